@@ -0,0 +1,702 @@
+/*
+Copyright (c) by respective owners including Yahoo!, Microsoft, and
+individual contributors. All rights reserved.  Released under a BSD (revised)
+license as described in the file LICENSE.
+ */
+// Micro-benchmarks for the hot paths: text parsing, cache reading, hashing, interactions, the gd
+// learners, saving and loading weights and the allreduce reduction.  The data is synthetic and
+// generated from a fixed seed, so runs on one machine are comparable across builds.
+//
+// usage: vw_bench [--filter <substring>] [--repetitions <n>] [--min_time <ms>] [--json] [--list] [--allocations]
+//
+// Each benchmark is first sized so that one repetition lasts at least min_time, then repeated;
+// the median time per item is reported along with the fastest and slowest repetitions.
+//
+// With --allocations nothing is timed: each benchmark is warmed up and then run over a fixed number
+// of items while every heap allocation is counted, and the allocations per item are reported.  The
+// steady state of the learning paths should not allocate at all.
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <random>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "../vowpalwabbit/vw.h"
+#include "../vowpalwabbit/gd.h"
+#include "../vowpalwabbit/cache.h"
+#include "../vowpalwabbit/parser.h"
+#include "../vowpalwabbit/parse_example.h"
+#include "../vowpalwabbit/parse_primitives.h"
+#include "../vowpalwabbit/allreduce.h"
+#include "../vowpalwabbit/spanning_tree.h"
+#include "../vowpalwabbit/hash.h"
+
+using namespace std;
+
+// heap allocations, counted while counting_allocations is set.  glibc's own entry points are
+// called underneath, so this only works against glibc.
+atomic<bool> counting_allocations(false);
+atomic<size_t> allocations(0);
+
+extern "C"
+{ void* __libc_malloc(size_t size);
+  void* __libc_calloc(size_t count, size_t size);
+  void* __libc_realloc(void* ptr, size_t size);
+  void* __libc_memalign(size_t alignment, size_t size);
+
+  inline void count_allocation()
+  { if (counting_allocations.load(memory_order_relaxed))
+      allocations.fetch_add(1, memory_order_relaxed);
+  }
+
+  void* malloc(size_t size)
+  { count_allocation();
+    return __libc_malloc(size);
+  }
+
+  void* calloc(size_t count, size_t size)
+  { count_allocation();
+    return __libc_calloc(count, size);
+  }
+
+  void* realloc(void* ptr, size_t size)
+  { count_allocation();
+    return __libc_realloc(ptr, size);
+  }
+
+  int posix_memalign(void** ptr, size_t alignment, size_t size)
+  { count_allocation();
+    *ptr = __libc_memalign(alignment, size);
+    return *ptr == nullptr ? ENOMEM : 0;
+  }
+
+  void* aligned_alloc(size_t alignment, size_t size)
+  { count_allocation();
+    return __libc_memalign(alignment, size);
+  }
+}
+
+struct result
+{ string name;
+  string unit; // what one item is
+  size_t items; // per repetition
+  vector<double> ns; // per item, one entry per repetition
+  double allocations; // per item, with --allocations
+};
+
+struct runner
+{ string filter;
+  size_t repetitions;
+  double min_time; // seconds per repetition
+  bool list;
+  bool json;
+  bool count_allocations;
+  vector<result> results;
+
+  bool wants(const string& name) { return name.find(filter) != string::npos; }
+
+  // whether any benchmark named group/... can match; the filter may name one of them
+  bool wants_group(const string& group) { return wants(group) || filter.compare(0, group.size(), group) == 0; }
+
+  // run(n) processes n items; n is always a multiple of batch, for benchmarks that work on whole
+  // buffers of batch items at a time
+  void run(const string& name, const string& unit, function<void(size_t)> run, size_t batch = 1)
+  { if (!wants(name))
+      return;
+    if (list)
+    { printf("%s\n", name.c_str());
+      return;
+    }
+
+    // warm up caches and lazily allocated state, going at least once through the 64 examples most
+    // benchmarks cycle through
+    size_t n = (64 + batch - 1) / batch * batch;
+    run(n);
+    n = batch;
+    if (count_allocations)
+    { n = (1000 + batch - 1) / batch * batch;
+      allocations = 0;
+      counting_allocations = true;
+      run(n);
+      counting_allocations = false;
+      result r = { name, unit, n, vector<double>(), (double)allocations / n };
+      results.push_back(r);
+      if (!json)
+        print(r);
+      return;
+    }
+
+    while (true)
+    { double t = time(run, n);
+      if (t >= min_time)
+        break;
+      n = t > min_time / 64 ? (size_t)(n * 1.2 * min_time / t) + 1 : n * 8;
+      n = (n + batch - 1) / batch * batch;
+    }
+
+    result r = { name, unit, n, vector<double>(), 0. };
+    for (size_t i = 0; i < repetitions; i++)
+      r.ns.push_back(time(run, n) * 1e9 / n);
+    sort(r.ns.begin(), r.ns.end());
+    results.push_back(r);
+    if (!json)
+      print(r);
+  }
+
+  static double time(function<void(size_t)>& run, size_t n)
+  { chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    run(n);
+    return chrono::duration<double>(chrono::steady_clock::now() - start).count();
+  }
+
+  static double median(const result& r) { return r.ns[r.ns.size() / 2]; }
+
+  void print(const result& r)
+  { if (count_allocations)
+    { printf("%-40s %12.3f allocations/%s\n", r.name.c_str(), r.allocations, r.unit.c_str());
+      fflush(stdout);
+      return;
+    }
+    printf("%-40s %12.1f ns/%-8s %14.0f %ss/s   [%.1f, %.1f]\n", r.name.c_str(), median(r), r.unit.c_str(),
+           1e9 / median(r), r.unit.c_str(), r.ns.front(), r.ns.back());
+    fflush(stdout);
+  }
+
+  void print_json()
+  { printf("{\"version\": \"%s\", \"repetitions\": %zu, \"min_time_ms\": %g, \"benchmarks\": [", version.to_string().c_str(), repetitions, min_time * 1e3);
+    for (size_t i = 0; i < results.size(); i++)
+    { result& r = results[i];
+      if (count_allocations)
+      { printf("%s\n  {\"name\": \"%s\", \"unit\": \"%s\", \"allocations_per_item\": %.3f, \"items\": %zu}",
+               i == 0 ? "" : ",", r.name.c_str(), r.unit.c_str(), r.allocations, r.items);
+        continue;
+      }
+      printf("%s\n  {\"name\": \"%s\", \"unit\": \"%s\", \"ns_per_item\": %.3f, \"items_per_second\": %.1f, "
+             "\"min_ns\": %.3f, \"max_ns\": %.3f, \"items_per_repetition\": %zu}",
+             i == 0 ? "" : ",", r.name.c_str(), r.unit.c_str(), median(r), 1e9 / median(r), r.ns.front(), r.ns.back(), r.items);
+    }
+    printf("\n]}\n");
+  }
+};
+
+// synthetic examples
+
+mt19937 rng(17);
+
+string random_word(size_t vocabulary) { return "w" + to_string(rng() % vocabulary); }
+
+float random_value() { return (float)(rng() % 2000) / 1000.f - 1.f; }
+
+string random_label() { return rng() % 2 ? "1" : "-1"; }
+
+// one namespace of 10 words
+string short_example()
+{ stringstream s;
+  s << random_label() << " |a";
+  for (size_t i = 0; i < 10; i++)
+    s << ' ' << random_word(100000);
+  return s.str();
+}
+
+// 10 namespaces of 10 weighted words
+string namespaces_example()
+{ stringstream s;
+  s << random_label();
+  for (char ns = 'a'; ns < 'k'; ns++)
+  { s << " |" << ns;
+    for (size_t i = 0; i < 10; i++)
+      s << ' ' << random_word(10000) << ':' << random_value();
+  }
+  return s.str();
+}
+
+// 256 numbered features, as from an embedding
+string dense_example()
+{ stringstream s;
+  s << random_label() << " |x";
+  for (size_t i = 0; i < 256; i++)
+    s << ' ' << i << ':' << random_value();
+  return s.str();
+}
+
+// 20 features with 40 character names
+string long_names_example()
+{ stringstream s;
+  s << random_label() << " |a";
+  for (size_t i = 0; i < 20; i++)
+  { string w = random_word(100000);
+    s << ' ' << w << string(40 - w.size(), 'x');
+  }
+  return s.str();
+}
+
+// namespaces a, b, c and d of 10 words each, for the interactions
+string four_namespaces_example()
+{ stringstream s;
+  s << random_label();
+  for (char ns = 'a'; ns < 'e'; ns++)
+  { s << " |" << ns;
+    for (size_t i = 0; i < 10; i++)
+      s << ' ' << random_word(100000);
+  }
+  return s.str();
+}
+
+struct shape
+{ const char* name;
+  string (*generate)();
+};
+
+shape shapes[] = { {"short", short_example}, {"namespaces", namespaces_example}, {"dense", dense_example}, {"long_names", long_names_example} };
+
+string temp_dir;
+vector<string> temp_files;
+
+string write_examples(const string& name, string (*generate)(), size_t count)
+{ string path = temp_dir + "/" + name;
+  temp_files.push_back(path);
+  FILE* f = fopen(path.c_str(), "w");
+  if (f == nullptr)
+  { fprintf(stderr, "can't write %s\n", path.c_str());
+    exit(1);
+  }
+  for (size_t i = 0; i < count; i++)
+    fprintf(f, "%s\n", generate().c_str());
+  fclose(f);
+  return path;
+}
+
+vector<example*> read_examples(vw& all, string (*generate)(), size_t count)
+{ vector<example*> examples;
+  for (size_t i = 0; i < count; i++)
+    examples.push_back(VW::read_example(all, generate()));
+  return examples;
+}
+
+// reads one example after another through the instance's reader, starting over at the end
+void read_source(vw& all, example* ec, size_t n)
+{ v_array<example*> examples = v_init<example*>();
+  examples.push_back(ec);
+  for (size_t i = 0; i < n; i++)
+  { while (all.p->reader(&all, examples) == 0)
+    { if (all.p->resettable)
+        reset_source(all, all.num_bits);
+      else
+      { all.p->input->reset_file(all.p->input->files[0]);
+        all.p->input->current = 0;
+      }
+      VW::empty_example(all, *ec);
+    }
+    VW::empty_example(all, *ec);
+  }
+  examples.delete_v();
+}
+
+void bench_read(runner& r)
+{ for (shape& s : shapes)
+  { string text_name = string("text/") + s.name, cache_name = string("cache/") + s.name;
+    if (!r.wants(text_name) && !r.wants(cache_name))
+      continue;
+    string text = write_examples(s.name, s.generate, 2000);
+    string cache = text + ".cache";
+    temp_files.push_back(cache);
+
+    vw* all = VW::initialize("--quiet --noop -d " + text);
+    example* ec = VW::alloc_examples(all->p->lp.label_size, 1);
+    r.run(text_name, "example", [&](size_t n) { read_source(*all, ec, n); });
+    VW::dealloc_example(all->p->lp.delete_label, *ec);
+    free(ec);
+    VW::finish(*all);
+
+    if (!r.wants(cache_name))
+      continue;
+    all = VW::initialize("--quiet --noop -d " + text + " --cache_file " + cache);
+    VW::start_parser(*all);
+    LEARNER::generic_driver(*all);
+    VW::end_parser(*all);
+    VW::finish(*all);
+
+    all = VW::initialize("--quiet --noop --cache_file " + cache);
+    ec = VW::alloc_examples(all->p->lp.label_size, 1);
+    r.run(cache_name, "example", [&](size_t n) { read_source(*all, ec, n); });
+    VW::dealloc_example(all->p->lp.delete_label, *ec);
+    free(ec);
+    VW::finish(*all);
+  }
+}
+
+void bench_hash(runner& r)
+{ size_t lengths[] = { 6, 16, 64 };
+  for (size_t length : lengths)
+  { vector<string> keys;
+    for (size_t i = 0; i < 64; i++)
+    { string key;
+      for (size_t j = 0; j < length; j++)
+        key += (char)('a' + rng() % 26);
+      keys.push_back(key);
+    }
+
+    uint64_t sink = 0;
+    r.run("hash/uniform_hash/" + to_string(length), "key", [&](size_t n)
+    { for (size_t i = 0; i < n; i++)
+      { const string& k = keys[i & 63];
+        sink += uniform_hash(k.c_str(), k.size(), sink & 1);
+      }
+    });
+    r.run("hash/hashstring/" + to_string(length), "key", [&](size_t n)
+    { for (size_t i = 0; i < n; i++)
+      { string& k = keys[i & 63];
+        substring s = { &k[0], &k[0] + k.size() };
+        sink += hashstring(s, sink & 1);
+      }
+    });
+    if (sink == 1) // keep the hashes alive
+      printf(" ");
+  }
+}
+
+void bench_interactions(runner& r)
+{ // generic is the loop over interactions of any length, the others have their own
+  // shared_prefix are interactions that start with the same namespaces
+  const char* kinds[][2] = { {"quadratic", "-q ab"}, {"cubic", "--cubic abc"}, {"generic", "--interactions abcd"},
+    {"shared_prefix", "-q ab -q ac -q ad --cubic abc --cubic abd"}
+  };
+  for (auto& kind : kinds)
+  { string name = string("interactions/") + kind[0];
+    if (!r.wants(name))
+      continue;
+    vw* all = VW::initialize(string("--quiet --noconstant -b 18 ") + kind[1]);
+    vector<example*> examples = read_examples(*all, four_namespaces_example, 64);
+    float sink = 0;
+    r.run(name, "example", [&](size_t n)
+    { for (size_t i = 0; i < n; i++)
+        INTERACTIONS::generate_interactions<float, const float&, GD::vec_add>(*all, *examples[i & 63], sink);
+    });
+    for (example* ec : examples)
+      VW::finish_example(*all, ec);
+    VW::finish(*all);
+  }
+}
+
+// small weights everywhere, as fp32 or replacing them as --quantize_model does
+void fill_weights(vw& all, quantize_kind kind)
+{ size_t length = (size_t)1 << all.num_bits;
+  uint32_t ss = all.weights.stride_shift();
+  if (kind == quantize_none)
+    for (size_t i = 0; i < length; i++)
+      all.weights.dense_weights[i << ss] = (float)(i % 97) * 1e-3f;
+  else if (kind == quantize_fp16)
+  { all.weights.half_weights.allocate(length, ss);
+    for (size_t i = 0; i < length; i++)
+      all.weights.half_weights.values()[i] = float_to_half((float)(i % 97) * 1e-3f);
+  }
+  else
+  { all.weights.int8_weights.allocate(length, ss);
+    for (size_t i = 0; i < length; i++)
+      all.weights.int8_weights.values()[i] = (int8_t)(i % 97);
+    for (size_t b = 0; b < all.weights.int8_weights.blocks(length); b++)
+      all.weights.int8_weights.scales()[b] = 1e-3f;
+  }
+  all.weights.quantized = kind;
+  if (kind != quantize_none)
+    all.weights.dense_weights.free_values();
+}
+
+void bench_gd(runner& r)
+{ // one per update rule gd specializes on
+  const char* rules[][2] =
+  { {"default", ""}, {"sgd", "--sgd"}, {"adaptive", "--adaptive"}, {"normalized", "--normalized"},
+    {"invariant", "--invariant"}, {"adaptive_normalized", "--adaptive --normalized"},
+    {"power_t", "--power_t 0.3"}, {"sparse_l2", "--sparse_l2 0.001"}, {"l1", "--l1 1e-7"},
+    {"simd", "--simd"}, {"predict", "-t"}, {"quadratic", "-q ab"}, {"cubic", "--cubic abc"},
+    {"generic", "--interactions abcd"}, {"quadratic_b24", "-b 24 -q ab -q ac -q ad"},
+    {"quadratic_b24_prefetch", "-b 24 -q ab -q ac -q ad --weight_prefetch"},
+    {"sparse", "--sparse_weights"}, {"sparse_quadratic_b32", "-b 32 -q ab -q ac -q ad --sparse_weights"},
+    {"predict_batch", "-t"}, // 16 examples per call, as the driver hands them out
+    // -t on --quantize_model weights, every weight written so that no page is the shared zero page
+    {"predict_filled", "-t"}, {"predict_fp16", "-t"}, {"predict_int8", "-t"},
+    {"predict_b24_filled", "-t -b 24 -q ab -q ac -q ad"}, {"predict_b24_fp16", "-t -b 24 -q ab -q ac -q ad"},
+    {"predict_b24_int8", "-t -b 24 -q ab -q ac -q ad"}
+  };
+  shape gd_shapes[] = { {"namespaces", namespaces_example}, {"dense", dense_example} };
+  for (auto& rule : rules)
+    for (shape& s : gd_shapes)
+    { string name = string("gd/") + rule[0] + "/" + s.name;
+      if (!r.wants(name))
+        continue;
+      string bits = strstr(rule[1], "-b ") == nullptr ? "-b 20 " : "";
+      vw* all = VW::initialize(string("--quiet ") + bits + rule[1]);
+      if (strstr(rule[0], "predict_") != nullptr && strcmp(rule[0], "predict_batch") != 0)
+        fill_weights(*all, strstr(rule[0], "fp16") ? quantize_fp16 : strstr(rule[0], "int8") ? quantize_int8 : quantize_none);
+      vector<example*> examples = read_examples(*all, s.generate, 64);
+      if (strcmp(rule[0], "predict_batch") == 0)
+        r.run(name, "example", [&](size_t n)
+        { for (size_t i = 0; i < n; i += 16)
+            all->l->predict_batch(&examples[i & 63], 16);
+        }, 16);
+      else
+        r.run(name, "example", [&](size_t n)
+        { for (size_t i = 0; i < n; i++)
+            all->learn(examples[i & 63]);
+        });
+      for (example* ec : examples)
+        VW::finish_example(*all, ec);
+      VW::finish(*all);
+    }
+}
+
+// the reductions that add features to an example on top of gd
+void bench_reductions(runner& r)
+{ if (r.wants("reductions/lrq"))
+  { vw* all = VW::initialize("--quiet -b 20 --lrq ab5");
+    vector<example*> examples = read_examples(*all, four_namespaces_example, 64);
+    r.run("reductions/lrq", "example", [&](size_t n)
+    { for (size_t i = 0; i < n; i++)
+        all->learn(examples[i & 63]);
+    });
+    for (example* ec : examples)
+      VW::finish_example(*all, ec);
+    VW::finish(*all);
+  }
+
+  if (r.wants("reductions/wap_ldf"))
+  { // 4 actions of 10 words, then the empty line that ends the multiline example
+    vw* all = VW::initialize("--quiet -b 20 --wap_ldf multiline");
+    vector<example*> examples;
+    for (size_t i = 0; i < 4; i++)
+    { stringstream s;
+      s << i + 1 << ':' << rng() % 2 << " |a";
+      for (size_t j = 0; j < 10; j++)
+        s << ' ' << random_word(100000);
+      examples.push_back(VW::read_example(*all, s.str()));
+    }
+    examples.push_back(VW::read_example(*all, string()));
+    r.run("reductions/wap_ldf", "example", [&](size_t n)
+    { for (size_t i = 0; i < n; i++)
+        for (example* ec : examples)
+          all->learn(ec);
+    });
+    for (example* ec : examples)
+      VW::finish_example(*all, ec);
+    VW::finish(*all);
+  }
+}
+
+void bench_save_load(runner& r)
+{ if (!r.wants_group("save_load/"))
+    return;
+  vw* all = VW::initialize("--quiet -b 20 --random_weights 1");
+  string model = temp_dir + "/weights";
+  temp_files.push_back(model);
+  size_t weights = (size_t)1 << all->num_bits;
+  r.run("save_load/save", "weight", [&](size_t n)
+  { for (size_t done = 0; done < n; done += weights)
+    { io_buf file;
+      file.open_file(model.c_str(), false, io_buf::WRITE);
+      GD::save_load_regressor(*all, file, false, false);
+      file.flush();
+      file.close_file();
+    }
+  }, weights);
+  r.run("save_load/load", "weight", [&](size_t n)
+  { for (size_t done = 0; done < n; done += weights)
+    { io_buf file;
+      file.open_file(model.c_str(), false, io_buf::READ);
+      GD::save_load_regressor(*all, file, true, false);
+      file.close_file();
+    }
+  }, weights);
+
+  // --dense_model: written whole, then copied into the strided array or mapped by a test-only instance
+  string dense = temp_dir + "/dense_weights";
+  temp_files.push_back(dense);
+  all->dense_model = true;
+  VW::set_weight(*all, constant, 0, 0.); // or the mapping would overwrite it
+  r.run("save_load/save_dense", "weight", [&](size_t n)
+  { for (size_t done = 0; done < n; done += weights)
+    { io_buf file;
+      file.open_file(dense.c_str(), false, io_buf::WRITE);
+      GD::save_load_regressor(*all, file, false, false);
+      file.flush();
+      file.close_file();
+    }
+  }, weights);
+  r.run("save_load/load_dense", "weight", [&](size_t n)
+  { for (size_t done = 0; done < n; done += weights)
+    { io_buf file;
+      file.open_file(dense.c_str(), false, io_buf::READ);
+      GD::save_load_regressor(*all, file, true, false);
+      file.close_file();
+    }
+  }, weights);
+  all->dense_model = false;
+
+  // --compress_model: deflated chunks, on as many threads as there are cores
+  string chunks = temp_dir + "/chunked_weights";
+  temp_files.push_back(chunks);
+  all->compress_model = true;
+  r.run("save_load/save_chunks", "weight", [&](size_t n)
+  { for (size_t done = 0; done < n; done += weights)
+    { io_buf file;
+      file.open_file(chunks.c_str(), false, io_buf::WRITE);
+      GD::save_load_regressor(*all, file, false, false);
+      file.flush();
+      file.close_file();
+    }
+  }, weights);
+  r.run("save_load/load_chunks", "weight", [&](size_t n)
+  { for (size_t done = 0; done < n; done += weights)
+    { io_buf file;
+      file.open_file(chunks.c_str(), false, io_buf::READ);
+      GD::save_load_regressor(*all, file, true, false);
+      file.close_file();
+    }
+  }, weights);
+  all->compress_model = false;
+
+  vw* test = VW::initialize("--quiet -b 20 -t");
+  r.run("save_load/load_mapped", "weight", [&](size_t n)
+  { for (size_t done = 0; done < n; done += weights)
+    { io_buf file;
+      file.open_file(dense.c_str(), false, io_buf::READ);
+      GD::save_load_regressor(*test, file, true, false);
+      file.close_file();
+    }
+  }, weights);
+  VW::finish(*test);
+  VW::finish(*all);
+}
+
+void sum_float(float& c1, const float& c2) { c1 += c2; }
+
+void bench_allreduce(runner& r)
+{ if (!r.wants_group("allreduce/"))
+    return;
+  const size_t length = 1 << 20;
+  vector<float> a(length), b(length);
+  for (size_t i = 0; i < length; i++)
+  { a[i] = random_value();
+    b[i] = random_value();
+  }
+
+  // what each node does with its children's buffers in the socket implementation
+  r.run("allreduce/addbufs", "float", [&](size_t n)
+  { for (size_t done = 0; done < n; done += length)
+      addbufs<float, sum_float>(a.data(), b.data(), length);
+  }, length);
+
+  // the whole reduction between two threads of one process
+  r.run("allreduce/threads", "float", [&](size_t n)
+  { AllReduceThreads root(2, 0);
+    AllReduceThreads other(&root, 2, 1);
+    thread peer([&]()
+    { for (size_t done = 0; done < n; done += length)
+        other.all_reduce<float, sum_float>(b.data(), length);
+    });
+    for (size_t done = 0; done < n; done += length)
+      root.all_reduce<float, sum_float>(a.data(), length);
+    peer.join();
+  }, length);
+
+  // four nodes on threads of this process, talking over loopback through a span server of its own
+  VW::SpanningTree* span_server;
+  try
+  { span_server = new VW::SpanningTree;
+  }
+  catch (exception& e)
+  { cerr << "allreduce/*_sockets skipped, no span server: " << e.what() << endl;
+    return;
+  }
+  span_server->Start();
+  const size_t nodes = 4;
+  vector<vector<float>> buffers(nodes, a);
+  for (int ring = 0; ring < 2; ring++)
+  { vector<AllReduceSockets*> sockets;
+    for (size_t node = 0; node < nodes; node++)
+      sockets.push_back(new AllReduceSockets("localhost", ring, nodes, node, ring != 0));
+    r.run(ring ? "allreduce/ring_sockets" : "allreduce/tree_sockets", "float", [&](size_t n)
+    { vector<thread> peers;
+      for (size_t node = 0; node < nodes; node++)
+        peers.push_back(thread([&, node]()
+        { for (size_t done = 0; done < n; done += length)
+            sockets[node]->all_reduce<float, sum_float>(buffers[node].data(), length);
+        }));
+      for (thread& peer : peers)
+        peer.join();
+    }, length);
+    for (AllReduceSockets* node : sockets)
+      delete node;
+  }
+  delete span_server;
+}
+
+void remove_temp_files()
+{ for (string& f : temp_files)
+    remove(f.c_str());
+  rmdir(temp_dir.c_str());
+}
+
+int main(int argc, char** argv)
+{ runner r;
+  r.repetitions = 9;
+  r.min_time = 0.05;
+  r.json = false;
+  r.list = false;
+  r.count_allocations = false;
+  for (int i = 1; i < argc; i++)
+  { string arg = argv[i];
+    if (arg == "--filter" && i + 1 < argc)
+      r.filter = argv[++i];
+    else if (arg == "--repetitions" && i + 1 < argc)
+      r.repetitions = max(1, atoi(argv[++i]));
+    else if (arg == "--min_time" && i + 1 < argc)
+      r.min_time = atof(argv[++i]) / 1e3;
+    else if (arg == "--json")
+      r.json = true;
+    else if (arg == "--list")
+      r.list = true;
+    else if (arg == "--allocations")
+      r.count_allocations = true;
+    else
+    { fprintf(stderr, "usage: %s [--filter <substring>] [--repetitions <n>] [--min_time <ms>] [--json] [--list] [--allocations]\n", argv[0]);
+      return 1;
+    }
+  }
+
+  char dir[] = "/tmp/vw_bench.XXXXXX";
+  if (mkdtemp(dir) == nullptr)
+  { perror("mkdtemp");
+    return 1;
+  }
+  temp_dir = dir;
+
+  try
+  { bench_read(r);
+    bench_hash(r);
+    bench_interactions(r);
+    bench_gd(r);
+    bench_reductions(r);
+    bench_save_load(r);
+    bench_allreduce(r);
+  }
+  catch (exception& e)
+  { fprintf(stderr, "%s\n", e.what());
+    remove_temp_files();
+    return 1;
+  }
+
+  if (r.json)
+    r.print_json();
+  remove_temp_files();
+  return 0;
+}
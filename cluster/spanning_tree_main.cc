@@ -29,8 +29,14 @@ using namespace std;
 using namespace VW;
 
 int main(int argc, char* argv[])
-{ if (argc > 2)
-  { cout << "usage: spanning_tree [--nondaemon | pid_file]" << endl;
+{ size_t heartbeat_timeout = 10;
+  if (argc > 2 && strcmp("--heartbeat_timeout", argv[1]) == 0)
+  { heartbeat_timeout = strtoul(argv[2], nullptr, 10);
+    argv += 2;
+    argc -= 2;
+  }
+  if (argc > 2 || heartbeat_timeout == 0)
+  { cout << "usage: spanning_tree [--heartbeat_timeout seconds] [--nondaemon | pid_file]" << endl;
     exit(0);
   }
 
@@ -40,7 +46,7 @@ int main(int argc, char* argv[])
     else if (daemon(1,1))
       THROWERRNO("daemon: ");
 
-    SpanningTree spanningTree;
+    SpanningTree spanningTree(heartbeat_timeout);
 
     if (argc == 2 && strcmp("--nondaemon",argv[1])!=0)
     { ofstream pid_file;
@@ -46,6 +46,10 @@ ssize_t clr_io_buf::read_file(int f, void* buf, size_t nbytes)
   return readBytes;
 }
 
+int64_t clr_io_buf::file_offset()
+{ return -1;
+}
+
 size_t clr_io_buf::num_files()
 { return 1;
 }
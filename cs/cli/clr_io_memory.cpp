@@ -36,6 +36,10 @@ ssize_t clr_io_memory_buf::read_file(int f, void* buf, size_t nbytes)
   return left_over;
 }
 
+int64_t clr_io_memory_buf::file_offset()
+{ return -1;
+}
+
 size_t clr_io_memory_buf::num_files()
 { return 1;
 }
@@ -32,6 +32,8 @@ public:
 
   virtual ssize_t read_file(int f, void* buf, size_t nbytes);
 
+  virtual int64_t file_offset();
+
   virtual size_t num_files();
 
   virtual ssize_t write_file(int file, const void* buf, size_t nbytes);
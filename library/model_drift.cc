@@ -0,0 +1,89 @@
+// How far the predictions of a model saved with --quantize_model drift from those of the model it
+// was quantized from, over a data file:
+//
+//   model_drift model.fp32 model.int8 data.vw [more vw arguments for both]
+//
+// Both models score each line with -t.  Reported are the mean, root mean square and largest
+// difference of the raw scores and of the predictions, and on how many lines the raw score changed
+// sign, i.e. a binary decision would flip.  Meant for models with scalar predictions.
+#include <stdio.h>
+#include <math.h>
+#include <fstream>
+#include "../vowpalwabbit/parser.h"
+#include "../vowpalwabbit/vw.h"
+
+using namespace std;
+
+struct drift
+{ double sum;
+  double squares;
+  double largest;
+  size_t at;
+};
+
+void add(drift& d, float a, float b, size_t line)
+{ double delta = fabs((double)a - (double)b);
+  d.sum += delta;
+  d.squares += delta * delta;
+  if (delta > d.largest)
+  { d.largest = delta;
+    d.at = line;
+  }
+}
+
+void report(const char* what, drift& d, size_t lines)
+{ printf("%-11s mean %.6g  rms %.6g  max %.6g (line %zu)\n", what, d.sum / lines, sqrt(d.squares / lines), d.largest, d.at);
+}
+
+int main(int argc, char *argv[])
+{ if (argc < 4)
+  { cerr << "usage: " << argv[0] << " fp32_model quantized_model data_file [vw arguments]" << endl;
+    return 1;
+  }
+  string extra;
+  for (int i = 4; i < argc; i++)
+    extra += string(" ") + argv[i];
+
+  ifstream data(argv[3]);
+  if (!data)
+  { cerr << "can not open " << argv[3] << endl;
+    return 1;
+  }
+
+  vw* reference = VW::initialize(string("--quiet -t --no_stdin -i ") + argv[1] + extra);
+  vw* quantized = VW::initialize(string("--quiet -t --no_stdin -i ") + argv[2] + extra);
+
+  drift raw = {0., 0., 0., 0};
+  drift prediction = {0., 0., 0., 0};
+  size_t lines = 0;
+  size_t flips = 0;
+  string line;
+  while (getline(data, line))
+  { if (line.empty())
+      continue;
+    lines++;
+    example* a = VW::read_example(*reference, line);
+    example* b = VW::read_example(*quantized, line);
+    reference->learn(a);
+    quantized->learn(b);
+
+    add(raw, a->partial_prediction, b->partial_prediction, lines);
+    add(prediction, a->pred.scalar, b->pred.scalar, lines);
+    if ((a->partial_prediction > 0.f) != (b->partial_prediction > 0.f))
+      flips++;
+
+    VW::finish_example(*reference, a);
+    VW::finish_example(*quantized, b);
+  }
+
+  if (lines > 0)
+  { printf("%zu examples\n", lines);
+    report("raw score", raw, lines);
+    report("prediction", prediction, lines);
+    printf("sign flips  %zu (%.4f%%)\n", flips, 100. * flips / lines);
+  }
+
+  VW::finish(*reference);
+  VW::finish(*quantized);
+  return 0;
+}
@@ -0,0 +1,139 @@
+#!/bin/bash
+# -- allreduce recovery test: a node of a cluster of local processes is lost and replaced
+#
+#   cluster-recover-test.sh kill|stop nodes passes [vw options...]
+#
+# Trains with --allreduce_recover and a model saved after each pass.  Once node 1 has saved its third
+# pass it is killed, or stopped so that it goes quiet until the span server misses its beats.  The
+# nodes left must notice and join again, a node started in its place from the newest of those models
+# must join them on a new tree, and every node must end with the same weights.
+NAME='cluster-recover-test'
+
+export PATH="vowpalwabbit:../vowpalwabbit:${PATH}"
+# The VW under test
+VW=`which vw`
+SPANNING_TREE=../cluster/spanning_tree
+
+if [ $# -lt 3 ] || [ "$1" != kill -a "$1" != stop ]; then
+    echo "usage: $0 kill|stop nodes passes [vw options...]"
+    exit 1
+fi
+HOW=$1
+NODES=$2
+PASSES=$3
+shift 3
+OPTIONS="$*"
+VICTIM=1
+TRAINSET=train-sets/0001.dat
+WORK=$NAME.tmp
+
+if [ -x "$VW" ]; then
+    : cool found vw at: $VW
+else
+    echo "$NAME: can not find 'vw' in $PATH - sorry"
+    exit 1
+fi
+if [ -x "$SPANNING_TREE" ]; then
+    : cool found spanning_tree at: $SPANNING_TREE
+else
+    echo "$NAME: can not find $SPANNING_TREE - make spanning_tree first"
+    exit 1
+fi
+
+cleanup() {
+    kill -9 $Pids $VictimPid 2>/dev/null
+    [ -n "$SpanPid" ] && kill $SpanPid 2>/dev/null && wait $SpanPid 2>/dev/null
+    /bin/rm -rf $WORK
+}
+
+fail() {
+    echo "$NAME FAILED: $*"
+    exit 1
+}
+
+# waits up to a minute for the command to succeed
+wait_for() {
+    for ((t = 0; t < 600; t++)); do
+        "$@" && return 0
+        sleep 0.1
+    done
+    return 1
+}
+
+# node i [vw options...]: starts node i, which writes $WORK/node<i>.model
+node() {
+    local i=$1
+    shift
+    $VW --span_server localhost --total $NODES --node $i --unique_id $$ --allreduce_recover \
+        -d $WORK/part$i --cache_file $WORK/$i.$RANDOM.cache -k --holdout_off --save_resume \
+        -f $WORK/node$i.model $OPTIONS "$@" > $WORK/node$i.log 2>&1 &
+}
+
+# -- main
+trap cleanup EXIT
+/bin/rm -rf $WORK
+mkdir $WORK
+# passes long enough to lose a node in the middle of one
+for ((i = 0; i < NODES; i++)); do
+    for ((copy = 0; copy < 100; copy++)); do
+        awk -v nodes=$NODES -v node=$i 'NR % nodes == node' $TRAINSET
+    done > $WORK/part$i
+done
+
+$SPANNING_TREE --heartbeat_timeout 2 --nondaemon > $WORK/spanning_tree.log 2>&1 &
+SpanPid=$!
+sleep 0.2
+
+for ((i = 0; i < NODES; i++)); do
+    node $i --passes $PASSES --save_per_pass
+    if [ $i -eq $VICTIM ]; then
+        VictimPid=$!
+        disown $VictimPid # killed, not waited for
+    else
+        Pids="$Pids $!"
+    fi
+done
+
+wait_for test -f $WORK/node$VICTIM.model.2 || fail "node $VICTIM saved no third pass"
+if [ $HOW = kill ]; then
+    kill -9 $VictimPid
+else
+    kill -STOP $VictimPid
+fi
+wait_for grep -q "joining the span server again" $WORK/node*.log || fail "no node noticed node $VICTIM was lost"
+kill -9 $VictimPid 2>/dev/null
+VictimPid=""
+mv $WORK/node$VICTIM.log $WORK/lost.log
+
+# a node that finished the average the others lost may still be saving it
+sleep 1
+Newest=`ls $WORK/node*.model.* | awk -F. '{ print $NF }' | sort -n | tail -1`
+node $VICTIM -i `ls $WORK/node*.model.$Newest | head -1` --preserve_performance_counters --passes $(($PASSES - $Newest))
+Pids="$Pids $!"
+
+for Pid in $Pids; do
+    wait $Pid || fail "a node failed, see $WORK/node*.log"
+done
+Pids=""
+# vw exits 0 on most errors
+if grep -q -i error $WORK/node*.log; then
+    fail "a node failed, see $WORK/node*.log"
+fi
+# the nodes left may see a killed node go before the span server does, a stopped one only it can
+if [ $HOW = kill ]; then
+    grep -q "dropping its tree" $WORK/spanning_tree.log || fail "the span server did not drop the tree of node $VICTIM"
+else
+    grep -q "node $VICTIM has not beat" $WORK/spanning_tree.log || fail "the span server did not miss the beats of node $VICTIM"
+fi
+
+for ((i = 0; i < NODES; i++)); do
+    $VW -i $WORK/node$i.model -t -d /dev/null --quiet --readable_model $WORK/node$i.readable
+    grep -E '^[0-9]+:' $WORK/node$i.readable > $WORK/node$i.weights
+done
+if ! grep -q . $WORK/node0.weights; then
+    fail "the nodes learned no weights"
+fi
+for ((i = 1; i < NODES; i++)); do
+    cmp -s $WORK/node0.weights $WORK/node$i.weights || fail "nodes 0 and $i ended with different weights"
+done
+echo "$NAME: node $VICTIM of $NODES lost ($HOW) and replaced${OPTIONS:+ with $OPTIONS}, all nodes agree OK"
@@ -0,0 +1,130 @@
+#!/bin/bash
+# -- allreduce test: the nodes of a cluster as local processes over loopback
+#
+#   cluster-test.sh [-e epsilon | -l loss] nodes 'learner options' allreduce options...
+#
+# Splits a training set over the nodes and trains on them twice, once with
+# the plain allreduce up and down the spanning tree and once with the given
+# allreduce options (--allreduce_ring, --allreduce_sparse, --allreduce_weights,
+# --allreduce_gradients).  Every node must end with the same model, and the two
+# models must match up to the order the floats were summed in, or to -e epsilon
+# for options that round what is sent.  Options that learn a different model
+# (--allreduce_overlap) are held to -l loss instead: the average loss of the two
+# models over the whole training set may differ by at most that much.
+NAME='cluster-test'
+
+export PATH="vowpalwabbit:../vowpalwabbit:${PATH}"
+# The VW under test
+VW=`which vw`
+SPANNING_TREE=../cluster/spanning_tree
+EPSILON=0.0001
+LOSS=
+
+if [ "$1" = -e ]; then
+    EPSILON=$2
+    shift 2
+elif [ "$1" = -l ]; then
+    LOSS=$2
+    shift 2
+fi
+if [ $# -lt 3 ]; then
+    echo "usage: $0 [-e epsilon | -l loss] nodes 'learner options' allreduce options..."
+    exit 1
+fi
+NODES=$1
+LEARNER=$2
+shift 2
+VARIANT="$*"
+TRAINSET=train-sets/0001.dat
+WORK=$NAME.tmp
+
+if [ -x "$VW" ]; then
+    : cool found vw at: $VW
+else
+    echo "$NAME: can not find 'vw' in $PATH - sorry"
+    exit 1
+fi
+if [ -x "$SPANNING_TREE" ]; then
+    : cool found spanning_tree at: $SPANNING_TREE
+else
+    echo "$NAME: can not find $SPANNING_TREE - make spanning_tree first"
+    exit 1
+fi
+
+cleanup() {
+    [ -n "$SpanPid" ] && kill $SpanPid 2>/dev/null && wait $SpanPid 2>/dev/null
+    /bin/rm -rf $WORK
+}
+
+# -- main
+/bin/rm -rf $WORK
+mkdir $WORK
+for ((i = 0; i < NODES; i++)); do
+    awk -v nodes=$NODES -v node=$i 'NR % nodes == node' $TRAINSET > $WORK/part$i
+done
+
+$SPANNING_TREE --nondaemon > $WORK/spanning_tree.log 2>&1 &
+SpanPid=$!
+sleep 0.2
+
+# train run unique_id allreduce options...: every node writes $WORK/<run><node>.model
+train() {
+    local run=$1 unique_id=$2
+    shift 2
+    for ((i = 0; i < NODES; i++)); do
+        $VW --span_server localhost --total $NODES --node $i --unique_id $unique_id "$@" \
+            -d $WORK/part$i --cache_file $WORK/$run$i.cache -k $LEARNER --holdout_off --quiet \
+            -f $WORK/$run$i.model > $WORK/$run$i.log 2>&1 &
+        Pids="$Pids $!"
+    done
+    for Pid in $Pids; do
+        if ! wait $Pid; then
+            echo "$NAME FAILED: a node of the $run failed, see $WORK/${run}*.log"
+            kill $Pids 2>/dev/null
+            exit 1
+        fi
+    done
+    Pids=""
+    # vw exits 0 on most errors
+    if grep -q -i error $WORK/${run}*.log; then
+        echo "$NAME FAILED: a node of the $run failed, see $WORK/${run}*.log"
+        exit 1
+    fi
+    for ((i = 1; i < NODES; i++)); do
+        if ! cmp -s $WORK/${run}0.model $WORK/$run$i.model; then
+            echo "$NAME FAILED: nodes 0 and $i of the $run ended with different models"
+            exit 1
+        fi
+    done
+    $VW -i $WORK/${run}0.model -t -d /dev/null --quiet --readable_model $WORK/$run.weights
+}
+
+trap cleanup EXIT
+train tree $$
+train variant $(($$ + 1)) $VARIANT
+
+if ! grep -q -E '^[0-9]+:' $WORK/tree.weights; then
+    echo "$NAME FAILED: the tree learned no weights"
+    exit 1
+fi
+# loss run: the average loss of the run's model over the whole training set
+loss() {
+    $VW -i $WORK/${1}0.model -t -d $TRAINSET 2>&1 | awk '/^average loss/ { print $4 }'
+}
+
+if [ -n "$LOSS" ]; then
+    TreeLoss=`loss tree`
+    VariantLoss=`loss variant`
+    if ! awk -v t=$TreeLoss -v v=$VariantLoss -v l=$LOSS 'BEGIN { exit !(v - t <= l && t - v <= l) }'; then
+        echo "$NAME FAILED: loss $VariantLoss with $VARIANT, $TreeLoss with the tree"
+        exit 1
+    fi
+else
+    Differ=`paste -d: <(grep -E '^[0-9]+:' $WORK/tree.weights) <(grep -E '^[0-9]+:' $WORK/variant.weights) |
+        awk -F: -v e=$EPSILON '$1 != $3 || $2 - $4 > e || $4 - $2 > e { n++ } END { print n + 0 }'`
+    if [ $Differ -ne 0 ]; then
+        echo "$NAME FAILED: $Differ weights with $VARIANT differ from the tree's"
+        exit 1
+    fi
+fi
+echo "$NAME: $LEARNER with $VARIANT on $NODES nodes OK"
@@ -20,6 +20,18 @@ do
         --foreground)
             Foreground="$1"
             ;;
+        --serve)
+            Serve="$1"
+            ;;
+        --reload)
+            # start serving another model, then SIGHUP the daemon to swap in the one tested
+            Reload="$1"
+            ;;
+        --labels)
+            # serve a model that does not learn but is not -t, and send it labelled lines from
+            # several clients at once: the labels must leave the answers alone
+            Labels="$1"
+            ;;
         *)
             echo "$NAME: unknown argument $1"
             exit 1
@@ -35,6 +47,14 @@ else
     echo "$NAME: can not find 'vw' in $PATH - sorry"
     exit 1
 fi
+if [ $Reload ] && ! [ "$Serve" -a "$Foreground" ]; then
+    echo "$NAME: --reload needs --serve --foreground"
+    exit 1
+fi
+if [ $Labels ] && ! [ "$Serve" -a "$Foreground" ]; then
+    echo "$NAME: --labels needs --serve --foreground"
+    exit 1
+fi
 
 # -- and netcat
 NETCAT=`which netcat`
@@ -61,7 +81,13 @@ fi
 
 
 # A command (+pattern) that is unlikely to match anything but our own test
-DaemonCmd="$VW -t -i $MODEL --daemon $Foreground --num_children 1 --quiet --port $PORT"
+if [ $Labels ]; then
+    DaemonCmd="$VW -l 0 -i $MODEL --serve --serve_threads 4 --serve_batch 1 $Foreground --quiet --port $PORT"
+elif [ $Serve ]; then
+    DaemonCmd="$VW -t -i $MODEL --serve $Foreground --quiet --port $PORT"
+else
+    DaemonCmd="$VW -t -i $MODEL --daemon $Foreground --num_children 1 --quiet --port $PORT"
+fi
 # libtool may wrap vw with '.libs/lt-vw' so we need to be flexible
 # on the exact process pattern we try to kill.
 DaemonPat=`echo $DaemonCmd | sed 's/^[^ ]*vw /.*vw /'`
@@ -113,10 +139,42 @@ cat > $PREDREF <<EOF
 EOF
 
 # Train
-$VW -b 10 --quiet -d $TRAINSET -f $MODEL
+if [ $Reload ]; then
+    head -1 $TRAINSET | $VW -b 10 --quiet -f $MODEL
+else
+    $VW -b 10 --quiet -d $TRAINSET -f $MODEL
+fi
 
 DaemonPid=`start_daemon`
 
+# the daemon's answer to one line, on a connection of its own
+predict_line() {
+    exec 3<>/dev/tcp/localhost/$PORT || return 1
+    echo "$1" >&3
+    read -t 5 Answer <&3
+    exec 3<&-
+    echo "$Answer"
+}
+
+if [ $Reload ]; then
+    Line=`tail -1 $TRAINSET`
+    OldAnswer=`predict_line "$Line"`
+    $VW -b 10 --quiet -d $TRAINSET -f $MODEL.new
+    mv $MODEL.new $MODEL
+    kill -HUP $DaemonPid
+    # the new model is loaded in the background: wait up to 10 seconds for its answers
+    for ((t = 0; t < 100; t++)); do
+        Answer=`predict_line "$Line"`
+        [ -n "$Answer" -a "$Answer" != "$OldAnswer" ] && break
+        sleep 0.1
+    done
+    if [ -z "$Answer" -o "$Answer" = "$OldAnswer" ]; then
+        echo "$NAME FAILED: the daemon still answers '$Answer' 10 seconds after SIGHUP"
+        stop_daemon
+        exit 1
+    fi
+fi
+
 # Test --foreground argument
 PidsAreEqual=false
 for ProcessPid in $(pgrep -f "$DaemonPat" 2>&1)
@@ -139,6 +197,35 @@ else
     fi
 fi
 
+if [ $Labels ]; then
+    # the model's labels run up to 0.99: the last two lines would score above it
+    LabelRef="0.932836 a
+0.990000 b
+0.990000 c"
+    Clients=""
+    for ((c = 0; c < 4; c++)); do
+        (
+            exec 3<>/dev/tcp/localhost/$PORT || exit 1
+            printf "100 'a| a b c\n100 'b| a b c a b c\n-100 'c| b c b c\n" >&3
+            for ((l = 0; l < 3; l++)); do
+                read -t 5 Answer <&3
+                echo "$Answer"
+            done
+        ) > $PREDOUT.$c &
+        Clients="$Clients $!"
+    done
+    wait $Clients
+    for ((c = 0; c < 4; c++)); do
+        if [ "`cat $PREDOUT.$c`" != "$LabelRef" ]; then
+            echo "$NAME FAILED: a client sending labelled lines was answered with"
+            cat $PREDOUT.$c
+            stop_daemon
+            exit 1
+        fi
+    done
+    /bin/rm -f $PREDOUT.?
+fi
+
 # Test on train-set
 # OpenBSD netcat quits immediately after stdin EOF
 # nc.traditional does not, so let's use -q 1.
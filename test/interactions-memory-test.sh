@@ -0,0 +1,53 @@
+#!/bin/bash
+# -- interactions memory test: interactions sharing a prefix of two wide namespaces learn within a
+# fixed amount of memory, however many examples the ring holds
+#
+NAME='interactions-memory-test'
+
+export PATH="vowpalwabbit:../vowpalwabbit:${PATH}"
+# The VW under test
+VW=`which vw`
+
+TRAINSET=$NAME.train
+PREDOUT=$NAME.predict
+EXAMPLES=300
+# kilobytes of address space vw may use: caching the 250000 pairs of the prefix ab for each example
+# of the ring would take 1.5 GB
+MEMORY=400000
+
+# -- make sure we can find vw first
+if [ -x "$VW" ]; then
+    : cool found vw at: $VW
+else
+    echo "$NAME: can not find 'vw' in $PATH - sorry"
+    exit 1
+fi
+
+cleanup() {
+    /bin/rm -f $TRAINSET $PREDOUT
+}
+
+# namespaces a and b of 500 features each; every 32nd example also has c and d to interact with
+cleanup
+awk -v n=$EXAMPLES 'BEGIN {
+    srand(1)
+    for (e = 0; e < n; e++) {
+        line = (e % 2) " |a"
+        for (i = 0; i < 500; i++) line = line " a" int(rand() * 100000)
+        line = line " |b"
+        for (i = 0; i < 500; i++) line = line " b" int(rand() * 100000)
+        if (e % 32 == 0) line = line " |c c |d d"
+        print line
+    }
+}' > $TRAINSET
+
+( ulimit -v $MEMORY; $VW -d $TRAINSET --interactions abc --interactions abd -b 18 --quiet -p $PREDOUT )
+Predictions=`cat $PREDOUT 2>/dev/null | wc -l`
+cleanup
+
+if [ $Predictions -eq $EXAMPLES ]; then
+    echo "$NAME: OK"
+    exit 0
+fi
+echo "$NAME FAILED: $Predictions of $EXAMPLES examples learned in $MEMORY KB"
+exit 1
@@ -0,0 +1,56 @@
+#!/bin/bash
+# -- --learner_threads test: a model learned over several passes on several threads predicts the
+# test set about as well as one learned on a single thread
+#
+#   learner-threads-test.sh threads tolerance [vw args]
+#
+NAME='learner-threads-test'
+
+export PATH="vowpalwabbit:../vowpalwabbit:${PATH}"
+# The VW under test
+VW=`which vw`
+
+TRAINSET=train-sets/rcv1_small.dat
+TESTSET=test-sets/rcv1_small_test.data
+
+if [ $# -lt 2 ]; then
+    echo "usage: $0 threads tolerance [vw args]"
+    exit 1
+fi
+THREADS=$1
+TOLERANCE=$2
+shift 2
+
+# -- make sure we can find vw first
+if [ -x "$VW" ]; then
+    : cool found vw at: $VW
+else
+    echo "$NAME: can not find 'vw' in $PATH - sorry"
+    exit 1
+fi
+
+cleanup() {
+    /bin/rm -f $NAME.*.model $NAME.*.cache
+}
+
+# average loss on the test set of a model learned on this many threads
+loss() {
+    $VW -d $TRAINSET --cache_file $NAME.$1.cache -k --passes 5 --learner_threads $1 --quiet -f $NAME.$1.model "${@:2}" || return 1
+    $VW -i $NAME.$1.model -t -d $TESTSET 2>&1 | awk '/^average loss/ { print $4 }'
+}
+
+cleanup
+Single=`loss 1 "$@"`
+Threaded=`loss $THREADS "$@"`
+cleanup
+
+if [ -z "$Single" -o -z "$Threaded" ]; then
+    echo "$NAME FAILED: no loss to compare"
+    exit 1
+fi
+if awk -v a=$Single -v b=$Threaded -v e=$TOLERANCE 'BEGIN { d = a - b; if (d < 0) d = -d; exit !(d <= e) }'; then
+    echo "$NAME: OK"
+    exit 0
+fi
+echo "$NAME FAILED: average loss $Threaded on $THREADS threads, $Single on one"
+exit 1
@@ -12,6 +12,12 @@ Alekh Agarwal and John Langford, with help Olivier Chapelle.
 #include <sys/timeb.h>
 #include <cmath>
 #include <stdint.h>
+#include <string.h>
+#include <algorithm>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <exception>
 #include "global_data.h"
 #include "vw_allreduce.h"
 
@@ -19,8 +25,123 @@ using namespace std;
 
 void add_float(float& c1, const float& c2) { c1 += c2; }
 
-void accumulate(vw& all, parameters& weights, size_t offset)
-{ uint64_t length = UINT64_ONE << all.num_bits; //This is size of gradient
+// --allreduce_sparse: the weights are cut into blocks, the nodes OR together a bitmap of the blocks
+// any of them has to send, and only those blocks are reduced, packed one after another.  A sum sends
+// the blocks that are not all zero.  An average sends the blocks that changed since the nodes last
+// agreed on them, which a fingerprint of each block finds; the others are the same on every node,
+// so averaging would leave them as they are.
+namespace SPARSE_ALLREDUCE
+{
+const uint64_t block_shift = 6;
+const uint64_t fnv_basis = 0xcbf29ce484222325ULL;
+const uint64_t fnv_prime = 0x100000001b3ULL;
+
+void or_bits(uint64_t& c1, const uint64_t& c2) { c1 |= c2; }
+
+struct blocks
+{ uint64_t size; // weights in a block
+  uint64_t count;
+  vector<uint64_t> bits; // one per block
+  vector<uint64_t> sent; // the blocks any node set, in order
+
+  blocks(vw& all)
+  { size = UINT64_ONE << min((uint64_t)all.num_bits, block_shift);
+    count = (UINT64_ONE << all.num_bits) / size;
+    bits.assign((count + 63) / 64, 0);
+  }
+
+  void set(uint64_t block) { bits[block / 64] |= UINT64_ONE << (block % 64); }
+
+  // returns the number of floats each node sends for the given slots of every weight
+  size_t agree(vw& all, size_t slots)
+  { all_reduce<uint64_t, or_bits>(all, bits.data(), bits.size());
+    for (uint64_t word = 0; word < bits.size(); word++)
+      for (uint64_t b = 0; b < 64; b++)
+        if (bits[word] & (UINT64_ONE << b))
+          sent.push_back(word * 64 + b);
+    return sent.size() * size * slots;
+  }
+
+  // copies slots [first, first + slots) of each weight of the sent blocks to packed, or back
+  void pack(dense_parameters& weights, size_t first, size_t slots, float* packed, bool back)
+  { for (uint64_t block : sent)
+      for (uint64_t i = block * size; i < (block + 1) * size; i++)
+      { weight* w = &weights[i << weights.stride_shift()] + first;
+        for (size_t s = 0; s < slots; s++, packed++)
+          if (back)
+            w[s] = *packed;
+          else
+            *packed = w[s];
+      }
+  }
+};
+
+// FNV-1a over the bits of slots [first, first + slots) of each weight in the block.  A block that
+// changed keeps its fingerprint with a chance of 2^-64.
+uint64_t fingerprint(dense_parameters& weights, uint64_t block, uint64_t size, size_t first, size_t slots)
+{ uint64_t h = fnv_basis;
+  for (uint64_t i = block * size; i < (block + 1) * size; i++)
+  { weight* w = &weights[i << weights.stride_shift()] + first;
+    for (size_t s = 0; s < slots; s++)
+    { uint32_t bits;
+      memcpy(&bits, w + s, sizeof(bits));
+      h = (h ^ bits) * fnv_prime;
+    }
+  }
+  return h;
+}
+
+// The blocks whose slots differ from the fingerprints of the last allreduce; before the first one
+// the fingerprints are of zeros.
+void set_changed(vw& all, blocks& b, dense_parameters& weights, size_t first, size_t slots)
+{ if (all.block_fingerprints.size() != b.count)
+  { uint64_t zeros = fnv_basis;
+    for (uint64_t i = 0; i < b.size * slots; i++)
+      zeros *= fnv_prime;
+    all.block_fingerprints.assign(b.count, zeros);
+  }
+  for (uint64_t block = 0; block < b.count; block++)
+    if (fingerprint(weights, block, b.size, first, slots) != all.block_fingerprints[block])
+      b.set(block);
+}
+
+void remember(vw& all, blocks& b, dense_parameters& weights, size_t first, size_t slots)
+{ for (uint64_t block : b.sent)
+    all.block_fingerprints[block] = fingerprint(weights, block, b.size, first, slots);
+}
+
+void accumulate(vw& all, dense_parameters& weights, size_t offset, wire_format wire)
+{ blocks b(all);
+  for (uint64_t block = 0; block < b.count; block++)
+    for (uint64_t i = block * b.size; i < (block + 1) * b.size; i++)
+      if ((&weights[i << weights.stride_shift()])[offset] != 0.f)
+      { b.set(block);
+        break;
+      }
+  vector<float> packed(b.agree(all, 1));
+  b.pack(weights, offset, 1, packed.data(), false);
+  all_reduce_sum(all, packed.data(), packed.size(), wire);
+  b.pack(weights, offset, 1, packed.data(), true);
+}
+
+void accumulate_avg(vw& all, dense_parameters& weights, size_t offset, wire_format wire)
+{ blocks b(all);
+  set_changed(all, b, weights, offset, 1);
+  vector<float> packed(b.agree(all, 1));
+  b.pack(weights, offset, 1, packed.data(), false);
+  all_reduce_sum(all, packed.data(), packed.size(), wire);
+  float numnodes = (float)all.all_reduce->total;
+  for (float& f : packed)
+    f /= numnodes;
+  b.pack(weights, offset, 1, packed.data(), true);
+  remember(all, b, weights, offset, 1);
+}
+}
+
+void accumulate(vw& all, parameters& weights, size_t offset, wire_format wire)
+{ if (all.allreduce_sparse)
+    return SPARSE_ALLREDUCE::accumulate(all, weights.dense_weights, offset, wire);
+  uint64_t length = UINT64_ONE << all.num_bits; //This is size of gradient
   float* local_grad = new float[length];
 
   if (weights.sparse)
@@ -30,7 +151,7 @@ void accumulate(vw& all, parameters& weights, size_t offset)
     for (uint64_t i = 0; i < length; i++)
       local_grad[i] = (&(weights.dense_weights[i << weights.dense_weights.stride_shift()]))[offset];    
   
-  all_reduce<float, add_float>(all, local_grad, length); //TODO: modify to not use first()
+  all_reduce_sum(all, local_grad, length, wire); //TODO: modify to not use first()
 
   if (weights.sparse)
     for (uint64_t i = 0; i < length; i++)
@@ -48,8 +169,10 @@ float accumulate_scalar(vw& all, float local_sum)
   return temp;
 }
 
-void accumulate_avg(vw& all, parameters& weights, size_t offset)
-{ uint32_t length = 1 << all.num_bits; //This is size of gradient
+void accumulate_avg(vw& all, parameters& weights, size_t offset, wire_format wire)
+{ if (all.allreduce_sparse)
+    return SPARSE_ALLREDUCE::accumulate_avg(all, weights.dense_weights, offset, wire);
+  uint32_t length = 1 << all.num_bits; //This is size of gradient
   float numnodes = (float)all.all_reduce->total;
   float* local_grad = new float[length];
 
@@ -60,7 +183,7 @@ void accumulate_avg(vw& all, parameters& weights, size_t offset)
     for (uint64_t i = 0; i < length; i++)
       local_grad[i] = (&(weights.dense_weights[i << weights.dense_weights.stride_shift()]))[offset];    
   
-  all_reduce<float, add_float>(all, local_grad, length); //TODO: modify to not use first()
+  all_reduce_sum(all, local_grad, length, wire); //TODO: modify to not use first()
 
   if (weights.sparse)
     for (uint64_t i = 0; i < length; i++)
@@ -86,32 +209,57 @@ float min_elem(float* arr, int length)
   return min;
 }
 
+inline void do_weighting(vw& all, float& local_weight, float* weight)
+{ if (local_weight > 0)
+    { float ratio = weight[1] / local_weight;
+      local_weight = weight[0] * ratio;
+      weight[0] *= ratio;
+      weight[1] *= ratio; //A crude max
+      if (all.normalized_updates)
+	weight[all.normalized_idx] *= ratio; //A crude max
+    }
+  else
+    {  local_weight = 0;
+      *weight = 0;
+    }
+}
+
 template<class T>
 void do_weighting(vw& all, uint64_t length, float* local_weights, T& weights)
 {
   for (uint64_t i = 0; i < length; i++)
-    {
-      float* weight = &weights[i << weights.stride_shift()];
-      if (local_weights[i] > 0)
-	{ float ratio = weight[1] / local_weights[i];
-	  local_weights[i] = weight[0] * ratio;
-	  weight[0] *= ratio;
-	  weight[1] *= ratio; //A crude max
-	  if (all.normalized_updates)
-	    weight[all.normalized_idx] *= ratio; //A crude max
-	}
-      else
-	{  local_weights[i] = 0;
-	  *weight = 0;
-	}
-    }
+    do_weighting(all, local_weights[i], &weights[i << weights.stride_shift()]);
+}
+
+namespace SPARSE_ALLREDUCE
+{
+void accumulate_weighted_avg(vw& all, dense_parameters& weights, wire_format wire)
+{ size_t stride = (size_t)1 << weights.stride_shift();
+  blocks b(all);
+  set_changed(all, b, weights, 0, stride);
+  vector<float> packed(b.agree(all, 1));
+  b.pack(weights, 1, 1, packed.data(), false);
+  all_reduce_sum(all, packed.data(), packed.size(), wire);
+  float* local_weight = packed.data();
+  for (uint64_t block : b.sent)
+    for (uint64_t i = block * b.size; i < (block + 1) * b.size; i++)
+      do_weighting(all, *local_weight++, &weights[i << weights.stride_shift()]);
+
+  packed.resize(packed.size() * stride);
+  b.pack(weights, 0, stride, packed.data(), false);
+  all_reduce_sum(all, packed.data(), packed.size(), wire);
+  b.pack(weights, 0, stride, packed.data(), true);
+  remember(all, b, weights, 0, stride);
+}
 }
 
-void accumulate_weighted_avg(vw& all, parameters& weights)
+void accumulate_weighted_avg(vw& all, parameters& weights, wire_format wire)
 { if(!all.adaptive)
   { all.trace_message<<"Weighted averaging is implemented only for adaptive gradient, use accumulate_avg instead\n";
     return;
   }
+  if (all.allreduce_sparse)
+    return SPARSE_ALLREDUCE::accumulate_weighted_avg(all, weights.dense_weights, wire);
   uint32_t length = 1 << all.num_bits; //This is the number of parameters
   float* local_weights = new float[length];
 
@@ -123,7 +271,7 @@ void accumulate_weighted_avg(vw& all, parameters& weights)
       local_weights[i] = (&(weights.dense_weights[i << weights.dense_weights.stride_shift()]))[1];    
 
   //First compute weights for averaging
-  all_reduce<float, add_float>(all, local_weights, length);
+  all_reduce_sum(all, local_weights, length, wire);
 
   if (weights.sparse)
     do_weighting(all, length, local_weights, weights.sparse_weights);
@@ -133,7 +281,128 @@ void accumulate_weighted_avg(vw& all, parameters& weights)
   if (weights.sparse)
     cout << "sparse parameters not supported with parallel computation!" << endl;
   else
-    all_reduce<float, add_float>(all, weights.dense_weights.first(), length*weights.stride_shift()); 
+    all_reduce_sum(all, weights.dense_weights.first(), (size_t)length << weights.stride_shift(), wire);
   delete[] local_weights;
 }
 
+void max_pass(uint64_t& c1, const uint64_t& c2) { c1 = max(c1, c2); }
+
+// --allreduce_recover: when a node is lost the span server builds a new tree of the nodes left and
+// one started in its place from the last checkpoint, and an average that failed is redone on it from
+// the weights as they were.  The nodes first agree on their passes: the average may have gone through
+// on some nodes before the loss, and the new node, restarted from the checkpoint of the pass before,
+// is a pass behind.  A node behind keeps its weights and catches up at its next pass, where the others
+// wait for it.
+const size_t max_rejoins = 10;
+
+void recover_average(vw& all, parameters& weights)
+{ AllReduceSockets& sockets = *(AllReduceSockets*)all.all_reduce;
+  dense_parameters& w = weights.dense_weights;
+  vector<weight> before(w.first(), w.first() + (((size_t)1 << all.num_bits) << w.stride_shift()));
+  for (size_t failures = 0;;)
+    try
+    { uint64_t passes[2] = { all.current_pass, ~(uint64_t)all.current_pass }; // the highest and the lowest
+      all_reduce<uint64_t, max_pass>(all, passes, 2);
+      if (passes[0] != ~passes[1])
+      { if (all.current_pass < passes[0])
+        { all.trace_message << "pass " << all.current_pass << " is behind pass " << passes[0]
+                            << " of other nodes, not averaged" << endl;
+          return;
+        }
+        continue;
+      }
+      if (all.adaptive)
+        accumulate_weighted_avg(all, weights, all.weights_wire);
+      else
+        accumulate_avg(all, weights, 0, all.weights_wire);
+      return;
+    }
+    catch (VW::vw_exception& e)
+    { if (++failures > max_rejoins)
+        throw;
+      all.trace_message << "allreduce failed (" << e.what() << "), joining the span server again" << endl;
+      sockets.reset();
+      memcpy(w.first(), before.data(), before.size() * sizeof(weight));
+    }
+}
+
+void average_weights(vw& all, parameters& weights)
+{ if (all.allreduce_recover)
+    recover_average(all, weights);
+  else if (all.adaptive)
+    accumulate_weighted_avg(all, weights, all.weights_wire);
+  else
+    accumulate_avg(all, weights, 0, all.weights_wire);
+}
+
+// --allreduce_overlap: the average of a copy of the weights, made on a thread of its own.  The
+// copies are kept from pass to pass.
+struct overlapped_average
+{ parameters snapshot; // averaged in place
+  vector<weight> start; // the weights when the copy was made
+  bool pending; // whether an average has started and not been added to the weights
+  thread reducer;
+  mutex started; // held until reducer is set
+  exception_ptr error;
+};
+
+void start_average(vw& all, parameters& weights)
+{ dense_parameters& w = weights.dense_weights;
+  size_t length = (size_t)1 << all.num_bits;
+  overlapped_average* a = all.overlapped;
+  if (a == nullptr)
+  { a = all.overlapped = new overlapped_average;
+    a->snapshot.sparse = false;
+    new(&a->snapshot.dense_weights) dense_parameters(length, w.stride_shift());
+    a->start.resize(length << w.stride_shift());
+    a->pending = false;
+  }
+  memcpy(a->snapshot.dense_weights.first(), w.first(), a->start.size() * sizeof(weight));
+  memcpy(a->start.data(), w.first(), a->start.size() * sizeof(weight));
+  a->pending = true;
+
+  lock_guard<mutex> l(a->started);
+  a->reducer = thread([&all, a]()
+  { { lock_guard<mutex> wait(a->started); }
+    try
+    { average_weights(all, a->snapshot);
+    }
+    catch (...)
+    { a->error = current_exception();
+    }
+  });
+}
+
+void wait_for_average(vw& all)
+{ overlapped_average* a = all.overlapped;
+  if (a == nullptr || !a->reducer.joinable() || a->reducer.get_id() == this_thread::get_id())
+    return;
+  a->reducer.join();
+  if (a->error)
+  { exception_ptr error = a->error;
+    a->error = nullptr;
+    a->pending = false;
+    rethrow_exception(error);
+  }
+}
+
+void finish_average(vw& all, parameters& weights)
+{ overlapped_average* a = all.overlapped;
+  if (a == nullptr || !a->pending)
+    return;
+  wait_for_average(all);
+  weight* w = weights.dense_weights.first();
+  const weight* average = a->snapshot.dense_weights.first();
+  for (size_t i = 0; i < a->start.size(); i++)
+    w[i] = average[i] + (w[i] - a->start[i]);
+  a->pending = false;
+}
+
+void free_average(vw& all)
+{ if (all.overlapped == nullptr)
+    return;
+  if (all.overlapped->reducer.joinable())
+    all.overlapped->reducer.join();
+  delete all.overlapped;
+  all.overlapped = nullptr;
+}
@@ -7,7 +7,19 @@ license as described in the file LICENSE.
 #pragma once
 #include "global_data.h"
 
-void accumulate(vw& all, parameters& weights, size_t o);
+void accumulate(vw& all, parameters& weights, size_t o, wire_format wire);
 float accumulate_scalar(vw& all, float local_sum);
-void accumulate_weighted_avg(vw& all, parameters& weights);
-void accumulate_avg(vw& all, parameters& weights, size_t o);
+void accumulate_weighted_avg(vw& all, parameters& weights, wire_format wire);
+void accumulate_avg(vw& all, parameters& weights, size_t o, wire_format wire);
+
+// The average of the weights over the nodes gd takes at the end of a pass: weighted with adaptive,
+// and with --allreduce_recover redone on a new tree if a node is lost.
+void average_weights(vw& all, parameters& weights);
+
+// --allreduce_overlap: start_average averages a copy of the weights on a thread of its own, while
+// learning goes on; finish_average waits for it and sets each weight to its average plus what it
+// learned since the copy.  Every other allreduce first waits for the average, so that the nodes
+// reduce in the same order.
+void start_average(vw& all, parameters& weights);
+void finish_average(vw& all, parameters& weights);
+void free_average(vw& all);
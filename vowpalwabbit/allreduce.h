@@ -7,6 +7,7 @@ license as described in the file LICENSE.
 
 #pragma once
 #include <string>
+#include <cstring>
 #ifdef _WIN32
 #include <WinSock2.h>
 #include <WS2tcpip.h>
@@ -44,6 +45,25 @@ typedef int socket_t;
 
 const size_t ar_buf_size = 1<<16;
 
+// A node asks the span server for a place in a ring rather than in the tree by setting this bit of
+// the node id it sends.  Servers that know no ring reject such an id as too large.
+const size_t ring_request = (size_t)1 << (8 * sizeof(size_t) - 1);
+
+// With --allreduce_recover a node sets this bit too, and keeps its connection to the span server
+// once it has its place in the tree: it sends beat_alive on it every second, and beat_done before it
+// ends.  The span server closes the connections of a tree when one of its nodes goes quiet, and builds
+// a new tree of the nodes that join again.
+const size_t recover_request = (size_t)1 << (8 * sizeof(size_t) - 2);
+const char beat_alive = 0;
+const char beat_done = 1;
+
+struct heartbeat; // allreduce_sockets.cc
+
+// How the floats AllReduceSockets::all_reduce_sum adds up travel between nodes: as they are, as
+// halves or as bf16 (the top half of a float), or with the runs of zeros left out.  Every node adds
+// in floats, and with 16 bit formats all end with the sums rounded the same way.
+enum wire_format : unsigned char { wire_raw, wire_fp16, wire_bf16, wire_zero_runs };
+
 struct node_socks
 { std::string current_master;
   socket_t parent;
@@ -177,6 +197,11 @@ private:
 
   void all_reduce_init();
 
+  bool recover;
+  heartbeat* beat; // while this node has a place in a tree of a recovering job, else nullptr
+  void watch(socket_t sock, bool on);
+  void stop_heartbeat(bool done);
+
   template <class T> void pass_up(char* buffer, size_t left_read_pos, size_t right_read_pos, size_t& parent_sent_pos)
   { size_t my_bufsize = (std::min)(ar_buf_size, (std::min)(left_read_pos, right_read_pos) / sizeof(T) * sizeof(T) - parent_sent_pos);
 
@@ -236,6 +261,8 @@ private:
             int read_size = recv(socks.children[i], child_read_buf[i] + child_unprocessed[i], (int)count, 0);
             if (read_size == -1)
               THROWERRNO("recv from child");
+            if (read_size == 0)
+              THROW("child closed the connection inside allreduce");
 
             addbufs<T, f>((T*)buffer + child_read_pos[i] / sizeof(T), (T*)child_read_buf[i], (child_read_pos[i] + read_size) / sizeof(T) - child_read_pos[i] / sizeof(T));
 
@@ -261,20 +288,115 @@ private:
   void pass_down(char* buffer, const size_t parent_read_pos, size_t& children_sent_pos);
   void broadcast(char* buffer, const size_t n);
 
-public:
-  AllReduceSockets(std::string pspan_server, const size_t punique_id, size_t ptotal, const size_t pnode)
-    : AllReduce(ptotal, pnode), span_server(pspan_server), unique_id(punique_id)
-  {
-  }
+  // The ring: socks.parent is the next node, socks.children[0] the previous one, and ring_rank this
+  // node's place, which the span server picks so that nodes on one host are neighbours.
+  bool ring;
+  size_t ring_rank;
+
+  // The buffer is cut into one segment per node.  In total - 1 steps of reduce-scatter each node
+  // sends a segment to the next node and adds the one arriving from the previous node, so that after
+  // them every node holds one segment summed over all nodes; in total - 1 steps of allgather those
+  // travel once more around the ring.  Each node sends and receives 2 (total - 1) / total of the
+  // buffer, whatever the number of nodes.
+  size_t ring_segment(size_t step, bool receive) const;
+  size_t ring_begin(size_t segment, size_t elements, size_t element_size) const;
+  void ring_wait(bool send, bool receive) const;
+  int ring_send(const char* data, size_t length);
+  int ring_recv(char* data, size_t length);
+
+  // all_reduce_sum in frames of wire_chunk floats, each encoded on its own, up and down the tree or
+  // around the ring
+  void reduce_frames(float* buffer, const size_t n, wire_format wire);
+  void broadcast_frames(float* buffer, const size_t n, wire_format wire);
+  void ring_frames(float* buffer, const size_t n, wire_format wire);
+
+  // The steps run as one stream: a segment is sent on as soon as, and as far as, it has arrived from
+  // the step before, so all links stay busy across steps and between the two halves.
+  template <class T, void(*f)(T&, const T&)> void ring_all_reduce(char* buffer, const size_t n)
+  { const size_t steps = 2 * (total - 1);
+    const size_t elements = n / sizeof(T);
+    char read_buf[ar_buf_size + sizeof(T) - 1];
+    size_t send_step = 0, sent = 0; // bytes of the segment of send_step already sent
+    size_t recv_step = 0, received = 0; // bytes of the segment of recv_step already received
+    size_t unprocessed = 0; // of those, bytes in read_buf short of a whole T
+
+    while (send_step < steps || recv_step < steps)
+    { size_t send_from = 0, send_length = 0;
+      if (send_step < steps)
+      { size_t segment = ring_segment(send_step, false);
+        send_from = ring_begin(segment, elements, sizeof(T));
+        send_length = ring_begin(segment + 1, elements, sizeof(T)) - send_from;
+        if (sent == send_length)
+        { send_step++;
+          sent = 0;
+          continue;
+        }
+      }
+      size_t recv_from = 0, recv_length = 0;
+      if (recv_step < steps)
+      { size_t segment = ring_segment(recv_step, true);
+        recv_from = ring_begin(segment, elements, sizeof(T));
+        recv_length = ring_begin(segment + 1, elements, sizeof(T)) - recv_from;
+        if (received == recv_length)
+        { recv_step++;
+          received = 0;
+          continue;
+        }
+      }
 
-  virtual ~AllReduceSockets()
-  {
+      // what is sent at a step is what arrived at the step before, summed in
+      size_t ready = 0;
+      if (send_step < steps)
+      { if (send_step == 0 || recv_step > send_step - 1)
+          ready = send_length;
+        else if (recv_step == send_step - 1)
+          ready = received - unprocessed;
+      }
+
+      // both sockets do not block, so only wait when neither moved
+      int write_size = 0, read_size = 0;
+      if (ready > sent)
+      { write_size = ring_send(buffer + send_from + sent, (std::min)(ar_buf_size, ready - sent));
+        sent += write_size;
+      }
+      if (recv_step < steps)
+      { size_t count = (std::min)(ar_buf_size, recv_length - received);
+        if (recv_step < total - 1)
+        { read_size = ring_recv(read_buf + unprocessed, count);
+          size_t whole = (unprocessed + read_size) / sizeof(T);
+          addbufs<T, f>((T*)(buffer + recv_from + received - unprocessed), (T*)read_buf, whole);
+          unprocessed = (unprocessed + read_size) % sizeof(T);
+          memmove(read_buf, read_buf + whole * sizeof(T), unprocessed);
+        }
+        else // the allgather half copies the sums straight into place
+          read_size = ring_recv(buffer + recv_from + received, count);
+        received += read_size;
+      }
+      if (write_size == 0 && read_size == 0)
+        ring_wait(ready > sent, recv_step < steps);
+    }
   }
 
+public:
+  AllReduceSockets(std::string pspan_server, const size_t punique_id, size_t ptotal, const size_t pnode, bool pring = false, bool precover = false);
+
+  virtual ~AllReduceSockets();
+
+  // --allreduce_recover: drops this node's place in the tree after a failed allreduce, so that the
+  // next all_reduce joins the span server again and meets the other nodes on a new tree
+  void reset();
+
   template <class T, void(*f)(T&, const T&)> void all_reduce(T* buffer, const size_t n)
   { if (span_server != socks.current_master)
       all_reduce_init();
+    if (ring)
+    { if (total > 1)
+        ring_all_reduce<T, f>((char*)buffer, n*sizeof(T));
+      return;
+    }
     reduce<T, f>((char*)buffer, n*sizeof(T));
     broadcast((char*)buffer, n*sizeof(T));
   }
+
+  void all_reduce_sum(float* buffer, const size_t n, wire_format wire);
 };
@@ -15,6 +15,11 @@ Alekh Agarwal and John Langford, with help Olivier Chapelle.
 #include <errno.h>
 #include <string.h>
 #include <stdlib.h>
+#include <vector>
+#include <algorithm>
+#include <thread>
+#include <mutex>
+#include <atomic>
 #ifdef _WIN32
 #include <WinSock2.h>
 #include <Windows.h>
@@ -22,10 +27,13 @@ Alekh Agarwal and John Langford, with help Olivier Chapelle.
 #include <io.h>
 #else
 #include <unistd.h>
+#include <fcntl.h>
+#include <signal.h>
 #include <arpa/inet.h>
 #endif
 #include <sys/timeb.h>
 #include "allreduce.h"
+#include "half.h"
 #include "vw_exception.h"
 
 using namespace std;
@@ -96,6 +104,122 @@ socket_t getsock()
   return sock;
 }
 
+void set_nonblocking(socket_t sock)
+{
+#ifdef _WIN32
+  u_long on = 1;
+  if (ioctlsocket(sock, FIONBIO, &on) != 0)
+    THROWERRNO("ioctlsocket FIONBIO");
+#else
+  int flags = fcntl(sock, F_GETFL, 0);
+  if (flags == -1 || fcntl(sock, F_SETFL, flags | O_NONBLOCK) == -1)
+    THROWERRNO("fcntl O_NONBLOCK");
+#endif
+}
+
+bool would_block()
+{
+#ifdef _WIN32
+  return WSAGetLastError() == WSAEWOULDBLOCK;
+#else
+  return errno == EAGAIN || errno == EWOULDBLOCK;
+#endif
+}
+
+void shut(socket_t sock)
+{
+#ifdef _WIN32
+  shutdown(sock, SD_BOTH);
+#else
+  shutdown(sock, SHUT_RDWR);
+#endif
+}
+
+// --allreduce_recover: a thread beats on the connection to the span server.  When the span server
+// closes it, having lost a node of the tree, or a beat does not go through, the thread shuts the
+// sockets to the other nodes, so that an allreduce waiting on them fails instead of hanging.
+struct heartbeat
+{ socket_t control;
+  std::thread thread;
+  std::atomic<bool> stop;
+  std::mutex lock; // over peers and lost
+  vector<socket_t> peers;
+  bool lost;
+};
+
+void beat_until_lost(heartbeat* b)
+{ while (!b->stop)
+  { fd_set fds;
+    FD_ZERO(&fds);
+    FD_SET(b->control, &fds);
+    timeval second = { 1, 0 };
+    int ready = select((int)b->control + 1, &fds, nullptr, nullptr, &second);
+    if (b->stop)
+      return;
+    if (ready != 0 || send(b->control, &beat_alive, 1, 0) != 1)
+    { cerr << "the span server dropped this node's tree" << endl;
+      lock_guard<mutex> l(b->lock);
+      b->lost = true;
+      for (socket_t sock : b->peers)
+        shut(sock);
+      return;
+    }
+  }
+}
+
+AllReduceSockets::AllReduceSockets(std::string pspan_server, const size_t punique_id, size_t ptotal, const size_t pnode, bool pring, bool precover)
+  : AllReduce(ptotal, pnode), span_server(pspan_server), unique_id(punique_id), recover(precover), beat(nullptr),
+    ring(pring), ring_rank(0)
+{
+#ifndef _WIN32
+  if (recover) // a node sending to one that died fails the send instead of dying with it
+    signal(SIGPIPE, SIG_IGN);
+#endif
+}
+
+AllReduceSockets::~AllReduceSockets()
+{ stop_heartbeat(true);
+}
+
+// the heartbeat shuts sock, which talks to other nodes of the tree, if it finds the tree lost
+void AllReduceSockets::watch(socket_t sock, bool on)
+{ if (beat == nullptr)
+    return;
+  lock_guard<mutex> l(beat->lock);
+  if (!on)
+    beat->peers.erase(std::remove(beat->peers.begin(), beat->peers.end(), sock), beat->peers.end());
+  else if (beat->lost)
+    shut(sock);
+  else
+    beat->peers.push_back(sock);
+}
+
+void AllReduceSockets::stop_heartbeat(bool done)
+{ if (beat == nullptr)
+    return;
+  if (done) // so that the span server does not take the end of this node for a loss
+    send(beat->control, &beat_done, 1, 0);
+  beat->stop = true;
+  shut(beat->control);
+  beat->thread.join();
+  CLOSESOCK(beat->control);
+  delete beat;
+  beat = nullptr;
+}
+
+void AllReduceSockets::reset()
+{ stop_heartbeat(false);
+  if (socks.current_master == "")
+    return;
+  if (socks.parent != -1)
+    CLOSESOCK(socks.parent);
+  for (int i = 0; i < 2; i++)
+    if (socks.children[i] != -1)
+      CLOSESOCK(socks.children[i]);
+  socks.parent = socks.children[0] = socks.children[1] = -1;
+  socks.current_master = "";
+}
+
 void AllReduceSockets::all_reduce_init()
 {
 #ifdef _WIN32
@@ -123,23 +247,31 @@ void AllReduceSockets::all_reduce_init()
   if(send(master_sock, (const char*)&total, sizeof(total), 0) < (int)sizeof(total))
     cerr << "write total=" << total << " to span server failed" << endl;
   else cerr << "wrote total=" << total << endl;
-  if(send(master_sock, (char*)&node, sizeof(node), 0) < (int)sizeof(node))
+  size_t request = node | (ring ? ring_request : 0) | (recover ? recover_request : 0);
+  if(send(master_sock, (char*)&request, sizeof(request), 0) < (int)sizeof(request))
     cerr << "write node=" << node << " to span server failed" << endl;
-  else cerr << "wrote node=" << node << endl;
+  else cerr << "wrote node=" << node << (ring ? " (ring)" : "") << endl;
   int ok;
   if (recv(master_sock, (char*)&ok, sizeof(ok), 0) < (int)sizeof(ok))
-    cerr << "read ok from span server failed" << endl;
-  else cerr << "read ok=" << ok << endl;
+  { CLOSESOCK(master_sock);
+    THROW("read ok from span server failed");
+  }
+  cerr << "read ok=" << ok << endl;
   if (!ok)
+  { CLOSESOCK(master_sock);
     THROW("mapper already connected");
+  }
 
   uint16_t kid_count;
   uint16_t parent_port;
   uint32_t parent_ip;
 
+  // a span server that gives up on the tree before it is built closes the connection here
   if(recv(master_sock, (char*)&kid_count, sizeof(kid_count), 0) < (int)sizeof(kid_count))
-    cerr << "read kid_count from span server failed" << endl;
-  else cerr << "read kid_count=" << kid_count << endl;
+  { CLOSESOCK(master_sock);
+    THROW("read kid_count from span server failed");
+  }
+  cerr << "read kid_count=" << kid_count << endl;
 
   socket_t sock = -1;
   short unsigned int netport = htons(26544);
@@ -182,7 +314,11 @@ void AllReduceSockets::all_reduce_init()
     cerr << "write netport failed!" << endl;
 
   if(recv(master_sock, (char*)&parent_ip, sizeof(parent_ip), 0) < (int)sizeof(parent_ip))
-    cerr << "read parent_ip failed!" << endl;
+  { CLOSESOCK(master_sock);
+    if (kid_count > 0)
+      CLOSESOCK(sock);
+    THROW("read parent_ip failed");
+  }
   else
   { char dotted_quad[INET_ADDRSTRLEN];
     if (nullptr == inet_ntop(AF_INET, (char*)&parent_ip, dotted_quad, INET_ADDRSTRLEN))
@@ -192,24 +328,51 @@ void AllReduceSockets::all_reduce_init()
       cerr << "read parent_ip=" << dotted_quad << endl;
   }
   if(recv(master_sock, (char*)&parent_port, sizeof(parent_port), 0) < (int)sizeof(parent_port))
-    cerr << "read parent_port failed!" << endl;
-  else cerr << "read parent_port=" << parent_port << endl;
+  { CLOSESOCK(master_sock);
+    if (kid_count > 0)
+      CLOSESOCK(sock);
+    THROW("read parent_port failed");
+  }
+  cerr << "read parent_port=" << parent_port << endl;
+
+  if (ring)
+  { if (recv(master_sock, (char*)&ring_rank, sizeof(ring_rank), 0) < (int)sizeof(ring_rank))
+      THROW("read ring position from span server failed");
+    cerr << "read ring position=" << ring_rank << endl;
+    if (total > 1 && (kid_count != 1 || parent_ip == (uint32_t)-1))
+      THROW("span server did not place this node in a ring");
+  }
 
-  CLOSESOCK(master_sock);
+  // the heartbeat starts before the other nodes connect, so that waiting on one that died ends too
+  if (recover)
+  { beat = new heartbeat;
+    beat->control = master_sock;
+    beat->stop = false;
+    beat->lost = false;
+    beat->thread = std::thread(beat_until_lost, beat);
+    if (kid_count > 0)
+      watch(sock, true);
+  }
+  else
+    CLOSESOCK(master_sock);
 
+  socks.parent = -1;
+  socks.children[0] = -1; socks.children[1] = -1;
   if(parent_ip != (uint32_t)-1)
   { socks.parent = sock_connect(parent_ip, parent_port);
+    watch(socks.parent, true);
   }
-  else
-    socks.parent = -1;
 
-  socks.children[0] = -1; socks.children[1] = -1;
   for (int i = 0; i < kid_count; i++)
   { sockaddr_in child_address;
     socklen_t size = sizeof(child_address);
     socket_t f = accept(sock,(sockaddr*)&child_address,&size);
     if (f < 0)
+    { watch(sock, false);
+      CLOSESOCK(sock);
       THROWERRNO("accept");
+    }
+    watch(f, true);
 
     // char hostname[NI_MAXHOST];
     // char servInfo[NI_MAXSERV];
@@ -219,7 +382,66 @@ void AllReduceSockets::all_reduce_init()
   }
 
   if (kid_count > 0)
+  { watch(sock, false);
     CLOSESOCK(sock);
+  }
+
+  if (ring && total > 1)
+  { set_nonblocking(socks.parent);
+    set_nonblocking(socks.children[0]);
+  }
+}
+
+size_t AllReduceSockets::ring_segment(size_t step, bool receive) const
+{ // reduce-scatter sends segment rank - step and receives rank - step - 1, allgather then sends
+  // rank + 1 - step and receives rank - step
+  size_t back;
+  if (step < total - 1)
+    back = receive ? step + 1 : step;
+  else
+  { step -= total - 1;
+    back = receive ? step : step + total - 1;
+  }
+  return (ring_rank + total - back % total) % total;
+}
+
+size_t AllReduceSockets::ring_begin(size_t segment, size_t elements, size_t element_size) const
+{ return elements * segment / total * element_size;
+}
+
+void AllReduceSockets::ring_wait(bool send, bool receive) const
+{ fd_set write_fds, read_fds;
+  FD_ZERO(&write_fds);
+  FD_ZERO(&read_fds);
+  if (send)
+    FD_SET(socks.parent, &write_fds);
+  if (receive)
+    FD_SET(socks.children[0], &read_fds);
+  socket_t max_fd = (std::max)(socks.parent, socks.children[0]) + 1;
+  if (select((int)max_fd, &read_fds, &write_fds, nullptr, nullptr) == -1)
+    THROWERRNO("select");
+}
+
+int AllReduceSockets::ring_send(const char* data, size_t length)
+{ int write_size = send(socks.parent, data, (int)length, 0);
+  if (write_size < 0)
+  { if (would_block())
+      return 0;
+    THROWERRNO("send to next node in ring");
+  }
+  return write_size;
+}
+
+int AllReduceSockets::ring_recv(char* data, size_t length)
+{ int read_size = recv(socks.children[0], data, (int)length, 0);
+  if (read_size < 0)
+  { if (would_block())
+      return 0;
+    THROWERRNO("recv from previous node in ring");
+  }
+  if (read_size == 0)
+    THROW("previous node in ring closed the connection");
+  return read_size;
 }
 
 
@@ -265,9 +487,329 @@ void AllReduceSockets::broadcast(char* buffer, const size_t n)
       size_t count = min(ar_buf_size,n-parent_read_pos);
       int read_size = recv(socks.parent, buffer + parent_read_pos, (int)count, 0);
       if(read_size == -1)
-      { cerr <<" recv from parent: " << strerror(errno) << endl;
-      }
+        THROWERRNO("recv from parent");
+      if(read_size == 0)
+        THROW("parent closed the connection inside allreduce");
       parent_read_pos += read_size;
     }
   }
 }
+
+// all_reduce_sum sends frames: the length of the payload as a uint32, then wire_chunk floats or
+// fewer, encoded.  Runs of zeros are groups of a uint16 count of zeros, a uint16 count of floats that
+// follow as they are, and those floats; a zero is one with all bits clear, so it is lossless.
+namespace
+{
+const size_t wire_chunk = ar_buf_size / sizeof(float);
+const size_t wire_frame = sizeof(uint32_t) + wire_chunk * sizeof(float) + 2 * sizeof(uint16_t);
+
+void add_floats(float& c1, const float& c2) { c1 += c2; }
+
+size_t encode(wire_format wire, const float* in, size_t n, char* out)
+{ switch (wire)
+  { case wire_fp16:
+      for (size_t i = 0; i < n; i++)
+      { uint16_t h = float_to_half(in[i]);
+        memcpy(out + i * sizeof(h), &h, sizeof(h));
+      }
+      return n * sizeof(uint16_t);
+    case wire_bf16:
+      for (size_t i = 0; i < n; i++)
+      { uint16_t h = float_to_bf16(in[i]);
+        memcpy(out + i * sizeof(h), &h, sizeof(h));
+      }
+      return n * sizeof(uint16_t);
+    case wire_zero_runs:
+    { char* p = out;
+      for (size_t i = 0; i < n;)
+      { uint32_t bits;
+        uint16_t zeros = 0, literals = 0;
+        for (; i < n && (memcpy(&bits, in + i, sizeof(bits)), bits == 0); i++)
+          zeros++;
+        const float* start = in + i;
+        for (; i < n && (memcpy(&bits, in + i, sizeof(bits)), bits != 0); i++)
+          literals++;
+        memcpy(p, &zeros, sizeof(zeros));
+        memcpy(p + sizeof(zeros), &literals, sizeof(literals));
+        p += sizeof(zeros) + sizeof(literals);
+        memcpy(p, start, literals * sizeof(float));
+        p += literals * sizeof(float);
+      }
+      return p - out;
+    }
+    default:
+      memcpy(out, in, n * sizeof(float));
+      return n * sizeof(float);
+  }
+}
+
+template <float (*convert)(uint16_t)> void decode_halves(const char* in, float* out, size_t n, bool add)
+{ uint16_t h;
+  if (add)
+    for (size_t i = 0; i < n; i++)
+    { memcpy(&h, in + i * sizeof(h), sizeof(h));
+      out[i] += convert(h);
+    }
+  else
+    for (size_t i = 0; i < n; i++)
+    { memcpy(&h, in + i * sizeof(h), sizeof(h));
+      out[i] = convert(h);
+    }
+}
+
+// adds the payload to out, or with add false overwrites out with it
+void decode(wire_format wire, const char* in, size_t bytes, float* out, size_t n, bool add)
+{ switch (wire)
+  { case wire_fp16:
+    case wire_bf16:
+      if (bytes != n * sizeof(uint16_t))
+        THROW("allreduce frame of " << bytes << " bytes for " << n << " floats");
+      if (wire == wire_fp16)
+        decode_halves<half_to_float>(in, out, n, add);
+      else
+        decode_halves<bf16_to_float>(in, out, n, add);
+      break;
+    case wire_zero_runs:
+    { size_t i = 0;
+      for (const char* end = in + bytes; in < end;)
+      { uint16_t zeros, literals;
+        if (end - in < (ptrdiff_t)(sizeof(zeros) + sizeof(literals)))
+          THROW("allreduce frame ends inside a run");
+        memcpy(&zeros, in, sizeof(zeros));
+        memcpy(&literals, in + sizeof(zeros), sizeof(literals));
+        in += sizeof(zeros) + sizeof(literals);
+        if (i + zeros + literals > n || end - in < (ptrdiff_t)(literals * sizeof(float)))
+          THROW("allreduce frame runs past its " << n << " floats");
+        if (!add)
+          memset(out + i, 0, zeros * sizeof(float));
+        i += zeros;
+        for (size_t j = 0; j < literals; j++, i++, in += sizeof(float))
+        { float f;
+          memcpy(&f, in, sizeof(f));
+          out[i] = add ? out[i] + f : f;
+        }
+      }
+      if (i != n)
+        THROW("allreduce frame of " << i << " floats, not " << n);
+      break;
+    }
+    default:
+      if (bytes != n * sizeof(float))
+        THROW("allreduce frame of " << bytes << " bytes for " << n << " floats");
+      if (add)
+        addbufs<float, add_floats>(out, (const float*)in, n);
+      else
+        memcpy(out, in, bytes);
+  }
+}
+
+// encodes the chunk of n floats into a frame, returning its length
+size_t encode_frame(wire_format wire, const float* chunk, size_t n, char* frame)
+{ uint32_t bytes = (uint32_t)encode(wire, chunk, n, frame + sizeof(bytes));
+  memcpy(frame, &bytes, sizeof(bytes));
+  return sizeof(bytes) + bytes;
+}
+
+// A frame arriving in pieces: the length, then the payload.
+class frame_reader
+{ std::vector<char> frame;
+  size_t have;
+  uint32_t length() const
+  { uint32_t bytes;
+    memcpy(&bytes, frame.data(), sizeof(bytes));
+    return bytes;
+  }
+public:
+  frame_reader() : frame(wire_frame), have(0) {}
+  char* next() { return frame.data() + have; }
+  size_t wanted() const { return have < sizeof(uint32_t) ? sizeof(uint32_t) - have : sizeof(uint32_t) + length() - have; }
+  const char* payload() const { return frame.data() + sizeof(uint32_t); }
+  size_t payload_size() const { return length(); }
+  // whether the frame is complete; if so the next bytes start another
+  bool got(size_t bytes)
+  { have += bytes;
+    if (have < sizeof(uint32_t))
+      return false;
+    if (sizeof(uint32_t) + length() > frame.size())
+      THROW("allreduce frame of " << length() << " bytes is too long");
+    return have == sizeof(uint32_t) + length();
+  }
+  void reset() { have = 0; }
+};
+
+void send_all(socket_t sock, const char* data, size_t length)
+{ while (length > 0)
+  { int write_size = send(sock, data, (int)length, 0);
+    if (write_size <= 0)
+      THROWERRNO("send allreduce frame");
+    data += write_size;
+    length -= write_size;
+  }
+}
+
+void recv_all(socket_t sock, char* data, size_t length)
+{ while (length > 0)
+  { int read_size = recv(sock, data, (int)length, 0);
+    if (read_size < 0)
+      THROWERRNO("recv allreduce frame");
+    if (read_size == 0)
+      THROW("connection closed inside an allreduce frame");
+    data += read_size;
+    length -= read_size;
+  }
+}
+
+size_t chunk_size(size_t chunk, size_t begin, size_t end)
+{ return (std::min)(wire_chunk, end - begin - chunk * wire_chunk);
+}
+
+size_t chunks(size_t begin, size_t end)
+{ return (end - begin + wire_chunk - 1) / wire_chunk;
+}
+
+}
+
+void AllReduceSockets::reduce_frames(float* buffer, const size_t n, wire_format wire)
+{ const size_t count = chunks(0, n);
+  size_t done[2]; // chunks each child has added in
+  frame_reader from[2];
+  for (int i = 0; i < 2; i++)
+    done[i] = socks.children[i] == -1 ? count : 0;
+  std::vector<char> frame(wire_frame);
+
+  for (size_t sent = 0;;)
+  { // a chunk goes up once both children have added theirs
+    for (; sent < (std::min)(done[0], done[1]) && socks.parent != -1; sent++)
+      send_all(socks.parent, frame.data(), encode_frame(wire, buffer + sent * wire_chunk, chunk_size(sent, 0, n), frame.data()));
+    if (done[0] == count && done[1] == count)
+      break;
+
+    fd_set fds;
+    FD_ZERO(&fds);
+    socket_t max_fd = 0;
+    for (int i = 0; i < 2; i++)
+      if (done[i] < count)
+      { FD_SET(socks.children[i], &fds);
+        max_fd = (std::max)(max_fd, socks.children[i] + 1);
+      }
+    if (select((int)max_fd, &fds, nullptr, nullptr, nullptr) == -1)
+      THROWERRNO("select");
+
+    for (int i = 0; i < 2; i++)
+      if (done[i] < count && FD_ISSET(socks.children[i], &fds))
+      { int read_size = recv(socks.children[i], from[i].next(), (int)from[i].wanted(), 0);
+        if (read_size < 0)
+          THROWERRNO("recv from child");
+        if (read_size == 0)
+          THROW("child closed the connection inside allreduce");
+        if (from[i].got(read_size))
+        { decode(wire, from[i].payload(), from[i].payload_size(), buffer + done[i] * wire_chunk, chunk_size(done[i], 0, n), true);
+          from[i].reset();
+          done[i]++;
+        }
+      }
+  }
+}
+
+void AllReduceSockets::broadcast_frames(float* buffer, const size_t n, wire_format wire)
+{ std::vector<char> frame(wire_frame);
+  for (size_t chunk = 0; chunk < chunks(0, n); chunk++)
+  { float* floats = buffer + chunk * wire_chunk;
+    const size_t size = chunk_size(chunk, 0, n);
+    size_t length;
+    if (socks.parent == -1)
+      length = encode_frame(wire, floats, size, frame.data());
+    else
+    { uint32_t bytes;
+      recv_all(socks.parent, frame.data(), sizeof(bytes));
+      memcpy(&bytes, frame.data(), sizeof(bytes));
+      if (sizeof(bytes) + bytes > frame.size())
+        THROW("allreduce frame of " << bytes << " bytes is too long");
+      recv_all(socks.parent, frame.data() + sizeof(bytes), bytes);
+      length = sizeof(bytes) + bytes;
+    }
+    // the root too takes the sums as sent, so every node ends with the same ones
+    decode(wire, frame.data() + sizeof(uint32_t), length - sizeof(uint32_t), floats, size, false);
+    for (int i = 0; i < 2; i++)
+      if (socks.children[i] != -1)
+        send_all(socks.children[i], frame.data(), length);
+  }
+}
+
+void AllReduceSockets::ring_frames(float* buffer, const size_t n, wire_format wire)
+{ const size_t steps = 2 * (total - 1);
+  std::vector<char> out(wire_frame);
+  frame_reader in;
+  size_t send_step = 0, send_chunk = 0, out_length = 0, out_sent = 0;
+  size_t recv_step = 0, recv_chunk = 0;
+
+  while (send_step < steps || recv_step < steps)
+  { if (send_step < steps && out_length == 0)
+    { size_t segment = ring_segment(send_step, false);
+      size_t begin = ring_begin(segment, n, 1), end = ring_begin(segment + 1, n, 1);
+      if (send_chunk == chunks(begin, end))
+      { send_step++;
+        send_chunk = 0;
+        continue;
+      }
+      // as with ring_all_reduce, a chunk goes on once it has come in from the previous step
+      if (send_step == 0 || recv_step >= send_step || (recv_step == send_step - 1 && recv_chunk > send_chunk))
+      { float* floats = buffer + begin + send_chunk * wire_chunk;
+        const size_t size = chunk_size(send_chunk, begin, end);
+        out_length = encode_frame(wire, floats, size, out.data());
+        out_sent = 0;
+        // the first allgather step sends the sums this node finished: it keeps them as sent
+        if (send_step == total - 1)
+          decode(wire, out.data() + sizeof(uint32_t), out_length - sizeof(uint32_t), floats, size, false);
+      }
+    }
+    if (recv_step < steps)
+    { size_t segment = ring_segment(recv_step, true);
+      if (recv_chunk == chunks(ring_begin(segment, n, 1), ring_begin(segment + 1, n, 1)))
+      { recv_step++;
+        recv_chunk = 0;
+        continue;
+      }
+    }
+
+    int write_size = 0, read_size = 0;
+    if (out_length > 0)
+    { write_size = ring_send(out.data() + out_sent, out_length - out_sent);
+      out_sent += write_size;
+      if (out_sent == out_length)
+      { out_length = 0;
+        send_chunk++;
+      }
+    }
+    if (recv_step < steps)
+    { read_size = ring_recv(in.next(), in.wanted());
+      if (read_size > 0 && in.got(read_size))
+      { size_t segment = ring_segment(recv_step, true);
+        size_t begin = ring_begin(segment, n, 1), end = ring_begin(segment + 1, n, 1);
+        decode(wire, in.payload(), in.payload_size(), buffer + begin + recv_chunk * wire_chunk,
+               chunk_size(recv_chunk, begin, end), recv_step < total - 1);
+        in.reset();
+        recv_chunk++;
+      }
+    }
+    if (write_size == 0 && read_size == 0)
+      ring_wait(out_length > 0, recv_step < steps);
+  }
+}
+
+void AllReduceSockets::all_reduce_sum(float* buffer, const size_t n, wire_format wire)
+{ if (wire == wire_raw)
+  { all_reduce<float, add_floats>(buffer, n);
+    return;
+  }
+  if (span_server != socks.current_master)
+    all_reduce_init();
+  if (ring)
+  { if (total > 1)
+      ring_frames(buffer, n, wire);
+  }
+  else
+  { reduce_frames(buffer, n, wire);
+    broadcast_frames(buffer, n, wire);
+  }
+}
@@ -1,9 +1,13 @@
 #pragma once
 #include <string.h>
-#include <unordered_map>
+#include <math.h>
+#include <memory>
+#include <algorithm>
 #ifndef _WIN32
 #include <sys/mman.h>
 #endif
+#include "page_alloc.h"
+#include "half.h"
 
 // It appears that on OSX MAP_ANONYMOUS is mapped to MAP_ANON
 // https://github.com/leftmike/foment/issues/4
@@ -15,7 +19,6 @@ typedef float weight;
 
 class dense_parameters;
 class sparse_parameters;
-typedef std::unordered_map<uint64_t, weight*> weight_map;
 
 template <typename T>
 class dense_iterator
@@ -57,6 +60,16 @@ private:
 	uint64_t _weight_mask;  // (stride*(1 << num_bits) -1)
 	uint32_t _stride_shift;
 	bool _seeded; // whether the instance is sharing model state with others
+	size_t _mapped; // bytes mapped by map_pages, 0 if _begin came from calloc
+	page_options _pages;
+
+	void release()
+	{ if (_mapped > 0)
+	    unmap_pages(_begin, _mapped);
+	  else
+	    free(_begin);
+	  _mapped = 0;
+	}
 
  public:
 	typedef dense_iterator<weight> iterator;
@@ -65,11 +78,18 @@ private:
    : _begin(calloc_mergable_or_throw<weight>(length << stride_shift)),
 	  _weight_mask((length << stride_shift) - 1),
 	  _stride_shift(stride_shift),
-	  _seeded(false)
+	  _seeded(false), _mapped(0), _pages()
 	    { }
 
+	// the array is mapped following pages, report says what the system gave
+ dense_parameters(size_t length, uint32_t stride_shift, const page_options& pages, std::string& report)
+   : _weight_mask((length << stride_shift) - 1),
+	  _stride_shift(stride_shift),
+	  _seeded(false), _mapped((length << stride_shift) * sizeof(weight)), _pages(pages)
+	{ _begin = (weight*)map_pages(_mapped, false, pages, report); }
+
  dense_parameters()
-	 : _begin(nullptr), _weight_mask(0), _stride_shift(0),_seeded(false)
+	 : _begin(nullptr), _weight_mask(0), _stride_shift(0),_seeded(false), _mapped(0), _pages()
 	  {}
 
 	bool not_null() { return (_weight_mask > 0 && _begin != nullptr);}
@@ -91,7 +111,7 @@ private:
 	void shallow_copy(const dense_parameters& input)
 	{
 	  if (!_seeded)
-		  free(_begin);
+		  release();
 	  _begin = input._begin;
 	  _weight_mask = input._weight_mask;
 	  _stride_shift = input._stride_shift;
@@ -131,32 +151,67 @@ private:
 	void stride_shift(uint32_t stride_shift) { _stride_shift = stride_shift; }
 
 	#ifndef _WIN32
-	void share(size_t length)
+	void share(size_t length, std::string& report)
 	{
-	  float* shared_weights = (float*)mmap(0, (length << _stride_shift) * sizeof(float),
-			                  PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+	  size_t bytes = (length << _stride_shift) * sizeof(float);
+	  float* shared_weights = (float*)map_pages(bytes, true, _pages, report);
           size_t float_count = length << _stride_shift;
       	  weight* dest = shared_weights;
 		  memcpy(dest, _begin, float_count*sizeof(float));
-      	  free(_begin);
+      	  release();
       	  _begin = dest;
+	  _mapped = bytes;
+	}
+
+	// the weights become the length floats at offset in fd, mapped copy-on-write: every process mapping
+	// the file shares its page cache until it writes a page.  The file has to be replaced by a rename,
+	// as pages not yet written follow changes made in place.
+	bool map_file(int fd, int64_t offset, size_t length)
+	{ size_t bytes = length * sizeof(weight);
+	  void* data = mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, offset);
+	  if (data == MAP_FAILED)
+	    return false;
+	  release();
+	  _begin = (weight*)data;
+	  _mapped = bytes;
+	  _weight_mask = length - 1;
+	  _stride_shift = 0;
+	  return true;
 	}
 	#endif
 
+	// the shape stays for indexing, the values go: the weights are held elsewhere, e.g. quantized
+	void free_values()
+	{ if (!_seeded)
+	    release();
+	  _begin = nullptr;
+	  _mapped = 0;
+	}
+
 	~dense_parameters()
 	{  if (_begin != nullptr && !_seeded)  // don't free weight vector if it is shared with another instance
-	   {  free(_begin);
+	   {  release();
 	      _begin = nullptr;
 	   }
 	}
 };
 
+// --sparse_weights: an open-addressing table whose slots hold an index and the stride weights of it
+// right after, so that a lookup reads one line instead of chasing a node and then its block.  Robin
+// Hood insertion keeps every index close to its home slot, which keeps probes short and lets a miss
+// stop early.  A slot's key is the index plus one, so zeroed memory is an empty table.
 template <typename T>
 class sparse_iterator
 {
 private:
-	weight_map::iterator _iter;
-	uint32_t _stride;
+	char* _slot;
+	char* _end;
+	size_t _slot_bytes;
+
+	void skip_empty()
+	{ while (_slot != _end && *(uint64_t*)_slot == 0)
+	    _slot += _slot_bytes;
+	}
 
 public:
 	typedef std::forward_iterator_tag iterator_category;
@@ -165,40 +220,41 @@ public:
 	typedef  T* pointer;
 	typedef  T& reference;
 
-	sparse_iterator(weight_map::iterator& iter, uint32_t stride)
-		: _iter(iter), _stride(stride)
-	{ }
+	sparse_iterator(char* slot, char* end, size_t slot_bytes)
+		: _slot(slot), _end(end), _slot_bytes(slot_bytes)
+	{ skip_empty(); }
 
-	sparse_iterator& operator=(const sparse_iterator& other)
-	{
-		_iter = other._iter;
-		_stride = other._stride;
-		return *this;
-
-	}
-	uint64_t index() { return _iter->first; }
+	uint64_t index() { return *(uint64_t*)_slot - 1; }
 
-	T& operator*() { return *(_iter->second); }
+	T& operator*() { return *(T*)(_slot + sizeof(uint64_t)); }
 
 	sparse_iterator& operator++()
 	{
-		_iter++;
+		_slot += _slot_bytes;
+		skip_empty();
 		return *this;
 	}
 
-	bool operator==(const sparse_iterator& rhs) const { return _iter == rhs._iter; }
-	bool operator!=(const sparse_iterator& rhs) const { return _iter != rhs._iter; }
+	bool operator==(const sparse_iterator& rhs) const { return _slot == rhs._slot; }
+	bool operator!=(const sparse_iterator& rhs) const { return _slot != rhs._slot; }
 };
 
 
 class sparse_parameters
 {
 private:
-	weight_map _map;
+	char* _slots;
+	std::shared_ptr<char> _storage; // owns _slots, freed or unmapped as they were allocated
+	size_t _capacity; // slots, a power of 2
+	uint32_t _hash_shift; // 64 - log2(_capacity)
+	size_t _size;
+	size_t _slot_bytes;
+	char* _carry; // two slots moved around by an insertion
 	uint64_t _weight_mask;  // (stride*(1 << num_bits) -1)
 	uint32_t _stride_shift;
 	bool _seeded; // whether the instance is sharing model state with others
-	bool _delete;
+	sparse_parameters* _owner; // seeded: the instance whose table this one reads and writes, which outlives it
+	page_options _pages;
 	void* default_data;
   float* default_value;
 public:
@@ -206,73 +262,195 @@ public:
 	typedef sparse_iterator<const weight> const_iterator;
  private:
 	void(*fun)(const weight*, void*);
+
+	static const size_t min_capacity = 1024;
+
+	size_t home(uint64_t key) const { return (size_t)((key * 0x9E3779B97F4A7C15ULL) >> _hash_shift); }
+	char* slot(size_t pos) const { return _slots + pos * _slot_bytes; }
+	static uint64_t& key(char* s) { return *(uint64_t*)s; }
+	static weight* weights(char* s) { return (weight*)(s + sizeof(uint64_t)); }
+
+	void layout()
+	{ _slot_bytes = (sizeof(uint64_t) + (sizeof(weight) << _stride_shift) + 7) & ~(size_t)7;
+	  free(_carry);
+	  _carry = calloc_or_throw<char>(2 * _slot_bytes);
+	}
+
+	// an empty table of capacity slots, on the pages asked for
+	void allocate_slots(size_t capacity)
+	{ size_t bytes = capacity * _slot_bytes;
+	  if (_pages.huge == huge_none && _pages.numa == numa_none)
+	    _storage = std::shared_ptr<char>(calloc_mergable_or_throw<char>(bytes), free);
+	  else
+	  { std::string report;
+	    _storage = std::shared_ptr<char>((char*)map_pages(bytes, false, _pages, report), [bytes](char* p) { unmap_pages(p, bytes); });
+	  }
+	  _slots = _storage.get();
+	  _capacity = capacity;
+	  _hash_shift = 64;
+	  for (size_t c = capacity; c > 1; c >>= 1)
+	    _hash_shift--;
+	  _size = 0;
+	}
+
+	// puts the slot at s into the table, shifting richer ones along; returns where it went
+	weight* place(const char* s)
+	{ char* carry = _carry;
+	  char* swap = _carry + _slot_bytes;
+	  memcpy(carry, s, _slot_bytes);
+	  weight* placed = nullptr;
+	  size_t mask = _capacity - 1;
+	  size_t pos = home(key(carry) - 1);
+	  for (size_t d = 0;; pos = (pos + 1) & mask, d++)
+	  { char* at = slot(pos);
+	    if (key(at) == 0)
+	    { memcpy(at, carry, _slot_bytes);
+	      _size++;
+	      return placed != nullptr ? placed : weights(at);
+	    }
+	    size_t resident = (pos - home(key(at) - 1)) & mask;
+	    if (resident < d)
+	    { memcpy(swap, at, _slot_bytes);
+	      memcpy(at, carry, _slot_bytes);
+	      std::swap(carry, swap);
+	      if (placed == nullptr)
+	        placed = weights(at);
+	      d = resident;
+	    }
+	  }
+	}
+
+	// into a table of capacity slots, of its own from then on
+	void rehash(size_t capacity)
+	{ std::shared_ptr<char> old = _storage;
+	  char* old_slots = _slots;
+	  size_t old_capacity = _capacity;
+	  allocate_slots(capacity);
+	  for (size_t pos = 0; pos < old_capacity; pos++)
+	    if (key(old_slots + pos * _slot_bytes) != 0)
+	      place(old_slots + pos * _slot_bytes);
+	}
+
+	weight* find(uint64_t index) const
+	{ if (_size == 0)
+	    return nullptr;
+	  size_t mask = _capacity - 1;
+	  size_t pos = home(index);
+	  for (size_t d = 0;; pos = (pos + 1) & mask, d++)
+	  { char* at = slot(pos);
+	    uint64_t k = key(at);
+	    if (k == index + 1)
+	      return weights(at);
+	    if (k == 0 || ((pos - home(k - 1)) & mask) < d)
+	      return nullptr;
+	  }
+	}
+
+	weight* insert(uint64_t index)
+	{ if (_capacity == 0)
+	    reserve(0);
+	  if (_size + 1 > _capacity - _capacity / 8)
+	    rehash(_capacity * 2);
+	  char* s = _carry + _slot_bytes;
+	  memset(s, 0, _slot_bytes);
+	  key(s) = index + 1;
+	  if (fun != nullptr)
+	    fun(weights(s), default_data);
+	  return place(s);
+	}
+
  public:
 
-	sparse_parameters(size_t length, uint32_t stride_shift = 0)
-		: _map(),
+	sparse_parameters(size_t length, uint32_t stride_shift = 0, const page_options& pages = page_options())
+		: _slots(nullptr), _capacity(0), _hash_shift(64), _size(0), _slot_bytes(0), _carry(nullptr),
 		_weight_mask((length << stride_shift) - 1),
 		_stride_shift(stride_shift),
-		_seeded(false), _delete(false), default_data(nullptr),
+		_seeded(false), _owner(nullptr), _pages(pages), default_data(nullptr),
     fun(nullptr)
-	{ default_value = calloc_mergable_or_throw<weight>(stride());}
+	{ layout();
+	  default_value = calloc_mergable_or_throw<weight>(stride());}
 
 	sparse_parameters()
-		: _map(), _weight_mask(0), _stride_shift(0), _seeded(false), _delete(false), default_data(nullptr), fun(nullptr)
-	{ default_value = calloc_mergable_or_throw<weight>(stride());}
+		: _slots(nullptr), _capacity(0), _hash_shift(64), _size(0), _slot_bytes(0), _carry(nullptr),
+		  _weight_mask(0), _stride_shift(0), _seeded(false), _owner(nullptr), _pages(), default_data(nullptr), fun(nullptr)
+	{ layout();
+	  default_value = calloc_mergable_or_throw<weight>(stride());}
 
-	bool not_null() { return (_weight_mask > 0 && !_map.empty()); }
+	bool not_null() { return _owner != nullptr ? _owner->not_null() : (_weight_mask > 0 && _size > 0); }
 
-	sparse_parameters(const sparse_parameters &other) { shallow_copy(other); }
+	sparse_parameters(const sparse_parameters &other)
+		: _slots(nullptr), _capacity(0), _hash_shift(64), _size(0), _slot_bytes(0), _carry(nullptr),
+		  _weight_mask(0), _stride_shift(0), _seeded(false), _owner(nullptr), _pages(), default_data(nullptr), default_value(nullptr), fun(nullptr)
+	{ shallow_copy(other); }
 	sparse_parameters(sparse_parameters &&) = delete;
 
 	weight* first() { throw 1; } //TODO: Throw better exceptions. Allreduce currently not supported in sparse.
 
+	// room for this many indices without growing
+	void reserve(size_t indices)
+	{ if (_owner != nullptr)
+	    return _owner->reserve(indices);
+	  size_t capacity = min_capacity;
+	  while (capacity - capacity / 8 < indices)
+	    capacity *= 2;
+	  if (capacity > _capacity)
+	  { if (_capacity == 0)
+	      allocate_slots(capacity);
+	    else
+	      rehash(capacity);
+	  }
+	}
+
+	size_t size() const { return _owner != nullptr ? _owner->size() : _size; }
+
+	// where a lookup of i starts, for prefetching
+	inline const char* home_slot(size_t i) const
+	{ if (_owner != nullptr)
+	    return _owner->home_slot(i);
+	  return _capacity == 0 ? _slots : slot(home(i & _weight_mask));
+	}
+
 	//iterator with stride
-	iterator begin() { weight_map::iterator i = _map.begin(); return iterator(i, stride()); }
-	iterator end() { weight_map::iterator i = _map.end(); return iterator(i, stride()); }
+	iterator begin() { return _owner != nullptr ? _owner->begin() : iterator(_slots, slot(_capacity), _slot_bytes); }
+	iterator end() { return _owner != nullptr ? _owner->end() : iterator(slot(_capacity), slot(_capacity), _slot_bytes); }
 
 	//const iterator
-	const_iterator cbegin() { weight_map::iterator i = _map.begin(); return const_iterator(i,  stride()); }
-	const_iterator cend() { weight_map::iterator i = _map.begin(); return const_iterator(i, stride()); }
+	const_iterator cbegin() { return _owner != nullptr ? _owner->cbegin() : const_iterator(_slots, slot(_capacity), _slot_bytes); }
+	const_iterator cend() { return _owner != nullptr ? _owner->cend() : const_iterator(slot(_capacity), slot(_capacity), _slot_bytes); }
 
+	// the reference is good until the next index is added, which may move the table
 	inline weight& operator[](size_t i)
-	{   uint64_t index = i & _weight_mask;
-    weight_map::iterator iter = _map.find(index);
-		if (iter == _map.end())
-		  {     _map.insert(std::make_pair(index, calloc_mergable_or_throw<weight>(stride())));
-			iter = _map.find(index);
-			if (fun != nullptr)
-        fun(iter->second, default_data);
-		}
-		return *(iter->second);
+	{ if (_owner != nullptr)
+	    return (*_owner)[i];
+	  uint64_t index = i & _weight_mask;
+	  weight* w = find(index);
+	  if (w == nullptr)
+	    w = insert(index);
+	  return *w;
 	}
 
   inline const weight& operator[](size_t i) const
-	{   uint64_t index = i & _weight_mask;
-		weight_map::const_iterator iter = _map.find(index);
-		if (iter == _map.end())
-      return *default_value;
-		return *(iter->second);
-  }
+	{ if (_owner != nullptr)
+	    return (*(const sparse_parameters*)_owner)[i];
+	  weight* w = find(i & _weight_mask);
+	  if (w == nullptr)
+	    return *default_value;
+	  return *w;
+	}
 
 	inline weight& strided_index(size_t index) { return operator[](index << _stride_shift); }
 
+	// the weights live in the table, which moves as it grows, so rather than a copy of it this one
+	// goes through the input's table for every index, adding to it as the input itself would
 	void shallow_copy(const sparse_parameters& input)
-	{
-		// TODO: this is level-1 copy (weight* are stilled shared)
-		if (!_seeded)
-		{
-			for (auto& pair : _map)
-				free(pair.second);
-		}
-		_map = input._map;
-		_weight_mask = input._weight_mask;
-		_stride_shift = input._stride_shift;
-    free(default_value);
-    default_value = calloc_mergable_or_throw<weight>(stride());
-    memcpy(default_value, input.default_value, stride());
-    default_data = input.default_data;
-		_seeded = true;
+	{ _owner = input._owner != nullptr ? input._owner : const_cast<sparse_parameters*>(&input);
+	  _storage.reset();
+	  _slots = nullptr;
+	  _capacity = 0;
+	  _size = 0;
+	  _weight_mask = input._weight_mask;
+	  stride_shift(input._stride_shift);
+	  _seeded = true;
 	}
 
 	template<class R, class T> void set_default(R& info)
@@ -288,8 +466,8 @@ public:
 
 	void set_zero(size_t offset)
 	{
-		for (weight_map::iterator iter = _map.begin(); iter != _map.end(); ++iter)
-			(&(*(iter->second)))[offset] = 0;
+		for (iterator iter = begin(); iter != end(); ++iter)
+			(&(*iter))[offset] = 0;
 	}
 
 	uint64_t mask()	const { return _weight_mask; }
@@ -300,8 +478,10 @@ public:
 
 	uint32_t stride_shift()	const { return _stride_shift; }
 
+	// before any index is added: the slots are laid out for the stride
 	void stride_shift(uint32_t stride_shift) {
     _stride_shift = stride_shift;
+    layout();
     free(default_value);
     default_value = calloc_mergable_or_throw<weight>(stride());
     if (fun != nullptr)
@@ -309,30 +489,116 @@ public:
   }
 
 #ifndef _WIN32
-	void share(size_t length)
+	void share(size_t length, std::string&)
 	{throw 1; //TODO: add better exceptions
 	}
 #endif
 
 	~sparse_parameters()
-	{if (!_delete && !_seeded)  // don't free weight vector if it is shared with another instance
-		{
-		for (auto& pair : _map)
-			free(pair.second);
-		 _map.clear();
-		 _delete = true;
-		}
+	{ free(_carry);
     if (default_data != nullptr)
       free(default_data);
     free(default_value);
 	}
 };
 
+// --quantize_model: only what prediction reads, the weights themselves, as halves or as bytes that
+// share one scale per block of weights.  Indexed as the dense weights they stand in for, each read
+// dequantizes.
+enum quantize_kind { quantize_none = 0, quantize_fp16 = 1, quantize_int8 = 2 };
+
+const uint32_t quantize_block_shift = 6; // the int8 weights of a 64 byte line share a scale
+
+template <class Q> // uint16_t for fp16, int8_t for int8
+class quantized_parameters
+{
+private:
+	Q* _values;
+	float* _scales; // int8: one for each block of weights
+	uint64_t _weight_mask; // as the dense weights', (stride*(1 << num_bits) -1)
+	uint32_t _stride_shift;
+	bool _seeded;
+
+	void release()
+	{ free(_values);
+	  free(_scales);
+	}
+
+	inline size_t slot(size_t i) const { return (i & _weight_mask) >> _stride_shift; }
+
+public:
+	quantized_parameters() : _values(nullptr), _scales(nullptr), _weight_mask(0), _stride_shift(0), _seeded(false) {}
+	quantized_parameters(const quantized_parameters&) = delete;
+
+	static size_t blocks(size_t length) { return ((length - 1) >> quantize_block_shift) + 1; }
+
+	void allocate(size_t length, uint32_t stride_shift)
+	{ if (!_seeded)
+	    release();
+	  _values = calloc_or_throw<Q>(length);
+	  _scales = sizeof(Q) == 1 ? calloc_or_throw<float>(blocks(length)) : nullptr;
+	  _weight_mask = (length << stride_shift) - 1;
+	  _stride_shift = stride_shift;
+	  _seeded = false;
+	}
+
+	bool not_null() const { return _values != nullptr; }
+
+	Q* values() { return _values; }
+	float* scales() { return _scales; }
+
+	static inline float dequantize(const Q* values, const float* scales, size_t j);
+
+	inline float operator[](size_t i) const { return dequantize(_values, _scales, slot(i)); }
+	inline const Q* address(size_t i) const { return _values + slot(i); }
+
+	// sum of x[k] times the weight at index[k] + offset, the members held in registers: without
+	// strict aliasing each store to a float accumulator reloads them
+	inline float dot(const float* x, const uint64_t* index, size_t n, uint64_t offset) const
+	{ const Q* values = _values;
+	  const float* scales = _scales;
+	  uint64_t mask = _weight_mask;
+	  uint32_t shift = _stride_shift;
+	  float sum = 0.f;
+	  for (size_t k = 0; k < n; k++)
+	    sum += x[k] * dequantize(values, scales, ((index[k] + offset) & mask) >> shift);
+	  return sum;
+	}
+
+	uint64_t mask() const { return _weight_mask; }
+
+	uint32_t stride_shift() const { return _stride_shift; }
+
+	void shallow_copy(const quantized_parameters& input)
+	{ if (!_seeded)
+	    release();
+	  _values = input._values;
+	  _scales = input._scales;
+	  _weight_mask = input._weight_mask;
+	  _stride_shift = input._stride_shift;
+	  _seeded = true;
+	}
+
+	~quantized_parameters()
+	{ if (!_seeded)
+	    release();
+	}
+};
+
+template<> inline float quantized_parameters<uint16_t>::dequantize(const uint16_t* values, const float*, size_t j)
+{ return half_to_float(values[j]); }
+
+template<> inline float quantized_parameters<int8_t>::dequantize(const int8_t* values, const float* scales, size_t j)
+{ return values[j] * scales[j >> quantize_block_shift]; }
+
 class parameters {
  public:
   bool sparse;
   dense_parameters dense_weights;
   sparse_parameters sparse_weights;
+  quantize_kind quantized; // a --quantize_model model was loaded: one of these replaced the dense weights
+  quantized_parameters<uint16_t> half_weights;
+  quantized_parameters<int8_t> int8_weights;
 
   inline weight& operator[](size_t i)
   {
@@ -376,6 +642,9 @@ class parameters {
 
   inline void shallow_copy(const parameters& input)
   {
+    quantized = input.quantized;
+    half_weights.shallow_copy(input.half_weights);
+    int8_weights.shallow_copy(input.int8_weights);
     if (sparse)
       sparse_weights.shallow_copy(input.sparse_weights);
     else
@@ -390,12 +659,12 @@ class parameters {
       dense_weights.set_zero(offset);
   }
 #ifndef _WIN32
-  inline void share(size_t length)
+  inline void share(size_t length, std::string& report)
   {
     if (sparse)
-      sparse_weights.share(length);
+      sparse_weights.share(length, report);
     else
-      dense_weights.share(length);
+      dense_weights.share(length, report);
   }
   #endif
 
@@ -416,6 +685,8 @@ class parameters {
 
   inline bool not_null()
   {
+    if (quantized != quantize_none)
+      return true;
     if (sparse)
       return sparse_weights.not_null();
     else
@@ -616,7 +616,7 @@ int process_pass(vw& all, bfgs& b)
   /********************************************************************/
     if (b.first_pass)
     { if(all.all_reduce != nullptr)
-      { accumulate(all, all.weights, W_COND); //Accumulate preconditioner
+      { accumulate(all, all.weights, W_COND, all.gradients_wire); //Accumulate preconditioner
         float temp = (float)b.importance_weight_sum;
         b.importance_weight_sum = accumulate_scalar(all, temp);
       }
@@ -624,7 +624,7 @@ int process_pass(vw& all, bfgs& b)
       if(all.all_reduce != nullptr)
       {	float temp = (float)b.loss_sum;
 	b.loss_sum = accumulate_scalar(all, temp);  //Accumulate loss_sums
-	accumulate(all, all.weights, 1); //Accumulate gradients from all nodes
+	accumulate(all, all.weights, 1, all.gradients_wire); //Accumulate gradients from all nodes
       }
     if (all.l2_lambda > 0.)
       b.loss_sum += add_regularization(all, b, all.l2_lambda);
@@ -658,7 +658,7 @@ int process_pass(vw& all, bfgs& b)
     { if(all.all_reduce != nullptr)
       { float t = (float)b.loss_sum;
         b.loss_sum = accumulate_scalar(all, t);  //Accumulate loss_sums
-        accumulate(all, all.weights, 1); //Accumulate gradients from all nodes
+        accumulate(all, all.weights, 1, all.gradients_wire); //Accumulate gradients from all nodes
       }
       if (all.l2_lambda > 0.)
         b.loss_sum += add_regularization(all, b, all.l2_lambda);
@@ -788,7 +788,7 @@ int process_pass(vw& all, bfgs& b)
 
   if (b.output_regularizer)//need to accumulate and place the regularizer.
   { if(all.all_reduce != nullptr)
-      accumulate(all, all.weights, W_COND); //Accumulate preconditioner
+      accumulate(all, all.weights, W_COND, all.gradients_wire); //Accumulate preconditioner
     //preconditioner_to_regularizer(all, b, all.l2_lambda);
   }
   ftime(&b.t_end_global);
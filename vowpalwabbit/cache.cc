@@ -191,3 +191,383 @@ void cache_features(io_buf& cache, example* ae, uint64_t mask)
   for (namespace_index ns : ae->indices)
     output_features(cache, ns, ae->feature_space[ns], mask);
 }
+
+inline uint32_t ZigZagEncode32(int32_t n) { return ((uint32_t)n << 1) ^ (uint32_t)(n >> 31); }
+inline int32_t ZigZagDecode32(uint32_t n) { return (int32_t)(n >> 1) ^ -(int32_t)(n & 1); }
+
+struct block_header
+{ uint32_t examples;
+  uint32_t features;
+  uint32_t index_bytes;
+  uint32_t values;
+};
+
+struct namespace_header
+{ unsigned char index;
+  unsigned char explicit_values; // 0 when every value is 1.0 and none are stored
+  uint32_t count;
+};
+
+// written field by field, so the format does not depend on how a compiler pads the struct
+const size_t namespace_header_bytes = 2 + sizeof(uint32_t);
+
+inline void write_namespace_header(char* c, const namespace_header& h)
+{ c[0] = (char)h.index;
+  c[1] = (char)h.explicit_values;
+  memcpy(c + 2, &h.count, sizeof(h.count));
+}
+
+inline void read_namespace_header(const char* c, namespace_header& h)
+{ h.index = (unsigned char)c[0];
+  h.explicit_values = (unsigned char)c[1];
+  memcpy(&h.count, c + 2, sizeof(h.count));
+}
+
+const size_t block_examples = 1 << 10;
+const size_t block_features = 1 << 18;
+
+// stream-vbyte: a 2-bit length code per value, four to a control byte, followed by the values'
+// low 1-4 bytes.  Groups of four decode with a single byte shuffle.
+size_t stream_vbyte_encode(const uint32_t* in, size_t n, uint8_t* out)
+{ uint8_t* control = out;
+  uint8_t* data = out + (n + 3) / 4;
+  memset(control, 0, (n + 3) / 4);
+  for (size_t i = 0; i < n; i++)
+  { uint32_t v = in[i];
+    uint8_t code = v < (1 << 8) ? 0 : v < (1 << 16) ? 1 : v < (1 << 24) ? 2 : 3;
+    control[i / 4] |= code << (2 * (i % 4));
+    memcpy(data, &v, code + 1);
+    data += code + 1;
+  }
+  return data - out;
+}
+
+inline const uint8_t* stream_vbyte_decode_scalar(const uint8_t* control, const uint8_t* data, size_t i, size_t n, uint32_t* out)
+{ for (; i < n; i++)
+  { uint8_t code = (control[i / 4] >> (2 * (i % 4))) & 3;
+    uint32_t v = 0;
+    memcpy(&v, data, code + 1);
+    data += code + 1;
+    out[i] = v;
+  }
+  return data;
+}
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define STREAM_VBYTE_SIMD
+#include <immintrin.h>
+
+struct stream_vbyte_tables
+{ uint8_t shuffle[256][16];
+  uint8_t length[256];
+
+  stream_vbyte_tables()
+  { for (size_t c = 0; c < 256; c++)
+    { uint8_t from = 0;
+      for (size_t k = 0; k < 4; k++)
+      { size_t bytes = ((c >> (2 * k)) & 3) + 1;
+        for (size_t j = 0; j < 4; j++)
+          shuffle[c][4 * k + j] = j < bytes ? from++ : 0x80;
+      }
+      length[c] = from;
+    }
+  }
+};
+static const stream_vbyte_tables svb;
+
+// the SIMD loops stop 16 bytes short of the end of the data, so they never load past it
+__attribute__((target("ssse3")))
+const uint8_t* stream_vbyte_decode_ssse3(const uint8_t* control, const uint8_t* data, const uint8_t* end, size_t n, uint32_t* out)
+{ size_t i = 0;
+  for (; i + 4 <= n && end - data >= 16; i += 4)
+  { uint8_t c = control[i / 4];
+    __m128i in = _mm_loadu_si128((const __m128i*)data);
+    __m128i shuffle = _mm_loadu_si128((const __m128i*)svb.shuffle[c]);
+    _mm_storeu_si128((__m128i*)(out + i), _mm_shuffle_epi8(in, shuffle));
+    data += svb.length[c];
+  }
+  return stream_vbyte_decode_scalar(control, data, i, n, out);
+}
+
+__attribute__((target("avx2")))
+const uint8_t* stream_vbyte_decode_avx2(const uint8_t* control, const uint8_t* data, const uint8_t* end, size_t n, uint32_t* out)
+{ size_t i = 0;
+  for (; i + 8 <= n && end - data >= 32; i += 8)
+  { uint8_t c0 = control[i / 4];
+    uint8_t c1 = control[i / 4 + 1];
+    const uint8_t* second = data + svb.length[c0];
+    __m256i in = _mm256_inserti128_si256(_mm256_castsi128_si256(_mm_loadu_si128((const __m128i*)data)),
+                                         _mm_loadu_si128((const __m128i*)second), 1);
+    __m256i shuffle = _mm256_inserti128_si256(_mm256_castsi128_si256(_mm_loadu_si128((const __m128i*)svb.shuffle[c0])),
+                                              _mm_loadu_si128((const __m128i*)svb.shuffle[c1]), 1);
+    _mm256_storeu_si256((__m256i*)(out + i), _mm256_shuffle_epi8(in, shuffle));
+    data = second + svb.length[c1];
+  }
+  return stream_vbyte_decode_scalar(control, data, i, n, out);
+}
+
+typedef const uint8_t* (*stream_vbyte_decoder)(const uint8_t*, const uint8_t*, const uint8_t*, size_t, uint32_t*);
+
+stream_vbyte_decoder pick_stream_vbyte_decoder()
+{ __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2"))
+    return stream_vbyte_decode_avx2;
+  if (__builtin_cpu_supports("ssse3"))
+    return stream_vbyte_decode_ssse3;
+  return nullptr;
+}
+static const stream_vbyte_decoder simd_decoder = pick_stream_vbyte_decoder();
+#endif
+
+// decodes n values from in, which must end exactly at end; returns nullptr if it doesn't
+const uint8_t* stream_vbyte_decode(const uint8_t* in, size_t n, uint32_t* out, const uint8_t* end)
+{ const uint8_t* control = in;
+  const uint8_t* data = in + (n + 3) / 4;
+  if (data > end)
+    return nullptr;
+  size_t data_bytes = 0;
+  for (size_t g = 0; g < n / 4; g++)
+  { uint8_t c = control[g];
+    data_bytes += 4 + (c & 3) + ((c >> 2) & 3) + ((c >> 4) & 3) + (c >> 6);
+  }
+  for (size_t i = n / 4 * 4; i < n; i++)
+    data_bytes += 1 + ((control[i / 4] >> (2 * (i % 4))) & 3);
+  if (data_bytes != (size_t)(end - data))
+    return nullptr;
+#ifdef STREAM_VBYTE_SIMD
+  if (simd_decoder != nullptr)
+    return simd_decoder(control, data, end, n, out);
+#endif
+  return stream_vbyte_decode_scalar(control, data, 0, n, out);
+}
+
+// an io_buf that grows instead of flushing, for building a block in memory
+class memory_buf : public io_buf
+{
+public:
+  virtual void flush()
+  { size_t used = head - space.begin();
+    space.resize(2 * (space.end_array - space.begin()));
+    head = space.begin() + used;
+  }
+};
+
+block_reader* new_block_reader()
+{ return &calloc_or_throw<block_reader>();
+}
+
+block_writer* new_block_writer()
+{ block_writer& ret = calloc_or_throw<block_writer>();
+  ret.meta = new memory_buf;
+  return &ret;
+}
+
+void free_block_reader(block_reader* b)
+{ b->deltas.delete_v();
+  b->values.delete_v();
+  free(b);
+}
+
+void free_block_writer(block_writer* b)
+{ delete b->meta;
+  b->deltas.delete_v();
+  b->values.delete_v();
+  free(b);
+}
+
+size_t read_cache_block(vw* all, io_buf& cache, block_reader& b)
+{ char* c;
+  block_header h;
+  if (buf_read(cache, c, sizeof(h)) < sizeof(h))
+    return 0;
+  memcpy(&h, c, sizeof(h));
+
+  if (buf_read(cache, c, h.index_bytes) < h.index_bytes)
+  { all->trace_message << "truncated cache block! wanted: " << h.index_bytes << " bytes" << endl;
+    return 0;
+  }
+  if ((size_t)(b.deltas.end_array - b.deltas.begin()) < h.features)
+    b.deltas.resize(h.features);
+  const uint8_t* end = (const uint8_t*)c + h.index_bytes;
+  if (stream_vbyte_decode((const uint8_t*)c, h.features, b.deltas.begin(), end) != end)
+  { all->trace_message << "corrupt cache block!" << endl;
+    return 0;
+  }
+
+  size_t value_bytes = h.values * sizeof(float);
+  if (buf_read(cache, c, value_bytes) < value_bytes)
+  { all->trace_message << "truncated cache block! wanted: " << value_bytes << " bytes" << endl;
+    return 0;
+  }
+  if ((size_t)(b.values.end_array - b.values.begin()) < h.values)
+    b.values.resize(h.values);
+  memcpy(b.values.begin(), c, value_bytes);
+
+  b.deltas.end() = b.deltas.begin() + h.features;
+  b.values.end() = b.values.begin() + h.values;
+  b.next_delta = 0;
+  b.next_value = 0;
+  b.examples_left = h.examples;
+  return sizeof(h) + h.index_bytes + value_bytes;
+}
+
+int read_block_cached_features(vw* all, v_array<example*>& examples)
+{ example* ae = examples[0];
+  ae->sorted = all->p->sorted_cache;
+  io_buf* input = all->p->input;
+  block_reader& b = *all->p->cache_in;
+
+  size_t total = 0;
+  if (b.examples_left == 0 && (total = read_cache_block(all, *input, b)) == 0)
+    return 0;
+  b.examples_left--;
+
+  size_t label_size = all->p->lp.read_cached_label(all->sd, &ae->l, *input);
+  if (label_size == 0)
+    return 0;
+  total += label_size;
+  size_t tag_size = read_cached_tag(*input, ae);
+  if (tag_size == 0)
+    return 0;
+  total += tag_size;
+
+  char* c;
+  if (buf_read(*input, c, 1) < 1)
+    return 0;
+  size_t num_indices = *(unsigned char*)c;
+  size_t header_bytes = num_indices * namespace_header_bytes;
+  if (buf_read(*input, c, header_bytes) < header_bytes)
+  { all->trace_message << "truncated example! wanted: " << header_bytes << " bytes" << endl;
+    return 0;
+  }
+  total += 1 + header_bytes;
+
+  for (size_t n = 0; n < num_indices; n++)
+  { namespace_header h;
+    read_namespace_header(c + n * namespace_header_bytes, h);
+    if (b.next_delta + h.count > b.deltas.size() || (h.explicit_values && b.next_value + h.count > b.values.size()))
+    { all->trace_message << "corrupt cache block!" << endl;
+      return 0;
+    }
+
+    ae->indices.push_back(h.index);
+    features& ours = ae->feature_space[h.index];
+    const uint32_t* delta = b.deltas.begin() + b.next_delta;
+    b.next_delta += h.count;
+    const float* value = h.explicit_values ? b.values.begin() + b.next_value : nullptr;
+    if (h.explicit_values)
+      b.next_value += h.count;
+
+    size_t size = ours.size();
+    if ((size_t)(ours.values.end_array - ours.values.begin()) < size + h.count)
+      ours.values.resize(size + h.count);
+    if ((size_t)(ours.indicies.end_array - ours.indicies.begin()) < size + h.count)
+      ours.indicies.resize(size + h.count);
+    feature_value* v = ours.values.end();
+    feature_index* idx = ours.indicies.end();
+
+    uint32_t last = 0;
+    for (size_t i = 0; i < h.count; i++)
+    { uint32_t index = last + (uint32_t)ZigZagDecode32(delta[i]);
+      if (index < last)
+        ae->sorted = false;
+      last = index;
+      idx[i] = index;
+    }
+    if (value == nullptr)
+      for (size_t i = 0; i < h.count; i++)
+      { v[i] = 1.f;
+        ours.sum_feat_sq += 1.f;
+      }
+    else
+      for (size_t i = 0; i < h.count; i++)
+      { v[i] = value[i];
+        ours.sum_feat_sq += value[i] * value[i];
+      }
+    ours.values.end() += h.count;
+    ours.indicies.end() += h.count;
+  }
+
+  return (int)total;
+}
+
+void write_cache_block(io_buf& cache, block_writer& w)
+{ if (w.examples == 0)
+    return;
+
+  block_header h;
+  h.examples = (uint32_t)w.examples;
+  h.features = (uint32_t)w.deltas.size();
+  h.values = (uint32_t)w.values.size();
+
+  char* c;
+  size_t max_index_bytes = (h.features + 3) / 4 + 4 * h.features;
+  buf_write(cache, c, sizeof(h) + max_index_bytes);
+  h.index_bytes = (uint32_t)stream_vbyte_encode(w.deltas.begin(), h.features, (uint8_t*)c + sizeof(h));
+  memcpy(c, &h, sizeof(h));
+  cache.set(c + sizeof(h) + h.index_bytes);
+
+  buf_write(cache, c, h.values * sizeof(float));
+  memcpy(c, w.values.begin(), h.values * sizeof(float));
+
+  io_buf& meta = *w.meta;
+  size_t meta_bytes = meta.head - meta.space.begin();
+  buf_write(cache, c, meta_bytes);
+  memcpy(c, meta.space.begin(), meta_bytes);
+
+  meta.head = meta.space.begin();
+  w.deltas.erase();
+  w.values.erase();
+  w.examples = 0;
+}
+
+void cache_block_example(vw& all, example* ae)
+{ block_writer& w = *all.p->cache_out;
+  io_buf& meta = *w.meta;
+  all.p->lp.cache_label(&ae->l, meta);
+  cache_tag(meta, ae->tag);
+  output_byte(meta, (unsigned char) ae->indices.size());
+
+  char* c;
+  buf_write(meta, c, ae->indices.size() * namespace_header_bytes);
+  for (namespace_index ns : ae->indices)
+  { features& fs = ae->feature_space[ns];
+    namespace_header h;
+    h.index = ns;
+    h.explicit_values = 0;
+    for (feature_value v : fs.values)
+      if (v != 1.)
+      { h.explicit_values = 1;
+        break;
+      }
+    h.count = (uint32_t)fs.size();
+    write_namespace_header(c, h);
+    c += namespace_header_bytes;
+
+    uint32_t last = 0;
+    for (feature_index i : fs.indicies)
+    { uint32_t index = (uint32_t)(i & all.parse_mask);
+      w.deltas.push_back(ZigZagEncode32((int32_t)(index - last)));
+      last = index;
+    }
+    if (h.explicit_values)
+      push_many(w.values, fs.values.begin(), fs.values.size());
+  }
+
+  if (++w.examples >= block_examples || w.deltas.size() >= block_features)
+    write_cache_block(*all.p->output, w);
+}
+
+void cache_example(vw& all, example* ae)
+{ if (all.p->cache_out != nullptr)
+    cache_block_example(all, ae);
+  else
+  { all.p->lp.cache_label(&ae->l, *(all.p->output));
+    cache_features(*(all.p->output), ae, all.parse_mask);
+  }
+}
+
+void flush_cache_block(vw& all)
+{ if (all.p->cache_out != nullptr)
+    write_cache_block(*all.p->output, *all.p->cache_out);
+}
@@ -17,3 +17,37 @@ void cache_features(io_buf& cache, example* ae, uint64_t mask);
 void output_byte(io_buf& cache, unsigned char s);
 void output_features(io_buf& cache, unsigned char index, features& fs, uint64_t mask);
 
+// The block cache format.  Examples are grouped into blocks.  A block holds the zigzagged index
+// deltas of all its features as one stream-vbyte column, then the values of the namespaces that
+// aren't all 1.0, then the label, tag and namespace headers of each example in order.  Indices are
+// stored in 32 bits, so caches for more than 32 bits use the format above.
+const char cache_marker = 'c';
+const char block_cache_marker = 'b';
+
+struct block_reader
+{ v_array<uint32_t> deltas;
+  v_array<float> values;
+  size_t next_delta;
+  size_t next_value;
+  size_t examples_left;
+};
+
+struct block_writer
+{ io_buf* meta; // labels, tags and namespace headers, until the block is written
+  v_array<uint32_t> deltas;
+  v_array<float> values;
+  size_t examples;
+};
+
+block_reader* new_block_reader();
+block_writer* new_block_writer();
+void free_block_reader(block_reader* b);
+void free_block_writer(block_writer* b);
+
+int read_block_cached_features(vw* all, v_array<example*>& examples);
+void cache_example(vw& all, example* ae); // the label and features, in the format being written
+void flush_cache_block(vw& all);
+
+size_t stream_vbyte_encode(const uint32_t* in, size_t n, uint8_t* out);
+const uint8_t* stream_vbyte_decode(const uint8_t* in, size_t n, uint32_t* out, const uint8_t* end);
+
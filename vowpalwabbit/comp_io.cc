@@ -49,6 +49,8 @@ ssize_t comp_io_buf::read_file(int f, void* buf, size_t nbytes)
   return (num_read > 0) ? num_read : 0;
 }
 
+int64_t comp_io_buf::file_offset() { return -1; }
+
 size_t comp_io_buf::num_files() { return gz_files.size(); }
 
 ssize_t comp_io_buf::write_file(int file, const void* buf, size_t nbytes)
@@ -145,6 +145,7 @@ struct ldf
   uint64_t ft_offset;
 
   v_array<action_scores > stored_preds;
+  v_array<COST_SENSITIVE::wclass*> all_costs; // reused by do_actual_learning_wap
 };
 
 bool ec_is_label_definition(example& ec) // label defs look like "0:___" or just "label:___"
@@ -170,7 +171,7 @@ bool ec_seq_is_label_definition(v_array<example*>ec_seq)
 
 inline bool cmp_wclass_ptr(const COST_SENSITIVE::wclass* a, const COST_SENSITIVE::wclass* b) { return a->x < b->x; }
 
-void compute_wap_values(vector<COST_SENSITIVE::wclass*> costs)
+void compute_wap_values(v_array<COST_SENSITIVE::wclass*>& costs)
 { std::sort(costs.begin(), costs.end(), cmp_wclass_ptr);
   costs[0]->wap_value = 0.;
   for (size_t i=1; i<costs.size(); i++)
@@ -208,7 +209,10 @@ void unsubtract_example(example *ec)
   features& fs = ec->feature_space[wap_ldf_namespace];
   ec->num_features -= fs.size();
   ec->total_sum_feat_sq -= fs.sum_feat_sq;
-  fs.erase();
+  // truncated rather than erased: every 1024th erase shrinks the arrays to fit, and the next pair
+  // would grow them again
+  fs.truncate_to(0);
+  fs.sum_feat_sq = 0;
   ec->indices.decr();
 }
 
@@ -254,7 +258,8 @@ bool test_ldf_sequence(ldf& data, size_t start_K)
 
 void do_actual_learning_wap(ldf& data, base_learner& base, size_t start_K)
 { size_t K = data.ec_seq.size();
-  vector<COST_SENSITIVE::wclass*> all_costs;
+  v_array<COST_SENSITIVE::wclass*>& all_costs = data.all_costs;
+  all_costs.end() = all_costs.begin();
   for (size_t k=start_K; k<K; k++)
     all_costs.push_back(&data.ec_seq[k]->l.cs.costs[0]);
   compute_wap_values(all_costs);
@@ -648,7 +653,7 @@ void clear_seq_and_finish_examples(vw& all, ldf& data)
     for (auto ec : data.ec_seq)
       if (ec->in_use)
         VW::finish_example(all, ec);
-  data.ec_seq.erase();
+  data.ec_seq.end() = data.ec_seq.begin(); // no shrinking erase, the next sequence is as long
 }
 
 void end_pass(ldf& data)
@@ -692,6 +697,7 @@ void finish(ldf& data)
   LabelDict::free_label_features(data.label_features);
   data.a_s.delete_v();
   data.stored_preds.delete_v();
+  data.all_costs.delete_v();
 }
 
 template <bool is_learn>
@@ -723,7 +729,7 @@ void predict_or_learn(ldf& data, base_learner& base, example &ec)
   }
   else
   { if (data.need_to_clear)    // should only happen if we're NOT driving
-    { data.ec_seq.erase();
+    { data.ec_seq.end() = data.ec_seq.begin();
       data.need_to_clear = false;
     }
     data.ec_seq.push_back(&ec);
@@ -185,5 +185,6 @@ void dealloc_example(void(*delete_label)(void*), example&ec, void(*delete_predic
     ec.feature_space[j].delete_v();
 
   ec.indices.delete_v();
+  ec.scratch.delete_v();
 }
 }
@@ -97,6 +97,7 @@ struct example // core example datatype.
   float total_sum_feat_sq;//precomputed, cause it's kind of fast & easy.
   float confidence;
   features* passthrough; // if a higher-up reduction wants access to internal state of lower-down reductions, they go here
+  v_array<unsigned char> scratch; // working memory kept from one use of the example to the next, see scratch_array()
 
   bool test_only;
   bool end_pass;//special example indicating end of pass.
@@ -107,6 +108,16 @@ struct example // core example datatype.
   iterator end() { return iterator(feature_space, indices.end()); }
 };
 
+// n uninitialized T's in the example's scratch memory, which only grows, so that per example
+// temporaries stop allocating once the largest example has been seen.  The memory is shared
+// by all callers: it is only valid until the next call on the same example.
+template<class T> T* scratch_array(example& ec, size_t n)
+{ size_t bytes = n * sizeof(T);
+  if ((size_t)(ec.scratch.end_array - ec.scratch.begin()) < bytes)
+    ec.scratch.resize(bytes);
+  return (T*)ec.scratch.begin();
+}
+
 struct vw;
 
 struct flat_example
@@ -268,7 +268,9 @@ base_learner* ftrl_setup(vw& all)
   b.data.l1_lambda = b.all->l1_lambda;
   b.data.l2_lambda = b.all->l2_lambda;
 
-  all.weights.stride_shift(2); // NOTE: for more parameter storage
+  // NOTE: for more parameter storage.  Predicting only reads W_XT, so with -t the weights are
+  // packed next to each other rather than every 4th float of the array.
+  all.weights.stride_shift(all.training ? 2 : 0);
 
   if (!all.quiet)
   { cerr << "Enabling FTRL based optimization" << endl;
@@ -288,7 +290,8 @@ base_learner* ftrl_setup(vw& all)
     l.set_predict(predict<true>);
   else
     l.set_predict(predict<false>);
-  l.set_sensitivity(sensitivity);
+  if (all.training)
+    l.set_sensitivity(sensitivity); // reads W_G2
   if (all.audit || all.hash_inv)
     l.set_multipredict(multipredict<true>);
   else
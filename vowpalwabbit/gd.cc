@@ -10,6 +10,8 @@ license as described in the file LICENSE.
 #include <WinSock2.h>
 #else
 #include <netdb.h>
+#include <sys/stat.h>
+#include <unistd.h>
 #endif
 
 #if !defined(VW_NO_INLINE_SIMD)
@@ -25,6 +27,7 @@ license as described in the file LICENSE.
 #include "reductions.h"
 #include "vw.h"
 #include "floatbits.h"
+#include "model_chunks.h"
 
 #define VERSION_SAVE_RESUME_FIX "7.10.1"
 #define VERSION_PASS_UINT64 "8.3.3"
@@ -52,6 +55,7 @@ struct gd
   void (*multipredict)(gd&, base_learner&, example&, size_t, size_t, polyprediction*, bool);
   bool normalized;
   bool adaptive;
+  bool kernels; // dense namespaces go through the SIMD kernels
 
   vw* all; //parallel, features, parameters
 };
@@ -123,21 +127,15 @@ inline void update_feature(float& update, float x, float& fw)
     return 1.f;
   }
 
-template<bool sqrt_rate, bool feature_mask_off, size_t adaptive, size_t normalized, size_t spare>
-void train(gd& g, example& ec, float update)
-{ if (normalized)
-    update *= g.update_multiplier;
-  foreach_feature<float, update_feature<sqrt_rate, feature_mask_off, adaptive, normalized, spare> >(*g.all, ec, update);
-}
-
 void end_pass(gd& g)
 { vw& all = *g.all;
   sync_weights(all);
   if (all.all_reduce != nullptr)
-  { if (all.adaptive)
-      accumulate_weighted_avg(all, all.weights);
+  { finish_average(all, all.weights);
+    if (all.allreduce_overlap && all.holdout_set_off && all.current_pass + 1 < all.numpasses)
+      start_average(all, all.weights); // the last pass averages at once, so every node ends the same
     else
-      accumulate_avg(all, all.weights, 0);
+      average_weights(all, all.weights);
   }
   all.eta *= all.eta_decay_rate;
   if (all.save_per_pass)
@@ -333,11 +331,148 @@ inline void vec_add_print(float&p, const float fx, float& fw)
   cerr << " + " << fw << "*" << fx;
 }
 
+#if !defined(VW_NO_INLINE_SIMD) && defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define GD_SIMD
+#include <immintrin.h>
+
+// --simd: the linear features of each namespace go through the kernels below, 8 at a time, for the
+// prediction and, with 4 weight slots per feature (adaptive and/or normalized updates, power_t 0.5,
+// no feature mask), for the update.  That pays off on long dense namespaces (embeddings, pixels).
+// The per-weight arithmetic is the scalar one, but the sums over a namespace are kept in 8 partial
+// sums, so results differ from the scalar code in the last bits.  AVX2 and AVX-512 add up in the
+// same order and agree with each other.  A group of 8 that repeats a weight, or that would throw,
+// goes through the scalar code, which applies the overlapping updates in order.
+
+enum simd_level { simd_none, simd_avx2, simd_avx512 };
+
+simd_level pick_simd_level()
+{ __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512cd"))
+    return simd_avx512;
+  if (__builtin_cpu_supports("avx2"))
+    return simd_avx2;
+  return simd_none;
+}
+static const simd_level gd_simd = pick_simd_level();
+
+// the AVX-512 kernels turn fp-contract off: avx512f brings fma, and fused multiply-adds would round
+// differently from the AVX2 kernels
+#define AVX512_KERNEL __attribute__((target("avx512f,avx512cd"), optimize("fp-contract=off")))
+
+__attribute__((target("avx2")))
+inline __m256 combine(__m128 lo, __m128 hi)
+{ return _mm256_insertf128_ps(_mm256_castps128_ps256(lo), hi, 1); }
+
+__attribute__((target("avx2")))
+inline float horizontal_sum(__m256 v)
+{ __m128 s = _mm_add_ps(_mm256_castps256_ps128(v), _mm256_extractf128_ps(v, 1));
+  s = _mm_add_ps(s, _mm_movehl_ps(s, s));
+  return _mm_cvtss_f32(_mm_add_ss(s, _mm_shuffle_ps(s, s, 1)));
+}
+
+// loads the 8 weight indices starting at feature i, offset and masked like dense_parameters::operator[]
+__attribute__((target("avx2")))
+inline void weight_indices(features& fs, size_t i, uint64_t offset, uint64_t mask, __m256i& lo, __m256i& hi)
+{ __m256i off = _mm256_set1_epi64x(offset);
+  __m256i m = _mm256_set1_epi64x(mask);
+  lo = _mm256_and_si256(_mm256_add_epi64(_mm256_loadu_si256((const __m256i*)(fs.indicies.begin() + i)), off), m);
+  hi = _mm256_and_si256(_mm256_add_epi64(_mm256_loadu_si256((const __m256i*)(fs.indicies.begin() + i + 4)), off), m);
+}
+
+AVX512_KERNEL
+inline __m512i weight_indices(features& fs, size_t i, uint64_t offset, uint64_t mask)
+{ __m512i index = _mm512_add_epi64(_mm512_loadu_si512(fs.indicies.begin() + i), _mm512_set1_epi64(offset));
+  return _mm512_and_si512(index, _mm512_set1_epi64(mask));
+}
+
+__attribute__((target("avx2")))
+inline bool distinct(__m256i lo, __m256i hi)
+{ __m256i lo1 = _mm256_permute4x64_epi64(lo, 0x39), lo2 = _mm256_permute4x64_epi64(lo, 0x4e);
+  __m256i hi1 = _mm256_permute4x64_epi64(hi, 0x39), hi2 = _mm256_permute4x64_epi64(hi, 0x4e);
+  __m256i hi3 = _mm256_permute4x64_epi64(hi, 0x93);
+  __m256i same = _mm256_or_si256(_mm256_cmpeq_epi64(lo, lo1), _mm256_cmpeq_epi64(lo, lo2));
+  same = _mm256_or_si256(same, _mm256_or_si256(_mm256_cmpeq_epi64(hi, hi1), _mm256_cmpeq_epi64(hi, hi2)));
+  same = _mm256_or_si256(same, _mm256_or_si256(_mm256_cmpeq_epi64(lo, hi), _mm256_cmpeq_epi64(lo, hi1)));
+  same = _mm256_or_si256(same, _mm256_or_si256(_mm256_cmpeq_epi64(lo, hi2), _mm256_cmpeq_epi64(lo, hi3)));
+  return _mm256_testz_si256(same, same);
+}
+
+AVX512_KERNEL
+inline bool distinct(__m512i index)
+{ __m512i conflicts = _mm512_conflict_epi64(index);
+  return _mm512_test_epi64_mask(conflicts, conflicts) == 0;
+}
+
+AVX512_KERNEL
+inline __m256 gather(weight* base, __m512i index)
+{ return _mm512_mask_i64gather_ps(_mm256_setzero_ps(), 0xff, index, base, 4); }
+
+__attribute__((target("avx2")))
+float dot_avx2(features& fs, dense_parameters& weights, uint64_t offset)
+{ weight* base = weights.first();
+  __m256 sum = _mm256_setzero_ps();
+  size_t i = 0;
+  for (; i + 8 <= fs.size(); i += 8)
+  { __m256i lo, hi;
+    weight_indices(fs, i, offset, weights.mask(), lo, hi);
+    __m256 w = combine(_mm256_i64gather_ps(base, lo, 4), _mm256_i64gather_ps(base, hi, 4));
+    sum = _mm256_add_ps(sum, _mm256_mul_ps(w, _mm256_loadu_ps(fs.values.begin() + i)));
+  }
+  float dot = horizontal_sum(sum);
+  for (; i < fs.size(); i++)
+    vec_add(dot, fs.values[i], weights[fs.indicies[i] + offset]);
+  return dot;
+}
+
+AVX512_KERNEL
+float dot_avx512(features& fs, dense_parameters& weights, uint64_t offset)
+{ weight* base = weights.first();
+  __m256 sum = _mm256_setzero_ps();
+  size_t i = 0;
+  for (; i + 8 <= fs.size(); i += 8)
+  { __m256 w = gather(base, weight_indices(fs, i, offset, weights.mask()));
+    sum = _mm256_add_ps(sum, _mm256_mul_ps(w, _mm256_loadu_ps(fs.values.begin() + i)));
+  }
+  float dot = horizontal_sum(sum);
+  for (; i < fs.size(); i++)
+    vec_add(dot, fs.values[i], weights[fs.indicies[i] + offset]);
+  return dot;
+}
+
+// inline_predict with the kernels
+float kernel_predict(vw& all, example& ec)
+{ float prediction = ec.l.simple.initial;
+  for (example::iterator i = ec.begin(); i != ec.end(); ++i)
+    if (!all.ignore_some_linear || !all.ignore_linear[i.index()])
+    { if (gd_simd == simd_avx512)
+        prediction += dot_avx512(*i, all.weights.dense_weights, ec.ft_offset);
+      else
+        prediction += dot_avx2(*i, all.weights.dense_weights, ec.ft_offset);
+    }
+  INTERACTIONS::generate_interactions<float, const float&, vec_add>(all, ec, prediction);
+  return prediction;
+}
+#endif
+
+// -t on a --quantize_model model: no l1 truncation, as the export came after it
+float quantized_predict(vw& all, example& ec)
+{ if (all.weights.quantized == quantize_fp16)
+    return inline_predict(all, ec, all.weights.half_weights);
+  else
+    return inline_predict(all, ec, all.weights.int8_weights);
+}
+
 template<bool l1, bool audit>
 void predict(gd& g, base_learner&, example& ec)
 { vw& all = *g.all;
-  if (l1)
+  if (all.weights.quantized != quantize_none)
+    ec.partial_prediction = quantized_predict(all, ec);
+  else if (l1)
     ec.partial_prediction = trunc_predict(all, ec, all.sd->gravity);
+#ifdef GD_SIMD
+  else if (g.kernels)
+    ec.partial_prediction = kernel_predict(all, ec);
+#endif
   else
     ec.partial_prediction = inline_predict(all, ec);
 
@@ -359,7 +494,15 @@ void multipredict(gd& g, base_learner&, example& ec, size_t count, size_t step,
 { vw& all = *g.all;
   for (size_t c=0; c<count; c++)
     pred[c].scalar = ec.l.simple.initial;
-  if (g.all->weights.sparse)
+  if (all.weights.quantized == quantize_fp16)
+    { multipredict_info<quantized_parameters<uint16_t> > mp = { count, step, pred, all.weights.half_weights, 0.f };
+      foreach_feature<multipredict_info<quantized_parameters<uint16_t> >, uint64_t, vec_add_multipredict>(all, ec, mp);
+    }
+  else if (all.weights.quantized == quantize_int8)
+    { multipredict_info<quantized_parameters<int8_t> > mp = { count, step, pred, all.weights.int8_weights, 0.f };
+      foreach_feature<multipredict_info<quantized_parameters<int8_t> >, uint64_t, vec_add_multipredict>(all, ec, mp);
+    }
+  else if (g.all->weights.sparse)
     {
       multipredict_info<sparse_parameters> mp =
 	{ count, step, pred, g.all->weights.sparse_weights, (float)all.sd->gravity };
@@ -473,6 +616,215 @@ inline void pred_per_update_feature(norm_data& nd, float x, float& fw)
   }
 }
 
+#ifdef GD_SIMD
+// pred_per_update_feature<true, true, adaptive, normalized, spare, false> on 8 features whose weight
+// slots are w[0..3], adding to the partial sums; returns false, having changed nothing, if a feature
+// is too large
+template<size_t adaptive, size_t normalized, size_t spare>
+__attribute__((target("avx2")))
+inline bool pred_per_update_lanes(norm_data& nd, __m256 x, __m256* w, __m256& norm_x, __m256& pred_per_update)
+{ __m256 x2 = _mm256_mul_ps(x, x);
+  if (_mm256_movemask_ps(_mm256_cmp_ps(x2, _mm256_set1_ps(x2_max), _CMP_GT_OQ)) != 0)
+    return false;
+  __m256 small = _mm256_cmp_ps(x2, _mm256_set1_ps(x2_min), _CMP_LT_OQ);
+  if (_mm256_movemask_ps(small) != 0)
+  { __m256 positive = _mm256_cmp_ps(x, _mm256_setzero_ps(), _CMP_GT_OQ);
+    x = _mm256_blendv_ps(x, _mm256_blendv_ps(_mm256_set1_ps(-x_min), _mm256_set1_ps(x_min), positive), small);
+    x2 = _mm256_blendv_ps(x2, _mm256_set1_ps(x2_min), small);
+  }
+
+  __m256 rate_decay = _mm256_set1_ps(1.f);
+  if (adaptive)
+  { w[adaptive] = _mm256_add_ps(w[adaptive], _mm256_mul_ps(_mm256_set1_ps(nd.grad_squared), x2));
+    rate_decay = _mm256_rsqrt_ps(w[adaptive]); // the same approximation as InvSqrt
+  }
+  if (normalized)
+  { __m256 x_abs = _mm256_andnot_ps(_mm256_set1_ps(-0.f), x);
+    __m256 grown = _mm256_cmp_ps(x_abs, w[normalized], _CMP_GT_OQ);
+    __m256 rescale = _mm256_div_ps(w[normalized], x_abs);
+    if (!adaptive)
+      rescale = _mm256_mul_ps(rescale, rescale);
+    __m256 rescaled = _mm256_and_ps(grown, _mm256_cmp_ps(w[normalized], _mm256_setzero_ps(), _CMP_GT_OQ));
+    w[0] = _mm256_blendv_ps(w[0], _mm256_mul_ps(w[0], rescale), rescaled);
+    w[normalized] = _mm256_blendv_ps(w[normalized], x_abs, grown);
+    norm_x = _mm256_add_ps(norm_x, _mm256_div_ps(x2, _mm256_mul_ps(w[normalized], w[normalized])));
+
+    __m256 inv_norm = _mm256_div_ps(_mm256_set1_ps(1.f), w[normalized]);
+    if (adaptive)
+      rate_decay = _mm256_mul_ps(rate_decay, inv_norm);
+    else
+      rate_decay = _mm256_mul_ps(inv_norm, inv_norm);
+  }
+  w[spare] = rate_decay;
+  pred_per_update = _mm256_add_ps(pred_per_update, _mm256_mul_ps(x2, rate_decay));
+  return true;
+}
+
+template<size_t adaptive, size_t normalized, size_t spare>
+__attribute__((target("avx2")))
+void pred_per_update_avx2(norm_data& nd, features& fs, dense_parameters& weights, uint64_t offset)
+{ weight* base = weights.first();
+  __m256 norm_x = _mm256_setzero_ps(), pred_per_update = _mm256_setzero_ps();
+  size_t i = 0;
+  for (; i + 8 <= fs.size(); i += 8)
+  { __m256i lo, hi;
+    weight_indices(fs, i, offset, weights.mask(), lo, hi);
+    if (distinct(lo, hi))
+    { uint64_t index[8];
+      _mm256_storeu_si256((__m256i*)index, lo);
+      _mm256_storeu_si256((__m256i*)(index + 4), hi);
+      // a feature's 4 slots are adjacent: load them as rows and transpose into one vector per slot
+      __m128 a[4], b[4];
+      for (size_t k = 0; k < 4; k++)
+      { a[k] = _mm_loadu_ps(base + index[k]);
+        b[k] = _mm_loadu_ps(base + index[k + 4]);
+      }
+      _MM_TRANSPOSE4_PS(a[0], a[1], a[2], a[3]);
+      _MM_TRANSPOSE4_PS(b[0], b[1], b[2], b[3]);
+      __m256 w[4];
+      for (size_t k = 0; k < 4; k++)
+        w[k] = combine(a[k], b[k]);
+
+      if (pred_per_update_lanes<adaptive, normalized, spare>(nd, _mm256_loadu_ps(fs.values.begin() + i), w, norm_x, pred_per_update))
+      { for (size_t k = 0; k < 4; k++)
+        { a[k] = _mm256_castps256_ps128(w[k]);
+          b[k] = _mm256_extractf128_ps(w[k], 1);
+        }
+        _MM_TRANSPOSE4_PS(a[0], a[1], a[2], a[3]);
+        _MM_TRANSPOSE4_PS(b[0], b[1], b[2], b[3]);
+        for (size_t k = 0; k < 4; k++)
+        { _mm_storeu_ps(base + index[k], a[k]);
+          _mm_storeu_ps(base + index[k + 4], b[k]);
+        }
+        continue;
+      }
+    }
+    for (size_t k = i; k < i + 8; k++)
+      pred_per_update_feature<true, true, adaptive, normalized, spare, false>(nd, fs.values[k], weights[fs.indicies[k] + offset]);
+  }
+  nd.norm_x += horizontal_sum(norm_x);
+  nd.pred_per_update += horizontal_sum(pred_per_update);
+  for (; i < fs.size(); i++)
+    pred_per_update_feature<true, true, adaptive, normalized, spare, false>(nd, fs.values[i], weights[fs.indicies[i] + offset]);
+}
+
+template<size_t adaptive, size_t normalized, size_t spare>
+AVX512_KERNEL
+void pred_per_update_avx512(norm_data& nd, features& fs, dense_parameters& weights, uint64_t offset)
+{ weight* base = weights.first();
+  __m256 norm_x = _mm256_setzero_ps(), pred_per_update = _mm256_setzero_ps();
+  size_t i = 0;
+  for (; i + 8 <= fs.size(); i += 8)
+  { __m512i index = weight_indices(fs, i, offset, weights.mask());
+    if (distinct(index))
+    { __m256 w[4];
+      for (size_t k = 0; k < 4; k++)
+        w[k] = gather(base + k, index);
+      if (pred_per_update_lanes<adaptive, normalized, spare>(nd, _mm256_loadu_ps(fs.values.begin() + i), w, norm_x, pred_per_update))
+      { for (size_t k = 0; k < 4; k++)
+          _mm512_i64scatter_ps(base + k, index, w[k], 4);
+        continue;
+      }
+    }
+    for (size_t k = i; k < i + 8; k++)
+      pred_per_update_feature<true, true, adaptive, normalized, spare, false>(nd, fs.values[k], weights[fs.indicies[k] + offset]);
+  }
+  nd.norm_x += horizontal_sum(norm_x);
+  nd.pred_per_update += horizontal_sum(pred_per_update);
+  for (; i < fs.size(); i++)
+    pred_per_update_feature<true, true, adaptive, normalized, spare, false>(nd, fs.values[i], weights[fs.indicies[i] + offset]);
+}
+
+template<size_t adaptive, size_t normalized, size_t spare>
+void pred_per_update_kernel(norm_data& nd, features& fs, dense_parameters& weights, uint64_t offset)
+{ if (gd_simd == simd_avx512)
+    pred_per_update_avx512<adaptive, normalized, spare>(nd, fs, weights, offset);
+  else
+    pred_per_update_avx2<adaptive, normalized, spare>(nd, fs, weights, offset);
+}
+
+// update_feature<true, true, adaptive, normalized, spare>, which only depends on spare
+template<size_t spare>
+__attribute__((target("avx2")))
+void update_avx2(float& update, features& fs, dense_parameters& weights, uint64_t offset)
+{ weight* base = weights.first();
+  size_t i = 0;
+  for (; i + 8 <= fs.size(); i += 8)
+  { __m256i lo, hi;
+    weight_indices(fs, i, offset, weights.mask(), lo, hi);
+    if (distinct(lo, hi))
+    { __m256 w = combine(_mm256_i64gather_ps(base, lo, 4), _mm256_i64gather_ps(base, hi, 4));
+      __m256 rate = combine(_mm256_i64gather_ps(base + spare, lo, 4), _mm256_i64gather_ps(base + spare, hi, 4));
+      __m256 x = _mm256_mul_ps(_mm256_loadu_ps(fs.values.begin() + i), rate);
+      w = _mm256_add_ps(w, _mm256_mul_ps(_mm256_set1_ps(update), x));
+
+      uint64_t index[8];
+      float updated[8];
+      _mm256_storeu_si256((__m256i*)index, lo);
+      _mm256_storeu_si256((__m256i*)(index + 4), hi);
+      _mm256_storeu_ps(updated, w);
+      for (size_t k = 0; k < 8; k++)
+        base[index[k]] = updated[k];
+    }
+    else
+      for (size_t k = i; k < i + 8; k++)
+        update_feature<true, true, 0, 0, spare>(update, fs.values[k], weights[fs.indicies[k] + offset]);
+  }
+  for (; i < fs.size(); i++)
+    update_feature<true, true, 0, 0, spare>(update, fs.values[i], weights[fs.indicies[i] + offset]);
+}
+
+template<size_t spare>
+AVX512_KERNEL
+void update_avx512(float& update, features& fs, dense_parameters& weights, uint64_t offset)
+{ weight* base = weights.first();
+  size_t i = 0;
+  for (; i + 8 <= fs.size(); i += 8)
+  { __m512i index = weight_indices(fs, i, offset, weights.mask());
+    if (distinct(index))
+    { __m256 x = _mm256_mul_ps(_mm256_loadu_ps(fs.values.begin() + i), gather(base + spare, index));
+      __m256 w = _mm256_add_ps(gather(base, index), _mm256_mul_ps(_mm256_set1_ps(update), x));
+      _mm512_i64scatter_ps(base, index, w, 4);
+    }
+    else
+      for (size_t k = i; k < i + 8; k++)
+        update_feature<true, true, 0, 0, spare>(update, fs.values[k], weights[fs.indicies[k] + offset]);
+  }
+  for (; i < fs.size(); i++)
+    update_feature<true, true, 0, 0, spare>(update, fs.values[i], weights[fs.indicies[i] + offset]);
+}
+
+template<size_t spare>
+void update_kernel(float& update, features& fs, dense_parameters& weights, uint64_t offset)
+{ if (gd_simd == simd_avx512)
+    update_avx512<spare>(update, fs, weights, offset);
+  else
+    update_avx2<spare>(update, fs, weights, offset);
+}
+
+// foreach_feature(all, ec, dat) with the linear features of each namespace going to kernel K
+template <class R, void (*T)(R&, float, float&), void (*K)(R&, features&, dense_parameters&, uint64_t)>
+inline void foreach_feature_kernel(vw& all, example& ec, R& dat)
+{ for (example::iterator i = ec.begin(); i != ec.end(); ++i)
+    if (!all.ignore_some_linear || !all.ignore_linear[i.index()])
+      K(dat, *i, all.weights.dense_weights, ec.ft_offset);
+  INTERACTIONS::generate_interactions<R, float&, T>(all, ec, dat);
+}
+#endif
+
+template<bool sqrt_rate, bool feature_mask_off, size_t adaptive, size_t normalized, size_t spare>
+void train(gd& g, example& ec, float update)
+{ if (normalized)
+    update *= g.update_multiplier;
+#ifdef GD_SIMD
+  if (sqrt_rate && feature_mask_off && spare != 0 && g.kernels)
+  { foreach_feature_kernel<float, update_feature<true, true, adaptive, normalized, spare>, update_kernel<spare> >(*g.all, ec, update);
+    return;
+  }
+#endif
+  foreach_feature<float, update_feature<sqrt_rate, feature_mask_off, adaptive, normalized, spare> >(*g.all, ec, update);
+}
+
 bool global_print_features = false;
 template<bool sqrt_rate, bool feature_mask_off, size_t adaptive, size_t normalized, size_t spare, bool stateless>
 float get_pred_per_update(gd& g, example& ec)
@@ -483,7 +835,12 @@ float get_pred_per_update(gd& g, example& ec)
   if (grad_squared == 0 && !stateless) return 1.;
 
   norm_data nd = {grad_squared, 0., 0., {g.neg_power_t, g.neg_norm_power}};
-  foreach_feature<norm_data,pred_per_update_feature<sqrt_rate, feature_mask_off, adaptive, normalized, spare, stateless> >(all, ec, nd);
+#ifdef GD_SIMD
+  if (sqrt_rate && feature_mask_off && !stateless && g.kernels)
+    foreach_feature_kernel<norm_data, pred_per_update_feature<true, true, adaptive, normalized, spare, false>, pred_per_update_kernel<adaptive, normalized, spare> >(all, ec, nd);
+  else
+#endif
+    foreach_feature<norm_data,pred_per_update_feature<sqrt_rate, feature_mask_off, adaptive, normalized, spare, stateless> >(all, ec, nd);
   if(normalized)
   { if(!stateless)
     { g.all->normalized_sum_norm_x += ec.weight * nd.norm_x;
@@ -580,6 +937,36 @@ void learn(gd& g, base_learner& base, example& ec)
   update<sparse_l2, invariant, sqrt_rate, feature_mask_off, adaptive, normalized, spare>(g,base,ec);
 }
 
+// with --weight_prefetch a batch asks for the linear weights of the next example while working on
+// the current one
+inline void prefetch_linear(vw& all, example& ec)
+{ for (example::iterator i = ec.begin(); i != ec.end(); ++i)
+    if (!all.ignore_some_linear || !all.ignore_linear[i.index()])
+      for (feature_index j : (*i).indicies)
+        INTERACTIONS::prefetch_weight(all.weights.dense_weights, j + ec.ft_offset);
+}
+
+template<bool l1>
+void predict_batch(gd& g, base_learner& base, example** ecs, size_t count)
+{ vw& all = *g.all;
+  bool prefetch = all.weight_prefetch > 0 && !all.weights.sparse && all.weights.quantized == quantize_none;
+  for (size_t c = 0; c < count; c++)
+  { if (prefetch && c + 1 < count)
+      prefetch_linear(all, *ecs[c+1]);
+    predict<l1, false>(g, base, *ecs[c]);
+  }
+}
+
+void learn_batch(gd& g, base_learner& base, example** ecs, size_t count)
+{ vw& all = *g.all;
+  bool prefetch = all.weight_prefetch > 0 && !all.weights.sparse;
+  for (size_t c = 0; c < count; c++)
+  { if (prefetch && c + 1 < count)
+      prefetch_linear(all, *ecs[c+1]);
+    g.learn(g, base, *ecs[c]);
+  }
+}
+
 void sync_weights(vw& all)
 {//todo, fix length dependence
 	if (all.sd->gravity == 0. && all.sd->contraction == 1.)  // to avoid unnecessary weight synchronization
@@ -596,8 +983,235 @@ void sync_weights(vw& all)
 	all.sd->contraction = 1.;
 }
 
+// --dense_model: after an index no weight has, the regressor is one float for each weight, starting
+// page aligned in the file so that -i can map it instead of reading it.  --compress_model follows
+// another such index with the chunks of model_chunks.h.
+const uint64_t image_marker = (uint64_t)-1;
+const uint64_t chunks_marker = (uint64_t)-2;
+const size_t image_alignment = 4096;
+const size_t image_chunk = 1 << 14; // weights copied at once
+
+// markers are cut to 32 bits where indices are
+bool is_marker(vw& all, uint64_t i, uint64_t marker)
+{ return i == (all.num_bits < 31 ? (uint32_t)marker : marker); }
+
+void write_marker(vw& all, io_buf& model_file, uint64_t marker)
+{ bin_write_fixed(model_file, (const char*)&marker, all.num_bits < 31 ? sizeof(uint32_t) : sizeof(uint64_t)); } // little endian, as the rest
+
+bool write_image(vw&, io_buf&, sparse_parameters&) { return false; } // as dense, a sparse model would be mostly zeros
+
+bool write_image(vw& all, io_buf& model_file, dense_parameters& weights)
+{ uint64_t length = (uint64_t)1 << all.num_bits;
+  size_t marker_size = all.num_bits < 31 ? sizeof(uint32_t) : sizeof(uint64_t);
+  int64_t at = model_file.file_offset(); // a pipe gets no padding, and is loaded by copying
+  uint32_t pad = 0;
+  if (at >= 0)
+    pad = (uint32_t)((image_alignment - (at + marker_size + sizeof(length) + sizeof(pad)) % image_alignment) % image_alignment);
+
+  write_marker(all, model_file, image_marker);
+  bin_write_fixed(model_file, (const char*)&length, sizeof(length));
+  bin_write_fixed(model_file, (const char*)&pad, sizeof(pad));
+  char zeros[image_alignment] = {};
+  bin_write_fixed(model_file, zeros, pad);
+
+  for (uint64_t i = 0; i < length; i += image_chunk)
+  { size_t n = (size_t)min((uint64_t)image_chunk, length - i);
+    char* p;
+    buf_write(model_file, p, n * sizeof(weight));
+    for (size_t j = 0; j < n; j++)
+      memcpy(p + j * sizeof(weight), &weights.strided_index(i + j), sizeof(weight));
+  }
+  return true;
+}
+
+bool map_image(vw&, io_buf&, sparse_parameters&, uint64_t) { return false; }
+
+bool map_image(vw& all, io_buf& model_file, dense_parameters& weights, uint64_t length)
+{
+#ifdef _WIN32
+  return false;
+#else
+  // the file holds every weight with nothing in between, and nothing was put in the array that a
+  // zero in the file would not overwrite; --hugepages and --numa place memory a file can not be in
+  if (weights.stride_shift() != 0 || weights.seeded() || weights.strided_index(constant) != 0.
+      || all.initial_weight != 0. || all.random_weights || all.random_positive_weights || all.normal_weights || all.tnormal_weights
+      || all.weight_pages.huge != huge_none || all.weight_pages.numa != numa_none)
+    return false;
+  int64_t at = model_file.file_offset();
+  if (at < 0 || at % sysconf(_SC_PAGESIZE) != 0)
+    return false;
+
+  int fd = model_file.files[model_file.current];
+  size_t bytes = length * sizeof(weight);
+  struct stat st;
+  if (fstat(fd, &st) < 0 || (uint64_t)st.st_size < at + bytes)
+    THROW("Model content is corrupted, its weight array ends early");
+  if (!weights.map_file(fd, at, length))
+    return false;
+  model_file.seek_file(at + bytes);
+  if (!all.quiet)
+    all.trace_message << "weight array: mapped from the model file" << endl;
+  return true;
+#endif
+}
+
 template<class T>
-void save_load_regressor(vw& all, io_buf& model_file, bool read, bool text, T& weights)
+void read_image(vw& all, io_buf& model_file, T& weights)
+{ uint64_t length = (uint64_t)1 << all.num_bits;
+  uint64_t stored = 0;
+  uint32_t pad = 0;
+  char* p;
+  if (bin_read_fixed(model_file, (char*)&stored, sizeof(stored), "") < sizeof(stored) || stored != length
+      || bin_read_fixed(model_file, (char*)&pad, sizeof(pad), "") < sizeof(pad) || pad >= image_alignment
+      || buf_read(model_file, p, pad) < pad)
+    THROW("Model content is corrupted, its weight array does not have " << length << " weights");
+
+  if (map_image(all, model_file, weights, length))
+    return;
+
+  // zeros are left to the defaults, as with the pairs
+  for (uint64_t i = 0; i < length; i += image_chunk)
+  { size_t n = (size_t)min((uint64_t)image_chunk, length - i);
+    if (buf_read(model_file, p, n * sizeof(weight)) < n * sizeof(weight))
+      THROW("Model content is corrupted, its weight array ends early");
+    for (size_t j = 0; j < n; j++)
+    { weight v;
+      memcpy(&v, p + j * sizeof(weight), sizeof(weight));
+      if (v != 0.)
+        weights.strided_index(i + j) = v;
+    }
+  }
+}
+
+// --quantize_model: after another such index, the weight count, the kind and the block length,
+// then for int8 the scale of each block, then every weight in that kind.  It is read for -t only,
+// in place of the dense weights.
+const uint64_t quantized_marker = (uint64_t)-3;
+
+template<class T>
+void quantize(T& weights, quantized_parameters<uint16_t>& q)
+{ for (typename T::iterator v = weights.begin(); v != weights.end(); ++v)
+    if (*v != 0.)
+      q.values()[v.index() >> weights.stride_shift()] = float_to_half(*v);
+}
+
+// a block's largest magnitude becomes 127
+template<class T>
+void quantize(T& weights, quantized_parameters<int8_t>& q)
+{ float* scales = q.scales();
+  for (typename T::iterator v = weights.begin(); v != weights.end(); ++v)
+    if (*v != 0.)
+    { float& top = scales[(v.index() >> weights.stride_shift()) >> quantize_block_shift];
+      top = max(top, fabsf(*v));
+    }
+  for (size_t b = 0; b < q.blocks((q.mask() + 1) >> q.stride_shift()); b++)
+    scales[b] /= 127.f;
+  for (typename T::iterator v = weights.begin(); v != weights.end(); ++v)
+    if (*v != 0.)
+    { size_t j = v.index() >> weights.stride_shift();
+      q.values()[j] = (int8_t)lrintf(*v / scales[j >> quantize_block_shift]);
+    }
+}
+
+void write_array(io_buf& model_file, const char* data, size_t bytes)
+{ for (size_t i = 0; i < bytes; i += image_chunk * sizeof(weight))
+  { size_t n = min(image_chunk * sizeof(weight), bytes - i);
+    char* p;
+    buf_write(model_file, p, n);
+    memcpy(p, data + i, n);
+  }
+}
+
+// zero pages are not copied, so that those calloc gave stay unmapped as unused weights do
+void read_array(io_buf& model_file, char* data, size_t bytes)
+{ static const char zeros[image_alignment] = {};
+  for (size_t i = 0; i < bytes; i += image_chunk * sizeof(weight))
+  { size_t n = min(image_chunk * sizeof(weight), bytes - i);
+    char* p;
+    if (buf_read(model_file, p, n) < n)
+      THROW("Model content is corrupted, its quantized weights end early");
+    for (size_t j = 0; j < n; j += image_alignment)
+    { size_t page = min(image_alignment, n - j);
+      if (memcmp(p + j, zeros, page) != 0)
+        memcpy(data + i + j, p + j, page);
+    }
+  }
+}
+
+template<class Q>
+void write_quantized(vw& all, io_buf& model_file, quantized_parameters<Q>& q)
+{ uint64_t length = (q.mask() + 1) >> q.stride_shift(); // stored without the stride
+  uint32_t kind = sizeof(Q) == 1 ? quantize_int8 : quantize_fp16;
+  uint32_t block = 1 << quantize_block_shift;
+  write_marker(all, model_file, quantized_marker);
+  bin_write_fixed(model_file, (const char*)&length, sizeof(length));
+  bin_write_fixed(model_file, (const char*)&kind, sizeof(kind));
+  bin_write_fixed(model_file, (const char*)&block, sizeof(block));
+  if (q.scales() != nullptr)
+    write_array(model_file, (const char*)q.scales(), q.blocks(length) * sizeof(float));
+  write_array(model_file, (const char*)q.values(), length * sizeof(Q));
+}
+
+template<class T>
+void save_quantized(vw& all, io_buf& model_file, T& weights)
+{ uint64_t length = (uint64_t)1 << all.num_bits;
+  if (all.weights.quantized == quantize_fp16)
+    write_quantized(all, model_file, all.weights.half_weights);
+  else if (all.weights.quantized == quantize_int8)
+    write_quantized(all, model_file, all.weights.int8_weights);
+  else if (all.quantize_model == quantize_fp16)
+  { quantized_parameters<uint16_t> q;
+    q.allocate(length, 0);
+    quantize(weights, q);
+    write_quantized(all, model_file, q);
+  }
+  else
+  { quantized_parameters<int8_t> q;
+    q.allocate(length, 0);
+    quantize(weights, q);
+    write_quantized(all, model_file, q);
+  }
+}
+
+template<class Q>
+void read_quantized(vw& all, io_buf& model_file, quantized_parameters<Q>& q, uint64_t length)
+{ q.allocate(length, all.weights.stride_shift());
+  if (q.scales() != nullptr)
+    read_array(model_file, (char*)q.scales(), q.blocks(length) * sizeof(float));
+  read_array(model_file, (char*)q.values(), length * sizeof(Q));
+}
+
+// only gd's own predictions dequantize: learning, audit and reductions reading weights need them all
+void load_quantized(vw& all, io_buf& model_file, gd* g)
+{ if (all.training)
+    THROW("a quantized model only predicts: load it with -t");
+  if (g == nullptr || all.audit || all.hash_inv || all.vm.count("lrq") || all.vm.count("lrqfa")
+      || all.vm.count("stage_poly") || all.vm.count("audit_regressor"))
+    THROW("a quantized model is only read by gd's predictions, without audit, lrq, lrqfa or stage_poly");
+
+  uint64_t length = (uint64_t)1 << all.num_bits;
+  uint64_t stored = 0;
+  uint32_t kind = quantize_none;
+  uint32_t block = 0;
+  if (bin_read_fixed(model_file, (char*)&stored, sizeof(stored), "") < sizeof(stored) || stored != length
+      || bin_read_fixed(model_file, (char*)&kind, sizeof(kind), "") < sizeof(kind)
+      || bin_read_fixed(model_file, (char*)&block, sizeof(block), "") < sizeof(block)
+      || (kind != quantize_fp16 && kind != quantize_int8) || block != (uint32_t)1 << quantize_block_shift)
+    THROW("Model content is corrupted, its quantized weights are not " << length << " fp16 or int8 weights");
+
+  if (kind == quantize_fp16)
+    read_quantized(all, model_file, all.weights.half_weights, length);
+  else
+    read_quantized(all, model_file, all.weights.int8_weights, length);
+  all.weights.quantized = (quantize_kind)kind;
+  if (!all.weights.sparse)
+    all.weights.dense_weights.free_values();
+  if (!all.quiet)
+    all.trace_message << "weight array: " << (kind == quantize_fp16 ? "fp16" : "int8") << " quantized, for prediction only" << endl;
+}
+
+template<class T>
+void save_load_regressor(vw& all, io_buf& model_file, bool read, bool text, T& weights, gd* g)
 {
 	size_t brw = 1;
 
@@ -638,19 +1252,47 @@ void save_load_regressor(vw& all, io_buf& model_file, bool read, bool text, T& w
 		brw = bin_read_fixed(model_file, (char*)&i, sizeof(i), "");
 	      if (brw > 0)
 		{
+		  if (is_marker(all, i, image_marker))
+		    { read_image(all, model_file, weights);
+		      break;
+		    }
+		  if (is_marker(all, i, chunks_marker))
+		    { MODEL_CHUNKS::load(all, model_file, weights);
+		      break;
+		    }
+		  if (is_marker(all, i, quantized_marker))
+		    { load_quantized(all, model_file, g);
+		      break;
+		    }
 		  if (i >= length)
 		    THROW("Model content is corrupted, weight vector index " << i << " must be less than total vector length " << length);
 		  weight* v = &weights.strided_index(i);
 		  brw += bin_read_fixed(model_file, (char*)&(*v), sizeof(*v), "");
 		}
 	    } while (brw >0);
+	else if (all.weights.quantized != quantize_none)
+	  { if (text)
+	      THROW("a quantized model has no readable form: write it from the model it was quantized from");
+	    if (all.quantize_model != quantize_none && all.quantize_model != all.weights.quantized)
+	      THROW("this model was quantized to the other kind already: quantize the model it came from");
+	    save_quantized(all, model_file, weights);
+	  }
+	else if (all.quantize_model != quantize_none && !text)
+	  save_quantized(all, model_file, weights);
+	else if (all.dense_model && !text && write_image(all, model_file, weights))
+	  return;
+	else if (all.compress_model && !text)
+	  { write_marker(all, model_file, chunks_marker);
+	    MODEL_CHUNKS::save(all, model_file, weights);
+	  }
 	else // write
+	  { stringstream msg; // only filled, and emptied by each write, for text
 	  for (typename T::iterator v = weights.begin(); v != weights.end(); ++v)
 	    if (*v != 0.)
 	      {
 		i = v.index() >> weights.stride_shift();
-		stringstream msg;
-		msg << i;
+		if (text)
+		  msg << i;
 
 		if (all.num_bits < 31)
 		  {
@@ -660,18 +1302,20 @@ void save_load_regressor(vw& all, io_buf& model_file, bool read, bool text, T& w
 		else
 		  brw = bin_text_write_fixed(model_file, (char *)&i, sizeof(i), msg, text);
 
-		msg << ":" << *v << "\n";
+		if (text)
+		  msg << ":" << *v << "\n";
 		brw += bin_text_write_fixed(model_file, (char *)&(*v), sizeof(*v), msg, text);
 	      }
+	  }
 }
 
 
-void save_load_regressor(vw& all, io_buf& model_file, bool read, bool text)
+void save_load_regressor(vw& all, io_buf& model_file, bool read, bool text, gd* g)
 {
 	if (all.weights.sparse)
-		save_load_regressor(all, model_file, read, text, all.weights.sparse_weights);
+		save_load_regressor(all, model_file, read, text, all.weights.sparse_weights, g);
 	else
-		save_load_regressor(all, model_file, read, text, all.weights.dense_weights);
+		save_load_regressor(all, model_file, read, text, all.weights.dense_weights, g);
 }
 
 template<class T>
@@ -894,7 +1538,7 @@ void save_load(gd& g, io_buf& model_file, bool read, bool text)
       save_load_online_state(all, model_file, read, text, &g);
     }
     else
-      save_load_regressor(all, model_file, read, text);
+      save_load_regressor(all, model_file, read, text, &g);
   }
 }
 
@@ -961,7 +1605,8 @@ base_learner* setup(vw& all)
   ("adaptive", "use adaptive, individual learning rates.")
   ("invariant", "use safe/importance aware updates.")
   ("normalized", "use per feature normalized updates")
-  ("sparse_l2", po::value<float>()->default_value(0.f), "use per feature normalized updates");
+  ("sparse_l2", po::value<float>()->default_value(0.f), "use per feature normalized updates")
+  ("simd", "run long namespaces through AVX2/AVX-512 kernels when the CPU has them; sums are reassociated, so results differ in the last bits");
   add_options(all);
   po::variables_map& vm = all.vm;
   gd& g = calloc_or_throw<gd>();
@@ -1023,6 +1668,15 @@ base_learner* setup(vw& all)
     all.trace_message << "Warning: the learning rate for the last pass is multiplied by: " << pow((double)all.eta_decay_rate, (double)all.numpasses)
          << " adjust --decay_learning_rate larger to avoid this." << endl;
 
+  if (all.allreduce_overlap && !all.holdout_set_off)
+    all.trace_message << "Warning: --allreduce_overlap averages each pass at once with a holdout set, whose loss and best"
+         << " model need the average; add --holdout_off to overlap." << endl;
+  else if (all.allreduce_overlap && all.save_per_pass)
+    THROW("--allreduce_overlap averages a pass after it is saved, so --save_per_pass would write each node's own weights");
+  if (all.allreduce_recover && !all.holdout_set_off)
+    all.trace_message << "Warning: --allreduce_recover redoes only the averages of the weights; a node lost while"
+         << " the holdout loss is summed stops the run.  Add --holdout_off." << endl;
+
 
 
   if (all.reg_mode % 2)
@@ -1046,6 +1700,9 @@ base_learner* setup(vw& all)
     stride = set_learn<false>(all, feature_mask_off, g);
 
   all.weights.stride_shift((uint32_t)ceil_log_2(stride-1));
+#ifdef GD_SIMD
+  g.kernels = vm.count("simd") && gd_simd != simd_none && !all.weights.sparse;
+#endif
 
   learner<gd>& ret = init_learner(&g, g.learn, ((uint64_t)1 << all.weights.stride_shift()));
   ret.set_predict(g.predict);
@@ -1054,6 +1711,13 @@ base_learner* setup(vw& all)
   ret.set_update(g.update);
   ret.set_save_load(save_load);
   ret.set_end_pass(end_pass);
+  if (!all.audit && !all.hash_inv) // audit output goes between an example's prediction and its result
+  { ret.set_predict_batch(all.reg_mode % 2 ? predict_batch<true> : predict_batch<false>);
+    ret.set_learn_batch(learn_batch);
+  }
+  // each update only touches the weights of its own features and the shared normalization sums
+  // merely race, but sparse weights insert on lookup and regularization rescales every weight
+  ret.concurrent = !all.weights.sparse && all.reg_mode == 0 && !all.audit && !all.hash_inv;
   return make_base(ret);
 }
 
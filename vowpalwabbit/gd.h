@@ -21,7 +21,7 @@ struct gd;
 
 float finalize_prediction(shared_data* sd, float ret);
 void print_audit_features(vw&, example& ec);
-void save_load_regressor(vw& all, io_buf& model_file, bool read, bool text);
+void save_load_regressor(vw& all, io_buf& model_file, bool read, bool text, GD::gd *g = nullptr);
 void save_load_online_state(vw& all, io_buf& model_file, bool read, bool text, GD::gd *g = nullptr);
 
  template <class T>
@@ -139,6 +139,17 @@ inline float inline_predict(vw& all, example& ec)
   return temp;
 }
 
+// inline_predict on the dequantizing weights of a --quantize_model model
+template<class Q>
+inline float inline_predict(vw& all, example& ec, const quantized_parameters<Q>& weights)
+{ float temp = ec.l.simple.initial;
+  for (example::iterator i = ec.begin(); i != ec.end(); ++i)
+    if (!all.ignore_some_linear || !all.ignore_linear[i.index()])
+      temp += weights.dot((*i).values.begin(), (*i).indicies.begin(), (*i).size(), ec.ft_offset);
+  INTERACTIONS::generate_interactions<float, const float&, vec_add, false, INTERACTIONS::dummy_func<float>, const quantized_parameters<Q> >(all, ec, temp, weights);
+  return temp;
+}
+
 inline float sign(float w) { if (w < 0.) return -1.; else  return 1.; }
 
 inline float trunc_weight(const float w, const float gravity)
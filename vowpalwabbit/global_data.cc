@@ -13,6 +13,7 @@ license as described in the file LICENSE.
 
 #include "global_data.h"
 #include "gd.h"
+#include "allreduce.h"
 #include "vw_exception.h"
 #include <boost/foreach.hpp>
 
@@ -459,17 +460,28 @@ vw::vw()
   daemon = false;
   num_children = 10;
   save_resume = false;
+  dense_model = false;
+  compress_model = false;
+  quantize_model = quantize_none;
   preserve_performance_counters = false;
 
   random_positive_weights = false;
 
   weights.sparse = false;
+  weights.quantized = quantize_none;
+  weight_pages.huge = huge_none;
+  weight_pages.numa = numa_none;
+  weight_pages.node = 0;
 
   set_minmax = set_mm;
 
   power_t = 0.5;
   eta = 0.5; //default learning rate for normalized adaptive updates, this is switched to 10 by default for the other updates (see parse_args.cc)
   numpasses = 1;
+  learner_threads = 1;
+  predict_batch = 16;
+  weight_prefetch = 0;
+  sparse_reserve = 0;
 
   final_prediction_sink.begin() = final_prediction_sink.end() = final_prediction_sink.end_array = nullptr;
   raw_prediction = -1;
@@ -501,6 +513,12 @@ vw::vw()
   initial_constant = 0.0;
 
   all_reduce = nullptr;
+  allreduce_sparse = false;
+  weights_wire = wire_raw;
+  gradients_wire = wire_raw;
+  allreduce_overlap = false;
+  overlapped = nullptr;
+  allreduce_recover = false;
 
   for (size_t i = 0; i < 256; i++)
   { ngram[i] = 0;
@@ -511,6 +529,9 @@ vw::vw()
   }
 
   interactions = v_init<v_string>();
+  interaction_plan.prefixes = v_init<INTERACTIONS::interaction_prefix>();
+  interaction_plan.prefix = v_init<size_t>();
+  interaction_plan.generic_length = 0;
 
   //by default use invariant normalized adaptive updates
   adaptive = true;
@@ -20,6 +20,8 @@ namespace po = boost::program_options;
 #include "parse_primitives.h"
 #include "loss_functions.h"
 #include "comp_io.h"
+#include "mmap_io.h"
+#include "prefetch_io.h"
 #include "example.h"
 #include "config.h"
 #include "learner.h"
@@ -408,6 +410,27 @@ enum AllReduceType
 };
 
 class AllReduce;
+enum wire_format : unsigned char;
+struct overlapped_average;
+
+namespace INTERACTIONS
+{
+// The namespaces of an interaction of length 2 or 3 but the last.  Every interaction with the same
+// prefix shares, per example, the hashes and values of the prefix's features or feature pairs.
+struct interaction_prefix
+{ size_t length; // 1 or 2
+  namespace_index ns[2];
+};
+
+const size_t no_prefix = (size_t)-1;
+
+// all.interactions as generate_interactions() runs them, built by compile_plan()
+struct interaction_plan
+{ v_array<interaction_prefix> prefixes;
+  v_array<size_t> prefix; // for each interaction its index in prefixes, or no_prefix if it shares none
+  size_t generic_length; // longest interaction without a prefix
+};
+}
 
 // avoid name clash
 namespace label_type
@@ -456,6 +479,13 @@ struct vw
 #endif
   AllReduceType all_reduce_type;
   AllReduce* all_reduce;
+  bool allreduce_sparse; // reduce only the blocks of weights some node changed
+  std::vector<uint64_t> block_fingerprints; // for allreduce_sparse: of each block as the nodes last agreed on it
+  wire_format weights_wire; // how averaged weights travel between nodes
+  wire_format gradients_wire; // how summed gradients travel between nodes
+  bool allreduce_overlap; // average the weights of a pass while the next pass learns
+  overlapped_average* overlapped; // for allreduce_overlap: the copies of the weights averaged, or nullptr
+  bool allreduce_recover; // redo an average a lost node broke on a new tree
 
   LEARNER::base_learner* l;//the top level learner
   LEARNER::base_learner* scorer;//a scoring function
@@ -483,6 +513,9 @@ struct vw
   bool hessian_on;
 
   bool save_resume;
+  bool dense_model; // save the regressor as one array -i can map
+  bool compress_model; // save the regressor in deflated chunks
+  quantize_kind quantize_model; // save only the weights, as halves or scaled bytes, for -t
   bool preserve_performance_counters;
   std::string id;
 
@@ -515,9 +548,14 @@ struct vw
   size_t pass_length;
   size_t numpasses;
   size_t passes_complete;
+  size_t learner_threads; // threads running learn concurrently on the shared weights
+  size_t predict_batch; // most test examples scored per call down the learner stack
+  size_t weight_prefetch; // how many features ahead interactions prefetch their weights, 0 for not at all
+  size_t sparse_reserve; // features the sparse_weights table has room for from the start
   uint64_t parse_mask; // 1 << num_bits -1
   bool permutations; // if true - permutations of features generated instead of simple combinations. false by default
   v_array<v_string> interactions; // interactions of namespaces to cross.
+  INTERACTIONS::interaction_plan interaction_plan; // interactions grouped by shared prefixes
   std::vector<std::string> pairs; // pairs of features to cross.
   std::vector<std::string> triples; // triples of features to cross.
   bool ignore_some;
@@ -594,6 +632,7 @@ struct vw
   std::string final_regressor_name;
 
   parameters weights;
+  page_options weight_pages; // how a dense weight array is mapped
   
   size_t max_examples; // for TLC
 
@@ -0,0 +1,58 @@
+/*
+Copyright (c) by respective owners including Yahoo!, Microsoft, and
+individual contributors. All rights reserved.  Released under a BSD
+license as described in the file LICENSE.
+ */
+// Floats in 16 bits: IEEE halves (fp16) for --quantize_model and the allreduce wire, and the top
+// half of a float (bf16), which keeps its range, for the allreduce wire.
+#pragma once
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+
+// rounds to nearest even, saturating at the largest half, 65504; a NaN becomes 0.  All cases are
+// computed and the result selected, so that loops of it vectorize.
+inline uint16_t float_to_half(float f)
+{ uint32_t x;
+  memcpy(&x, &f, sizeof(x));
+  uint16_t sign = (uint16_t)((x >> 16) & 0x8000);
+  x &= 0x7fffffff;
+  float a;
+  memcpy(&a, &x, sizeof(a));
+  // below 2^-14 a half is a multiple of 2^-24: adding 2^23 rounds it into the low bits
+  float small = a * 16777216.f + 8388608.f;
+  uint32_t low;
+  memcpy(&low, &small, sizeof(low));
+  uint32_t h = x < 0x38800000 ? low & 0x7ff : (x + 0xc8000fff + ((x >> 13) & 1)) >> 13; // exponent bias 127 to 15, and the rounding
+  h = x >= 0x477ff000 ? 0x7bff : h;
+  return x > 0x7f800000 ? 0 : sign | (uint16_t)h;
+}
+
+// both cases are computed and one picked with a mask, not a branch, so that loops of it vectorize
+inline float half_to_float(uint16_t h)
+{ uint32_t rest = h & 0x7fff;
+  uint32_t normal = (rest << 13) + 0x38000000; // exponent bias 15 to 127
+  float small = (float)(int32_t)rest * (1.f / 16777216.f); // below 2^-14 a half is a multiple of 2^-24
+  uint32_t x;
+  memcpy(&x, &small, sizeof(x));
+  uint32_t subnormal = 0u - (uint32_t)(rest < 0x0400);
+  x = (x & subnormal) | (normal & ~subnormal) | (uint32_t)(h & 0x8000) << 16;
+  float f;
+  memcpy(&f, &x, sizeof(f));
+  return f;
+}
+
+// rounds to nearest even; a NaN becomes 0
+inline uint16_t float_to_bf16(float f)
+{ uint32_t x;
+  memcpy(&x, &f, sizeof(x));
+  uint16_t h = (uint16_t)((x + 0x7fff + ((x >> 16) & 1)) >> 16);
+  return (x & 0x7fffffff) > 0x7f800000 ? 0 : h;
+}
+
+inline float bf16_to_float(uint16_t h)
+{ uint32_t x = (uint32_t)h << 16;
+  float f;
+  memcpy(&f, &x, sizeof(f));
+  return f;
+}
@@ -251,6 +251,54 @@ void sort_and_filter_duplicate_interactions(v_array<v_string>& vec, bool filter_
 
 
 
+// groups interactions of length 2 and 3 by the namespaces they start with, keeping their order.
+// Only prefixes that two or more interactions start with are kept: computing the features of one
+// costs as much as the loops it saves, and a triple's takes room for every pair of its namespaces.
+
+void compile_plan(vw& all)
+{ interaction_plan& plan = all.interaction_plan;
+  plan.prefixes.erase();
+  plan.prefix.erase();
+  plan.generic_length = 0;
+
+  std::vector<size_t> uses; // of each prefix in plan.prefixes
+  for (v_string& ns : all.interactions)
+  { const size_t len = ns.size();
+#ifndef GEN_INTER_LOOP
+    if (len == 2 || len == 3)
+    { interaction_prefix p = { len - 1, { ns[0], len == 3 ? ns[1] : (namespace_index)0 } };
+      size_t k = 0;
+      while (k < plan.prefixes.size() &&
+             (plan.prefixes[k].length != p.length || plan.prefixes[k].ns[0] != p.ns[0] || plan.prefixes[k].ns[1] != p.ns[1]))
+        ++k;
+      if (k == plan.prefixes.size())
+      { plan.prefixes.push_back(p);
+        uses.push_back(0);
+      }
+      uses[k]++;
+      plan.prefix.push_back(k);
+      continue;
+    }
+#endif
+    plan.prefix.push_back(no_prefix);
+    plan.generic_length = std::max(plan.generic_length, len);
+  }
+
+  // drop the prefixes of a single interaction, renumbering the others
+  std::vector<size_t> kept(uses.size(), no_prefix);
+  size_t shared = 0;
+  for (size_t k = 0; k < uses.size(); ++k)
+    if (uses[k] > 1)
+    { plan.prefixes[shared] = plan.prefixes[k];
+      kept[k] = shared++;
+    }
+  plan.prefixes.end() = plan.prefixes.begin() + shared;
+  for (size_t& k : plan.prefix)
+    if (k != no_prefix)
+      k = kept[k];
+}
+
+
 /*
  *  Estimation of generated features properties
  */
@@ -2,6 +2,9 @@
 
 #include "global_data.h"
 #include "constant.h"
+#if defined(_MSC_VER)
+#include <xmmintrin.h>
+#endif
 
 /*
  *  Interactions preprocessing and feature combinations generation
@@ -28,6 +31,10 @@ v_array<v_string> expand_interactions(const std::vector<std::string> &vec, const
 // remove duplicate interactions and sort namespaces in them (if required)
 void sort_and_filter_duplicate_interactions(v_array<v_string> &vec, bool filter_duplicates, size_t &removed_cnt, size_t &sorted_cnt);
 
+// (re)builds all.interaction_plan from all.interactions; call it after changing all.interactions
+// once VW::initialize() has returned, while no example is being learned or predicted
+void compile_plan(vw& all);
+
 
 /*
  *  Feature combinations generation
@@ -71,6 +78,54 @@ inline void call_T(R& dat, W& /*weights*/, const float ft_value, const uint64_t
     T(dat, ft_value, ft_idx);
 }
 
+template <class W>
+inline void prefetch_weight(const W& /*weights*/, const uint64_t /*ft_idx*/) {}
+
+inline void prefetch_weight(const dense_parameters& weights, const uint64_t ft_idx)
+{
+#if defined(__GNUC__)
+  __builtin_prefetch(&weights[ft_idx]);
+#elif defined(_MSC_VER)
+  _mm_prefetch((const char*)&weights[ft_idx], _MM_HINT_T0);
+#endif
+}
+
+inline void prefetch_weight(const sparse_parameters& weights, const uint64_t ft_idx)
+{
+#if defined(__GNUC__)
+  __builtin_prefetch(weights.home_slot(ft_idx));
+#elif defined(_MSC_VER)
+  _mm_prefetch(weights.home_slot(ft_idx), _MM_HINT_T0);
+#endif
+}
+
+template <class Q>
+inline void prefetch_weight(const quantized_parameters<Q>& weights, const uint64_t ft_idx)
+{
+#if defined(__GNUC__)
+  __builtin_prefetch(weights.address(ft_idx));
+#elif defined(_MSC_VER)
+  _mm_prefetch((const char*)weights.address(ft_idx), _MM_HINT_T0);
+#endif
+}
+
+// the same 3 cases as call_T(): only the first two touch the weight
+
+template <class R, void (*T)(R&, const float, float&), class W>
+inline void prefetch_T(W& weights, const uint64_t ft_idx)
+{
+  prefetch_weight(weights, ft_idx);
+}
+
+template <class R, void (*T)(R&, const float, const float&), class W>
+inline void prefetch_T(const W& weights, const uint64_t ft_idx)
+{
+  prefetch_weight(weights, ft_idx);
+}
+
+template <class R, void (*T)(R&, float, uint64_t), class W>
+inline void prefetch_T(W& /*weights*/, const uint64_t /*ft_idx*/) {}
+
 // state data used in non-recursive feature generation algorithm
 // contains N feature_gen_data records (where N is length of interaction)
 struct feature_gen_data
@@ -96,7 +151,7 @@ inline float INTERACTION_VALUE(float value1, float value2) { return value1*value
 // #define GEN_INTER_LOOP
 
 template <class R, class S, void(*T)(R&, float, S), bool audit, void(*audit_func)(R&, const audit_strings*), class W>
-inline void inner_kernel(R& dat, features::iterator_all& begin, features::iterator_all& end, const uint64_t offset, W& weights, feature_value ft_value, feature_index halfhash)
+inline void inner_kernel(R& dat, features::iterator_all& begin, features::iterator_all& end, const uint64_t offset, W& weights, feature_value ft_value, feature_index halfhash, const size_t prefetch_distance)
 {
   if (audit)
   {
@@ -107,12 +162,113 @@ inline void inner_kernel(R& dat, features::iterator_all& begin, features::iterat
       audit_func(dat, nullptr);
     }
   }
-  else
+  else if (prefetch_distance == 0)
   { for (; begin != end; ++begin)
       call_T<R, T>(dat, weights, INTERACTION_VALUE(ft_value, begin.value()), (begin.index() ^ halfhash) + offset);
   }
+  else
+  { // the weights of an interaction are spread over the whole weight vector, so each update may
+    // wait on memory once the weights outgrow the caches.  Asking for the weight prefetch_distance
+    // features ahead keeps that many loads in flight (--weight_prefetch).
+    features::iterator_all ahead = begin;
+    for (size_t i = 0; i < prefetch_distance && ahead != end; ++i, ++ahead)
+      prefetch_T<R, T>(weights, (ahead.index() ^ halfhash) + offset);
+
+    for (; begin != end; ++begin)
+    { if (ahead != end)
+      { prefetch_T<R, T>(weights, (ahead.index() ^ halfhash) + offset);
+        ++ahead;
+      }
+      call_T<R, T>(dat, weights, INTERACTION_VALUE(ft_value, begin.value()), (begin.index() ^ halfhash) + offset);
+    }
+  }
+}
+
+
+// features of a prefix of an interaction, or pairs of them for prefixes of length 2, with the hash
+// and value of their product ready for the last namespace
+struct prefix_feature
+{ uint64_t halfhash;
+  float x;
+  uint32_t i; // feature in the first namespace
+  uint32_t j; // feature in the second namespace
+};
+
+// where an example's features of a prefix are kept; end is nullptr until they are computed
+struct prefix_features
+{ prefix_feature* begin;
+  prefix_feature* end;
+};
+
+// bytes of prefix features generate_interactions() keeps on its stack: a prefix whose features do not
+// fit in what is left, such as a pair of wide namespaces, is not cached, its interactions loop over
+// the namespaces themselves
+const size_t prefix_cache_bytes = 48 * 1024;
+
+inline prefix_feature* compute_prefix_features(const interaction_prefix& p, features* features_data, bool permutations, prefix_feature* out)
+{ features& first = features_data[p.ns[0]];
+  if (p.length == 1)
+  { for (size_t i = 0; i < first.indicies.size(); ++i)
+    { out->halfhash = FNV_prime * (uint64_t)first.indicies[i];
+      out->x = first.values[i];
+      out->i = (uint32_t)i;
+      out->j = 0;
+      ++out;
+    }
+    return out;
+  }
+
+  features& second = features_data[p.ns[1]];
+  const bool same_namespace = ( !permutations && ( p.ns[0] == p.ns[1] ) );
+  for (size_t i = 0; i < first.indicies.size(); ++i)
+  { const uint64_t halfhash1 = FNV_prime * (uint64_t)first.indicies[i];
+    const float first_ft_value = first.values[i];
+    size_t j = 0;
+    if (same_namespace) // next index differs for permutations and simple combinations
+      j = (PROCESS_SELF_INTERACTIONS(first_ft_value)) ? i : i+1;
+
+    for (; j < second.indicies.size(); ++j)
+    { //f3 x k*(f2 x k*f1)
+      out->halfhash = FNV_prime * (halfhash1 ^ (uint64_t)second.indicies[j]);
+      out->x = INTERACTION_VALUE(first_ft_value, second.values[j]);
+      out->i = (uint32_t)i;
+      out->j = (uint32_t)j;
+      ++out;
+    }
+  }
+  return out;
 }
 
+// the interaction's shared prefix in the plan, or no_prefix if it has none or the interaction was
+// changed in place since the plan was compiled
+inline size_t matching_prefix(interaction_plan& plan, size_t prefix, v_string& ns)
+{ if (prefix == no_prefix)
+    return no_prefix;
+  interaction_prefix& p = plan.prefixes[prefix];
+  if (p.length + 1 != ns.size() || p.ns[0] != ns[0] || (p.length == 2 && p.ns[1] != ns[1]))
+    return no_prefix;
+  return prefix;
+}
+
+// the features of a shared prefix, computed into the cache the first time an interaction needs
+// them; nullptr if there is no prefix or its features do not fit in what is left of the cache
+inline prefix_features* cached_prefix(interaction_plan& plan, size_t prefix, prefix_features* prefix_data, features* features_data,
+                                      bool permutations, prefix_feature*& next, prefix_feature* cache_end)
+{ if (prefix == no_prefix)
+    return nullptr;
+  prefix_features& pf = prefix_data[prefix];
+  if (pf.end == nullptr)
+  { interaction_prefix& p = plan.prefixes[prefix];
+    size_t cnt = features_data[p.ns[0]].size();
+    if (p.length == 2)
+      cnt *= features_data[p.ns[1]].size();
+    if (cnt > (size_t)(cache_end - next))
+      return nullptr;
+    pf.begin = next;
+    pf.end = next = compute_prefix_features(p, features_data, permutations, pf.begin);
+  }
+  return &pf;
+}
 
 // this templated function generates new features for given example and set of interactions
 // and passes each of them to given function T()
@@ -120,14 +276,31 @@ inline void inner_kernel(R& dat, features::iterator_all& begin, features::iterat
  template <class R, class S, void(*T)(R&, float, S), bool audit, void(*audit_func)(R&, const audit_strings*), class W> // nullptr func can't be used as template param in old compilers
  inline void generate_interactions(vw& all, example& ec, R& dat, W& weights) // default value removed to eliminate ambiguity in old complers
  {
+   if (all.interactions.empty())
+     return;
    features* features_data = ec.feature_space;
 
   // often used values
   const uint64_t offset = ec.ft_offset;
 //    const uint64_t stride_shift = all.stride_shift; // it seems we don't need stride shift in FTRL-like hash
 
-  // statedata for generic non-recursive iteration
-  v_array<feature_gen_data > state_data = v_init<feature_gen_data >();
+  // read only: several threads may generate features of one vw at once
+  interaction_plan& plan = all.interaction_plan;
+  if (plan.prefix.size() != all.interactions.size())
+    THROW("all.interactions was changed without calling INTERACTIONS::compile_plan()");
+
+  // the example's scratch memory holds the state of the generic loop, then where each prefix's
+  // features are; the features themselves live only as long as this call, in as much of the cache
+  // as they fit
+  unsigned char* scratch = scratch_array<unsigned char>(ec, plan.generic_length * sizeof(feature_gen_data)
+                           + plan.prefixes.size() * sizeof(prefix_features));
+  feature_gen_data* const state_begin = (feature_gen_data*)scratch;
+  prefix_features* const prefix_data = (prefix_features*)(state_begin + plan.generic_length);
+  for (size_t k = 0; k < plan.prefixes.size(); ++k)
+    prefix_data[k].end = nullptr;
+  prefix_feature prefix_cache[prefix_cache_bytes / sizeof(prefix_feature)];
+  prefix_feature* next_prefix_feature = prefix_cache;
+  prefix_feature* const prefix_cache_end = prefix_cache + prefix_cache_bytes / sizeof(prefix_feature);
 
   feature_gen_data empty_ns_data;  // micro-optimization. don't want to call its constructor each time in loop.
   empty_ns_data.loop_idx = 0;
@@ -136,14 +309,19 @@ inline void inner_kernel(R& dat, features::iterator_all& begin, features::iterat
   empty_ns_data.self_interaction = false;
 
   // loop throw the set of possible interactions
+  const size_t* prefix_of = plan.prefix.begin();
   for (v_string& ns : all.interactions)
   { // current list of namespaces to interact.
+    const size_t prefix = matching_prefix(plan, *prefix_of++, ns);
 
 #ifndef GEN_INTER_LOOP
 
     // unless GEN_INTER_LOOP is defined we use nested 'for' loops for interactions length 2 (pairs) and 3 (triples)
     // and generic non-recursive algorythm for all other cases.
     // nested 'for' loops approach is faster, but can't be used for interation of any length.
+    // When other interactions share the prefix, the outer loops go over its features, computed the
+    // first time one of them has something to generate, in the order the loops would, as long as
+    // they fit in the cache.
 
     const size_t len = ns.size();
 
@@ -156,21 +334,36 @@ inline void inner_kernel(R& dat, features::iterator_all& begin, features::iterat
             if (second.nonempty())
               {
                 const bool same_namespace = ( !all.permutations && ( ns[0] == ns[1] ) );
+                features::features_value_index_audit_range range = second.values_indices_audit();
+                prefix_features* pf = cached_prefix(plan, prefix, prefix_data, features_data, all.permutations, next_prefix_feature, prefix_cache_end);
+                if (pf != nullptr)
+                { for (prefix_feature* f = pf->begin; f != pf->end; ++f)
+                  { if (audit) audit_func(dat, first.space_names[f->i].get());
+                    // next index differs for permutations and simple combinations
+                    features::iterator_all begin = range.begin();
+                    if (same_namespace)
+                      begin += (PROCESS_SELF_INTERACTIONS(f->x)) ? f->i : f->i + 1;
 
-                for(size_t i = 0; i < first.indicies.size(); ++i)
+                    features::iterator_all end = range.end();
+                    inner_kernel<R, S, T, audit, audit_func>(dat, begin, end, offset, weights, f->x, f->halfhash, all.weight_prefetch);
+
+                    if (audit) audit_func(dat, nullptr);
+                  } // end for(fst)
+                }
+                else
+                  for(size_t i = 0; i < first.indicies.size(); ++i)
                   { feature_index halfhash = FNV_prime * (uint64_t)first.indicies[i];
                     if (audit) audit_func(dat, first.space_names[i].get());
                     // next index differs for permutations and simple combinations
                     feature_value ft_value = first.values[i];
-                    features::features_value_index_audit_range range = second.values_indices_audit();
                     features::iterator_all begin = range.begin();
                     if (same_namespace)
                       begin += (PROCESS_SELF_INTERACTIONS(ft_value)) ? i : i + 1;
 
                     features::iterator_all end = range.end();
-                    inner_kernel<R, S, T, audit, audit_func>(dat, begin, end, offset, weights, ft_value, halfhash);
+                    inner_kernel<R, S, T, audit, audit_func>(dat, begin, end, offset, weights, ft_value, halfhash, all.weight_prefetch);
 
-	            if (audit) audit_func(dat, nullptr);
+                    if (audit) audit_func(dat, nullptr);
                   } // end for(fst)
               } // end if (data[snd] size > 0)
           } // end if (data[fst] size > 0)
@@ -183,34 +376,58 @@ inline void inner_kernel(R& dat, features::iterator_all& begin, features::iterat
         { features& third = features_data[ns[2]];
           if (third.nonempty())
           { // don't compare 1 and 3 as interaction is sorted
-            const bool same_namespace1 = ( !all.permutations && ( ns[0] == ns[1] ) );
             const bool same_namespace2 = ( !all.permutations && ( ns[1] == ns[2] ) );
+            features::features_value_index_audit_range range = third.values_indices_audit();
+            prefix_features* pf = cached_prefix(plan, prefix, prefix_data, features_data, all.permutations, next_prefix_feature, prefix_cache_end);
+            if (pf != nullptr)
+            { uint32_t audit_i = (uint32_t)-1; // feature of the first namespace on the audit stack
+              for (prefix_feature* f = pf->begin; f != pf->end; ++f)
+              { if (audit)
+                { if (f->i != audit_i)
+                  { if (audit_i != (uint32_t)-1) audit_func(dat, nullptr);
+                    audit_func(dat, first.space_names[f->i].get());
+                    audit_i = f->i;
+                  }
+                  audit_func(dat, second.space_names[f->j].get());
+                }
 
-            for(size_t i = 0; i < first.indicies.size(); ++i)
-            { if(audit) audit_func(dat, first.space_names[i].get());
-              const uint64_t halfhash1 = FNV_prime * (uint64_t)first.indicies[i];
-              const float& first_ft_value = first.values[i];
-              size_t j=0;
-              if (same_namespace1) // next index differs for permutations and simple combinations
-                j = (PROCESS_SELF_INTERACTIONS(first_ft_value)) ? i : i+1;
-
-              for (; j < second.indicies.size(); ++j)
-              { //f3 x k*(f2 x k*f1)
-                if(audit) audit_func(dat, second.space_names[j].get());
-                feature_index halfhash = FNV_prime * (halfhash1 ^ (uint64_t)second.indicies[j]);
-                feature_value ft_value = INTERACTION_VALUE(first_ft_value, second.values[j]);
-
-                features::features_value_index_audit_range range = third.values_indices_audit();
                 features::iterator_all begin = range.begin();
                 if (same_namespace2) //next index differs for permutations and simple combinations
-                  begin += (PROCESS_SELF_INTERACTIONS(ft_value)) ? j : j + 1;
+                  begin += (PROCESS_SELF_INTERACTIONS(f->x)) ? f->j : f->j + 1;
 
                 features::iterator_all end = range.end();
-                inner_kernel<R, S, T, audit, audit_func>(dat, begin, end, offset, weights, ft_value, halfhash);
+                inner_kernel<R, S, T, audit, audit_func>(dat, begin, end, offset, weights, f->x, f->halfhash, all.weight_prefetch);
                 if (audit) audit_func(dat, nullptr);
-              } // end for (snd)
-              if(audit) audit_func(dat, nullptr);
-            } // end for (fst)
+              } // end for (fst, snd)
+              if (audit && audit_i != (uint32_t)-1) audit_func(dat, nullptr);
+            }
+            else
+            { const bool same_namespace1 = ( !all.permutations && ( ns[0] == ns[1] ) );
+              for(size_t i = 0; i < first.indicies.size(); ++i)
+              { if(audit) audit_func(dat, first.space_names[i].get());
+                const uint64_t halfhash1 = FNV_prime * (uint64_t)first.indicies[i];
+                const float& first_ft_value = first.values[i];
+                size_t j=0;
+                if (same_namespace1) // next index differs for permutations and simple combinations
+                  j = (PROCESS_SELF_INTERACTIONS(first_ft_value)) ? i : i+1;
+
+                for (; j < second.indicies.size(); ++j)
+                { //f3 x k*(f2 x k*f1)
+                  if(audit) audit_func(dat, second.space_names[j].get());
+                  feature_index halfhash = FNV_prime * (halfhash1 ^ (uint64_t)second.indicies[j]);
+                  feature_value ft_value = INTERACTION_VALUE(first_ft_value, second.values[j]);
+
+                  features::iterator_all begin = range.begin();
+                  if (same_namespace2) //next index differs for permutations and simple combinations
+                    begin += (PROCESS_SELF_INTERACTIONS(ft_value)) ? j : j + 1;
+
+                  features::iterator_all end = range.end();
+                  inner_kernel<R, S, T, audit, audit_func>(dat, begin, end, offset, weights, ft_value, halfhash, all.weight_prefetch);
+                  if (audit) audit_func(dat, nullptr);
+                } // end for (snd)
+                if(audit) audit_func(dat, nullptr);
+              } // end for (fst)
+            }
 
           } // end if (data[thr] size > 0)
         } // end if (data[snd] size > 0)
@@ -222,9 +439,13 @@ inline void inner_kernel(R& dat, features::iterator_all& begin, features::iterat
 #endif
     {
 
+      if (ns.size() > plan.generic_length)
+        THROW("all.interactions was changed without calling INTERACTIONS::compile_plan()");
       bool must_skip_interaction = false;
+      // state data for generic non-recursive iteration, one record per namespace
+      feature_gen_data* const state_end = state_begin + ns.size();
       // preparing state data
-      feature_gen_data* fgd = state_data.begin();
+      feature_gen_data* fgd = state_begin;
       feature_gen_data* fgd2; // for further use
       for (namespace_index n : ns)
       { features& ft = features_data[(int32_t)n];
@@ -235,11 +456,7 @@ inline void inner_kernel(R& dat, features::iterator_all& begin, features::iterat
           break;
         }
 
-        if (fgd == state_data.end())
-        { state_data.push_back(empty_ns_data);
-          fgd = state_data.end()-1; // reassign as memory could be realloced
-        }
-
+        *fgd = empty_ns_data;
         fgd->loop_end = ft_cnt-1; // saving number of features for each namespace
         fgd->ft_arr = &ft;
         ++fgd;
@@ -258,9 +475,9 @@ inline void inner_kernel(R& dat, features::iterator_all& begin, features::iterat
 
         // iterate list backward as margin grows in this order
 
-        for (fgd = state_data.end()-1; fgd > state_data.begin(); --fgd)
+        for (fgd = state_end-1; fgd > state_begin; --fgd)
         { fgd2 = fgd-1;
-          fgd->self_interaction = (fgd->ft_arr == fgd2->ft_arr); //state_data.begin().self_interaction is always false
+          fgd->self_interaction = (fgd->ft_arr == fgd2->ft_arr); //state_begin->self_interaction is always false
           if (fgd->self_interaction)
           { size_t& loop_end = fgd2->loop_end;
 
@@ -282,8 +499,8 @@ inline void inner_kernel(R& dat, features::iterator_all& begin, features::iterat
       } // end of state_data adjustment
 
 
-      fgd = state_data.begin();  // always equal to first ns
-      fgd2 = state_data.end()-1; // always equal to last ns
+      fgd = state_begin;  // always equal to first ns
+      fgd2 = state_end-1; // always equal to last ns
       fgd->loop_idx = 0; // loop_idx contains current feature id for curently processed namespace.
 
       // beware: micro-optimization.
@@ -341,7 +558,7 @@ inline void inner_kernel(R& dat, features::iterator_all& begin, features::iterat
 	  begin += start_i;
 	  features::iterator_all end = range.begin();
 	  end += fgd2->loop_end + 1;
-	  inner_kernel<R, S, T, audit, audit_func, W>(dat, begin, end, offset, weights, ft_value, halfhash);
+	  inner_kernel<R, S, T, audit, audit_func, W>(dat, begin, end, offset, weights, ft_value, halfhash, all.weight_prefetch);
 
           // trying to go back increasing loop_idx of each namespace by the way
 
@@ -360,8 +577,6 @@ inline void inner_kernel(R& dat, features::iterator_all& begin, features::iterat
       } // while do_it
     }
   } // foreach interaction in all.interactions
-
-  state_data.delete_v();
 }
 
 template <class R, class S, void(*T)(R&, float, S), bool audit, void(*audit_func)(R&, const audit_strings*)> // nullptr func can't be used as template param in old compilers
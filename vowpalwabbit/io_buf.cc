@@ -18,12 +18,7 @@ size_t buf_read(io_buf &i, char* &pointer, size_t n)
   }
   else // out of bytes, so refill.
   { if (i.head != i.space.begin()) //There exists room to shift.
-    { // Out of buffer so swap to beginning.
-      size_t left = i.space.end() - i.head;
-      memmove(i.space.begin(), i.head, left);
-      i.head = i.space.begin();
-      i.space.end() = i.space.begin() + left;
-    }
+      i.compact(); // Out of buffer so swap to beginning.
     if (i.fill(i.files[i.current]) > 0) // read more bytes from current file if present
       return buf_read(i, pointer, n);// more bytes are read.
     else if (++i.current < i.files.size())
@@ -62,10 +57,7 @@ size_t readto(io_buf &i, char* &pointer, char terminal)
   }
   else
   { if (i.space.end() == i.space.end_array)
-    { size_t left = i.space.end() - i.head;
-      memmove(i.space.begin(), i.head, left);
-      i.head = i.space.begin();
-      i.space.end() = i.space.begin()+left;
+    { i.compact();
       pointer = i.space.end();
     }
     if (i.current < i.files.size() && i.fill(i.files[i.current]) > 0)// more bytes are read.
@@ -154,7 +154,15 @@ public:
 
   static ssize_t read_file_or_socket(int f, void* buf, size_t nbytes);
 
-  ssize_t fill(int f)
+  // moves the loaded but unread bytes to the front of space, making room for fill
+  virtual void compact()
+  { size_t left = space.end() - head;
+    memmove(space.begin(), head, left);
+    head = space.begin();
+    space.end() = space.begin() + left;
+  }
+
+  virtual ssize_t fill(int f)
   { // if the loaded values have reached the allocated space
     if (space.end_array - space.end() == 0)
     { // reallocate to twice as much space
@@ -196,6 +204,31 @@ public:
 
   virtual bool compressed() { return false; }
 
+  // where in the current file the next byte is read or written, or -1 if the buffer does not read and
+  // write files itself (pipes, sockets, compressed, prefetched or mapped files, memory)
+  virtual int64_t file_offset()
+  { if (current >= files.size())
+      return -1;
+#ifdef _WIN32
+    int64_t at = _lseeki64(files[current], 0, SEEK_CUR);
+#else
+    int64_t at = lseek(files[current], 0, SEEK_CUR);
+#endif
+    return at < 0 ? -1 : at - (space.end() - head);
+  }
+
+  // reads on from offset in the current file, dropping what was loaded; only where file_offset works
+  void seek_file(int64_t offset)
+  {
+#ifdef _WIN32
+    _lseeki64(files[current], offset, SEEK_SET);
+#else
+    lseek(files[current], offset, SEEK_SET);
+#endif
+    space.end() = space.begin();
+    head = space.begin();
+  }
+
   static void close_file_or_socket(int f);
 
   void close_files()
@@ -1,3 +1,6 @@
+#include <thread>
+#include <mutex>
+#include <condition_variable>
 #include "parser.h"
 #include "vw.h"
 #include "parse_regressor.h"
@@ -84,6 +87,118 @@ void generic_driver(vector<vw*> alls)
     (*it)->l->end_examples();
 }
 
+// --learner_threads: every thread takes examples off the ring and learns from them against the
+// shared weights without locking (Hogwild).  Finishing an example updates the shared statistics and
+// writes predictions, so examples are finished one at a time in input order.  End of pass, save and
+// empty examples are barriers: they are handled once everything before them is done, and nothing
+// after them learns until they are, since they change the weights, the pass and the learning rate.
+struct hogwild
+{ vw* all;
+  uint64_t finished; // sequence number of the last example finished
+  uint64_t barrier; // sequence number of the last barrier taken off the ring
+  mutex take; // examples are taken off the ring in order, each seeing the barriers before it
+  mutex lock;
+  condition_variable turn;
+};
+
+void wait_finished(hogwild& h, uint64_t seq)
+{ unique_lock<mutex> l(h.lock);
+  h.turn.wait(l, [&]() { return h.finished >= seq; });
+}
+
+void pass_turn(hogwild& h, uint64_t seq)
+{ { lock_guard<mutex> l(h.lock);
+    h.finished = seq;
+  }
+  h.turn.notify_all();
+}
+
+void hogwild_learner(hogwild& h)
+{ vw& all = *h.all;
+  while (true)
+  { example* ec;
+    uint64_t seq, barrier;
+    { lock_guard<mutex> l(h.take);
+      if ((ec = VW::get_example(all.p)) == nullptr)
+        break;
+      seq = all.p->ring_seq[ec - all.p->examples].load();
+      if (ec->indices.size() <= 1)
+        h.barrier = seq;
+      barrier = h.barrier;
+    }
+    if (all.early_terminate) // drain the parser
+    { wait_finished(h, seq - 1);
+      VW::finish_example(all, ec);
+    }
+    else if (ec->indices.size() > 1)
+    { wait_finished(h, barrier);
+      all.learn(ec);
+      wait_finished(h, seq - 1);
+      all.l->finish_example(all, *ec);
+    }
+    else
+    { wait_finished(h, seq - 1);
+      process_example(all, ec);
+    }
+    pass_turn(h, seq);
+  }
+}
+
+void hogwild_driver(vw& all)
+{ hogwild h;
+  h.all = &all;
+  h.finished = all.p->used_index.load();
+  h.barrier = h.finished;
+
+  vector<thread> threads;
+  for (size_t i = 1; i < all.learner_threads; i++)
+    threads.push_back(thread(hogwild_learner, ref(h)));
+  hogwild_learner(h);
+  for (thread& t : threads)
+    t.join();
+  all.l->end_examples();
+}
+
+// --predict_batch: test examples that are already parsed go down the learner stack in one call and
+// are then finished in input order.  A batch never waits for the parser, and ends at the first
+// example that learns or is not an ordinary one.
+inline bool batches(vw& all, example& ec)
+{ return ec.indices.size() > 1 && (ec.test_only || !all.training); }
+
+void batch_driver(vw& all)
+{ v_array<example*> batch = v_init<example*>();
+  example* ec = VW::get_example(all.p);
+  while (ec != nullptr && all.early_terminate == false)
+  { if (!batches(all, *ec))
+    { process_example(all, ec);
+      ec = VW::get_example(all.p);
+      continue;
+    }
+    batch.erase();
+    do
+    { batch.push_back(ec);
+      ec = batch.size() < all.predict_batch ? VW::try_get_example(all.p) : nullptr;
+    }
+    while (ec != nullptr && batches(all, *ec));
+    all.l->predict_batch(batch.begin(), batch.size());
+    for (example* b : batch)
+      all.l->finish_example(all, *b);
+    if (ec == nullptr)
+      ec = VW::get_example(all.p);
+  }
+  if (all.early_terminate) //drain any extra examples from parser.
+    for (; ec != nullptr; ec = VW::get_example(all.p))
+      VW::finish_example(all, ec);
+  all.l->end_examples();
+  batch.delete_v();
+}
+
 void generic_driver(vw& all)
-{ generic_driver<vw&, process_example>(all, all); }
+{ if (all.learner_threads > 1)
+    hogwild_driver(all);
+  else if (all.predict_batch > 1 && all.l->batches())
+    batch_driver(all);
+  else
+    generic_driver<vw&, process_example>(all, all);
+}
 }
@@ -55,6 +55,8 @@ struct learn_data
   void (*predict_f)(void* data, base_learner& base, example&);
   void (*update_f)(void* data, base_learner& base, example&);
   void (*multipredict_f)(void* data, base_learner& base, example&, size_t count, size_t step, polyprediction*pred, bool finalize_predictions);
+  void (*learn_batch_f)(void* data, base_learner& base, example** ecs, size_t count);
+  void (*predict_batch_f)(void* data, base_learner& base, example** ecs, size_t count);
 };
 
 struct sensitivity_data
@@ -84,6 +86,7 @@ inline float noop_sensitivity(void*, base_learner&, example&) { return 0.; }
 typedef void (*tlearn)(void* d, base_learner& base, example& ec);
 typedef float (*tsensitivity)(void* d, base_learner& base, example& ec);
 typedef void (*tmultipredict)(void* d, base_learner& base, example& ec, size_t, size_t, polyprediction*, bool);
+typedef void (*tbatch)(void* d, base_learner& base, example** ecs, size_t count);
 typedef void (*tsl)(void* d, io_buf& io, bool read, bool text);
 typedef void (*tfunc)(void*d);
 typedef void (*tend_example)(vw& all, void* d, example& ec);
@@ -113,6 +116,7 @@ public:
   prediction_type::prediction_type_t pred_type;
   size_t weights; //this stores the number of "weight vectors" required by the learner.
   size_t increment;
+  bool concurrent; // learn may run on several examples at once, against the same weights
 
   //called once for each example.  Must work under reduction.
   inline void learn(example& ec, size_t i=0)
@@ -147,6 +151,32 @@ public:
   inline void set_learn(void (*u)(T&, base_learner&, example&)) { learn_fd.learn_f = (tlearn)u; }
   inline void set_multipredict(void (*u)(T&, base_learner&, example&, size_t, size_t, polyprediction*, bool)) { learn_fd.multipredict_f = (tmultipredict)u; }
 
+  //called on several examples at once.  Must give the same results as learn/predict on each of
+  //them in turn; a learner that does not provide its own is called one example at a time.
+  inline void learn_batch(example** ecs, size_t count, size_t i=0)
+  { if (learn_fd.learn_batch_f == nullptr)
+    { for (size_t c=0; c<count; c++)
+        learn(*ecs[c], i);
+      return;
+    }
+    for (size_t c=0; c<count; c++) ecs[c]->ft_offset += (uint32_t)(increment*i);
+    learn_fd.learn_batch_f(learn_fd.data, *learn_fd.base, ecs, count);
+    for (size_t c=0; c<count; c++) ecs[c]->ft_offset -= (uint32_t)(increment*i);
+  }
+  inline void predict_batch(example** ecs, size_t count, size_t i=0)
+  { if (learn_fd.predict_batch_f == nullptr)
+    { for (size_t c=0; c<count; c++)
+        predict(*ecs[c], i);
+      return;
+    }
+    for (size_t c=0; c<count; c++) ecs[c]->ft_offset += (uint32_t)(increment*i);
+    learn_fd.predict_batch_f(learn_fd.data, *learn_fd.base, ecs, count);
+    for (size_t c=0; c<count; c++) ecs[c]->ft_offset -= (uint32_t)(increment*i);
+  }
+  inline bool batches() { return learn_fd.predict_batch_f != nullptr; }
+  inline void set_learn_batch(void (*u)(T&, base_learner&, example**, size_t)) { learn_fd.learn_batch_f = (tbatch)u; }
+  inline void set_predict_batch(void (*u)(T&, base_learner&, example**, size_t)) { learn_fd.predict_batch_f = (tbatch)u; }
+
   inline void update(example& ec, size_t i=0)
   { ec.ft_offset += (uint32_t)(increment*i);
     learn_fd.update_f(learn_fd.data, *learn_fd.base, ec);
@@ -245,6 +275,8 @@ learner<T>& init_learner(T* dat, void (*learn)(T&, base_learner&, example&),
   ret.learn_fd.update_f = (tlearn)learn;
   ret.learn_fd.predict_f = (tlearn)learn;
   ret.learn_fd.multipredict_f = nullptr;
+  ret.learn_fd.learn_batch_f = nullptr;
+  ret.learn_fd.predict_batch_f = nullptr;
   ret.sensitivity_fd.sensitivity_f = (tsensitivity)noop_sensitivity;
   ret.finish_example_fd.data = dat;
   ret.finish_example_fd.finish_example_f = return_simple_example;
@@ -274,7 +306,10 @@ learner<T>& init_learner(T* dat, base_learner* base,
   ret.learn_fd.update_f = (tlearn)learn;
   ret.learn_fd.predict_f = (tlearn)predict;
   ret.learn_fd.multipredict_f = nullptr;
+  ret.learn_fd.learn_batch_f = nullptr;
+  ret.learn_fd.predict_batch_f = nullptr;
   ret.learn_fd.base = base;
+  ret.concurrent = false; // a reduction has to say so itself
 
   ret.finisher_fd.data = dat;
   ret.finisher_fd.base = base;
@@ -15,6 +15,7 @@ license as described in the file LICENSE.
 #include "accumulate.h"
 #include "best_constant.h"
 #include "vw_exception.h"
+#include "serve.h"
 #include <fstream>
 
 using namespace std;
@@ -94,6 +95,11 @@ int main(int argc, char *argv[])
     //struct timeb t_start, t_end;
     //ftime(&t_start);
 
+    if (all.vm.count("serve"))
+    { SERVE::serve(all, argc, argv); // finishes every model it served, all included
+      return 0;
+    }
+
     VW::start_parser(all);
     if (alls.size() == 1)
       LEARNER::generic_driver(all);
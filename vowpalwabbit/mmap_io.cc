@@ -0,0 +1,125 @@
+/*
+Copyright (c) by respective owners including Yahoo!, Microsoft, and
+individual contributors. All rights reserved.  Released under a BSD (revised)
+license as described in the file LICENSE.
+ */
+#ifndef _WIN32
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+#include <algorithm>
+#include "mmap_io.h"
+
+mmap_io_buf::mmap_io_buf()
+{ windowed = false;
+  buffer = v_init<char>();
+}
+
+mmap_io_buf::~mmap_io_buf()
+{ end_window();
+  while (!maps.empty())
+    unmap(maps.begin()->first);
+}
+
+int mmap_io_buf::open_file(const char* name, bool stdin_off, int flag)
+{ int f = io_buf::open_file(name, stdin_off, flag);
+#ifndef _WIN32
+  struct stat st;
+  if (flag == READ && f != -1 && fstat(f, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0)
+  { unmap(f); // descriptors get reused
+    // private and writable: the json parser tokenizes in place
+    void* data = mmap(nullptr, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, f, 0);
+    if (data != MAP_FAILED)
+    { madvise(data, st.st_size, MADV_SEQUENTIAL);
+      madvise(data, st.st_size, MADV_WILLNEED);
+      mapping m = { (char*)data, (size_t)st.st_size, 0 };
+      maps[f] = m;
+    }
+  }
+#endif
+  return f;
+}
+
+void mmap_io_buf::reset_file(int f)
+{ end_window();
+  io_buf::reset_file(f);
+  std::map<int, mapping>::iterator m = maps.find(f);
+  if (m != maps.end())
+    m->second.offset = 0;
+}
+
+ssize_t mmap_io_buf::read_file(int f, void* buf, size_t nbytes)
+{ std::map<int, mapping>::iterator m = maps.find(f);
+  if (m == maps.end())
+    return io_buf::read_file(f, buf, nbytes);
+
+  mapping& mp = m->second;
+  size_t n = std::min(nbytes, mp.size - mp.offset);
+  memcpy(buf, mp.data + mp.offset, n);
+  mp.offset += n;
+  return n;
+}
+
+int64_t mmap_io_buf::file_offset() { return -1; }
+
+void mmap_io_buf::compact()
+{ if (windowed)
+    end_window();
+  else
+    io_buf::compact();
+}
+
+ssize_t mmap_io_buf::fill(int f)
+{ // the window always reaches the end of its mapping, so there is nothing left to add to it
+  end_window();
+
+  std::map<int, mapping>::iterator m = maps.find(f);
+  if (m != maps.end() && head == space.end() && m->second.offset < m->second.size)
+  { mapping& mp = m->second;
+    buffer = space;
+    space.begin() = mp.data + mp.offset;
+    space.end() = mp.data + mp.size;
+    space.end_array = space.end();
+    head = space.begin();
+    windowed = true;
+
+    ssize_t n = mp.size - mp.offset;
+    mp.offset = mp.size;
+    return n;
+  }
+  // unread bytes are waiting in the buffer, or the file isn't mapped: copy through read_file
+  return io_buf::fill(f);
+}
+
+bool mmap_io_buf::close_file()
+{ if (files.size() > 0)
+    unmap(files.last());
+  return io_buf::close_file();
+}
+
+void mmap_io_buf::end_window()
+{ if (!windowed)
+    return;
+
+  char* unread = head;
+  size_t left = space.end() - head;
+  space = buffer;
+  if ((size_t)(space.end_array - space.begin()) < left)
+    space.resize(left);
+  memcpy(space.begin(), unread, left);
+  head = space.begin();
+  space.end() = space.begin() + left;
+  windowed = false;
+}
+
+void mmap_io_buf::unmap(int f)
+{ std::map<int, mapping>::iterator m = maps.find(f);
+  if (m == maps.end())
+    return;
+
+  end_window();
+#ifndef _WIN32
+  munmap(m->second.data, m->second.size);
+#endif
+  maps.erase(m);
+}
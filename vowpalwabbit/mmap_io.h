@@ -0,0 +1,47 @@
+/*
+Copyright (c) by respective owners including Yahoo!, Microsoft, and
+individual contributors. All rights reserved.  Released under a BSD
+license as described in the file LICENSE.
+ */
+#pragma once
+#include <map>
+#include "io_buf.h"
+
+// An io_buf that maps regular files rather than read()ing them.  While a mapped file is read,
+// space is a window onto the mapping, so buf_read and readto hand out pointers into the page cache
+// without a copy or a system call.  Pipes, sockets and stdin go through the usual buffer.
+class mmap_io_buf : public io_buf
+{
+public:
+  struct mapping
+  { char* data;
+    size_t size;
+    size_t offset; // bytes handed out so far, through space or read_file
+  };
+  std::map<int, mapping> maps;
+
+  bool windowed; // space currently points into a mapping
+  v_array<char> buffer; // the space we own, put aside while windowed
+
+  mmap_io_buf();
+
+  virtual ~mmap_io_buf();
+
+  virtual int open_file(const char* name, bool stdin_off, int flag = READ);
+
+  virtual void reset_file(int f);
+
+  virtual ssize_t read_file(int f, void* buf, size_t nbytes);
+
+  virtual int64_t file_offset();
+
+  virtual void compact();
+
+  virtual ssize_t fill(int f);
+
+  virtual bool close_file();
+
+  void end_window(); // back to our own space, keeping the unread bytes
+
+  void unmap(int f);
+};
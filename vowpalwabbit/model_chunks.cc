@@ -0,0 +1,352 @@
+/*
+Copyright (c) by respective owners including Yahoo!, Microsoft, and
+individual contributors. All rights reserved.  Released under a BSD (revised)
+license as described in the file LICENSE.
+ */
+#include <zlib.h>
+#include <algorithm>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include "model_chunks.h"
+#include "cache.h"
+#include "vw_exception.h"
+
+using namespace std;
+
+namespace MODEL_CHUNKS
+{
+const uint64_t range = 1 << 20; // weights in a chunk
+const size_t slice = 1 << 16; // bytes moved through the io_buf at once
+
+// encoded: uint32 weights, uint32 index bytes, their stream-vbyte deltas, then the values as 4 byte planes
+struct chunk_header
+{ uint64_t first; // weight the range starts at
+  uint32_t raw_bytes; // encoded; 0 after the last chunk
+  uint32_t packed_bytes; // deflated, or raw_bytes where deflating did not help
+  uint64_t checksum; // of the encoded bytes
+};
+
+struct chunk
+{ chunk_header h;
+  string data;
+  bool ready; // encoded, for the writer
+
+  chunk() : ready(false) {}
+};
+
+// one thread per core, none where there is only a range to do
+size_t workers(size_t ranges)
+{ size_t n = min((size_t)thread::hardware_concurrency(), ranges);
+  return n > 1 ? n : 0;
+}
+
+// the nonzero weights of a range: how far each is from the one before it, the first from the range start
+void encode(uint64_t first, vector<uint32_t>& deltas, vector<weight>& values, chunk& c)
+{ size_t n = values.size();
+  string raw(2 * sizeof(uint32_t) + (n + 3) / 4 + n * sizeof(uint32_t) + n * sizeof(weight), '\0');
+  uint32_t count = (uint32_t)n;
+  uint32_t index_bytes = (uint32_t)stream_vbyte_encode(deltas.data(), n, (uint8_t*)&raw[2 * sizeof(uint32_t)]);
+  memcpy(&raw[0], &count, sizeof(count));
+  memcpy(&raw[sizeof(uint32_t)], &index_bytes, sizeof(index_bytes));
+  // byte planes: the exponent bytes of similar weights line up, which is what deflate finds
+  char* planes = &raw[2 * sizeof(uint32_t) + index_bytes];
+  for (size_t j = 0; j < n; j++)
+  { char bytes[sizeof(weight)];
+    memcpy(bytes, &values[j], sizeof(weight));
+    for (size_t b = 0; b < sizeof(weight); b++)
+      planes[b * n + j] = bytes[b];
+  }
+  raw.resize(2 * sizeof(uint32_t) + index_bytes + n * sizeof(weight));
+
+  c.h.first = first;
+  c.h.raw_bytes = (uint32_t)raw.size();
+  c.h.checksum = uniform_hash(raw.data(), raw.size(), 0);
+  uLongf packed = compressBound((uLong)raw.size());
+  c.data.resize(packed);
+  if (compress2((Bytef*)&c.data[0], &packed, (const Bytef*)raw.data(), (uLong)raw.size(), Z_BEST_SPEED) == Z_OK
+      && packed < raw.size())
+    c.data.resize(packed);
+  else
+    c.data.swap(raw);
+  c.h.packed_bytes = (uint32_t)c.data.size();
+}
+
+template<class A>
+void decode(const chunk& c, uint64_t length, A& apply)
+{ string inflated;
+  const string* raw = &c.data;
+  if (c.h.packed_bytes != c.h.raw_bytes)
+  { inflated.resize(c.h.raw_bytes);
+    uLongf size = c.h.raw_bytes;
+    if (uncompress((Bytef*)&inflated[0], &size, (const Bytef*)c.data.data(), c.h.packed_bytes) != Z_OK || size != c.h.raw_bytes)
+      THROW("Model content is corrupted, the chunk at weight " << c.h.first << " does not inflate");
+    raw = &inflated;
+  }
+  if (uniform_hash(raw->data(), raw->size(), 0) != c.h.checksum)
+    THROW("Model content is corrupted, the chunk at weight " << c.h.first << " fails its checksum");
+
+  uint32_t n, index_bytes;
+  memcpy(&n, raw->data(), sizeof(n));
+  memcpy(&index_bytes, raw->data() + sizeof(uint32_t), sizeof(index_bytes));
+  const uint8_t* indices = (const uint8_t*)raw->data() + 2 * sizeof(uint32_t);
+  vector<uint32_t> deltas(n);
+  if (2 * sizeof(uint32_t) + (uint64_t)index_bytes + (uint64_t)n * sizeof(weight) != raw->size()
+      || stream_vbyte_decode(indices, n, deltas.data(), indices + index_bytes) == nullptr)
+    THROW("Model content is corrupted, the chunk at weight " << c.h.first << " is malformed");
+
+  const char* planes = (const char*)indices + index_bytes;
+  uint64_t index = c.h.first;
+  for (size_t j = 0; j < n; j++)
+  { index += deltas[j];
+    if (index >= length)
+      THROW("Model content is corrupted, weight vector index " << index << " must be less than total vector length " << length);
+    if (index >= c.h.first + range) // the dense load relies on each chunk keeping to its range
+      THROW("Model content is corrupted, weight vector index " << index << " is past the chunk at weight " << c.h.first);
+    char bytes[sizeof(weight)];
+    for (size_t b = 0; b < sizeof(weight); b++)
+      bytes[b] = planes[b * n + j];
+    weight v;
+    memcpy(&v, bytes, sizeof(weight));
+    apply(index, v);
+  }
+}
+
+void write_chunk(io_buf& model_file, const chunk& c)
+{ bin_write_fixed(model_file, (const char*)&c.h, sizeof(c.h));
+  for (size_t at = 0; at < c.data.size(); at += slice)
+    bin_write_fixed(model_file, c.data.data() + at, min(slice, c.data.size() - at));
+}
+
+// gather(k, first, deltas, values) fills in range k; the ranges are encoded on worker threads while
+// this one writes them in order, at most a couple per worker ahead
+template<class G>
+void save_ranges(vw& all, io_buf& model_file, size_t ranges, G gather)
+{ uint64_t length = (uint64_t)1 << all.num_bits;
+  bin_write_fixed(model_file, (const char*)&length, sizeof(length));
+
+  size_t threads = workers(ranges);
+  if (threads == 0)
+  { vector<uint32_t> deltas;
+    vector<weight> values;
+    chunk c;
+    for (size_t k = 0; k < ranges; k++)
+    { uint64_t first;
+      deltas.clear();
+      values.clear();
+      gather(k, first, deltas, values);
+      if (values.empty())
+        continue;
+      encode(first, deltas, values, c);
+      write_chunk(model_file, c);
+    }
+  }
+  else
+  { vector<chunk> chunks(ranges);
+    mutex lock;
+    condition_variable changed;
+    size_t next = 0;
+    size_t written = 0;
+    const size_t window = 2 * threads;
+
+    vector<thread> encoders;
+    for (size_t t = 0; t < threads; t++)
+      encoders.push_back(thread([&]()
+      { vector<uint32_t> deltas;
+        vector<weight> values;
+        while (true)
+        { size_t k;
+          { unique_lock<mutex> l(lock);
+            changed.wait(l, [&]() { return next >= ranges || next < written + window; });
+            if (next >= ranges)
+              return;
+            k = next++;
+          }
+          chunk c;
+          uint64_t first;
+          deltas.clear();
+          values.clear();
+          gather(k, first, deltas, values);
+          c.h.raw_bytes = 0;
+          if (!values.empty())
+            encode(first, deltas, values, c);
+          { lock_guard<mutex> l(lock);
+            chunks[k].h = c.h;
+            chunks[k].data.swap(c.data);
+            chunks[k].ready = true;
+          }
+          changed.notify_all();
+        }
+      }));
+
+    for (size_t k = 0; k < ranges; k++)
+    { { unique_lock<mutex> l(lock);
+        changed.wait(l, [&]() { return chunks[k].ready; });
+      }
+      if (chunks[k].h.raw_bytes > 0)
+        write_chunk(model_file, chunks[k]);
+      string().swap(chunks[k].data);
+      { lock_guard<mutex> l(lock);
+        written++;
+      }
+      changed.notify_all();
+    }
+    for (thread& t : encoders)
+      t.join();
+  }
+
+  chunk_header end = { 0, 0, 0, 0 };
+  bin_write_fixed(model_file, (const char*)&end, sizeof(end));
+}
+
+void save(vw& all, io_buf& model_file, dense_parameters& weights)
+{ uint64_t length = (uint64_t)1 << all.num_bits;
+  save_ranges(all, model_file, (size_t)((length + range - 1) / range),
+              [&](size_t k, uint64_t& first, vector<uint32_t>& deltas, vector<weight>& values)
+  { first = k * range;
+    uint64_t end = min(first + range, length);
+    uint64_t last = first;
+    for (uint64_t i = first; i < end; i++)
+    { weight w = weights.strided_index(i);
+      if (w != 0.)
+      { deltas.push_back((uint32_t)(i - last));
+        values.push_back(w);
+        last = i;
+      }
+    }
+  });
+}
+
+void save(vw& all, io_buf& model_file, sparse_parameters& weights)
+{ // the map is in no order and may not be read while it is written, so its weights are sorted first
+  vector<pair<uint64_t, weight>> sorted;
+  for (sparse_parameters::iterator v = weights.begin(); v != weights.end(); ++v)
+    if (*v != 0.)
+      sorted.push_back(make_pair(v.index() >> weights.stride_shift(), *v));
+  sort(sorted.begin(), sorted.end());
+  vector<size_t> starts; // of the ranges holding any
+  for (size_t j = 0; j < sorted.size(); j++)
+    if (j == 0 || sorted[j].first / range != sorted[j - 1].first / range)
+      starts.push_back(j);
+
+  save_ranges(all, model_file, starts.size(),
+              [&](size_t k, uint64_t& first, vector<uint32_t>& deltas, vector<weight>& values)
+  { first = sorted[starts[k]].first / range * range;
+    size_t end = k + 1 < starts.size() ? starts[k + 1] : sorted.size();
+    uint64_t last = first;
+    for (size_t j = starts[k]; j < end; j++)
+    { deltas.push_back((uint32_t)(sorted[j].first - last));
+      values.push_back(sorted[j].second);
+      last = sorted[j].first;
+    }
+  });
+}
+
+// reads the chunks in order on this thread; with parallel, worker threads decode them
+template<class A>
+void load_chunks(vw& all, io_buf& model_file, bool parallel, A apply)
+{ uint64_t length = (uint64_t)1 << all.num_bits;
+  uint64_t stored = 0;
+  if (bin_read_fixed(model_file, (char*)&stored, sizeof(stored), "") < sizeof(stored) || stored != length)
+    THROW("Model content is corrupted, its chunks are not of " << length << " weights");
+  const uint64_t largest = 2 * sizeof(uint32_t) + (range + 3) / 4 + range * (sizeof(uint32_t) + sizeof(weight));
+
+  deque<chunk> queue;
+  mutex lock;
+  condition_variable changed;
+  bool done = false;
+  string error;
+  size_t threads = parallel ? workers((size_t)((length + range - 1) / range)) : 0;
+  const size_t window = 2 * threads;
+
+  vector<thread> decoders;
+  for (size_t t = 0; t < threads; t++)
+    decoders.push_back(thread([&]()
+    { while (true)
+      { chunk c;
+        { unique_lock<mutex> l(lock);
+          changed.wait(l, [&]() { return done || !queue.empty(); });
+          if (queue.empty())
+            return;
+          c.h = queue.front().h;
+          c.data.swap(queue.front().data);
+          queue.pop_front();
+        }
+        changed.notify_all();
+        try
+        { decode(c, length, apply); }
+        catch (exception& e)
+        { lock_guard<mutex> l(lock);
+          if (error.empty())
+            error = e.what();
+        }
+      }
+    }));
+
+  auto finish = [&]()
+  { { lock_guard<mutex> l(lock);
+      done = true;
+    }
+    changed.notify_all();
+    for (thread& t : decoders)
+      t.join();
+    decoders.clear();
+  };
+
+  try
+  { uint64_t next_first = 0; // chunks come in order, each after the range of the one before
+    while (true)
+    { chunk c;
+      if (bin_read_fixed(model_file, (char*)&c.h, sizeof(c.h), "") < sizeof(c.h))
+        THROW("Model content is corrupted, its chunks end early");
+      if (c.h.raw_bytes == 0)
+        break;
+      if (c.h.raw_bytes > largest || c.h.packed_bytes > compressBound(c.h.raw_bytes) || c.h.first >= length)
+        THROW("Model content is corrupted, the chunk at weight " << c.h.first << " is malformed");
+      if (c.h.first < next_first)
+        THROW("Model content is corrupted, the chunk at weight " << c.h.first << " overlaps the one before");
+      next_first = c.h.first + range;
+      c.data.resize(c.h.packed_bytes);
+      for (size_t at = 0; at < c.data.size(); at += slice)
+      { char* p;
+        size_t n = min(slice, c.data.size() - at);
+        if (buf_read(model_file, p, n) < n)
+          THROW("Model content is corrupted, its chunks end early");
+        memcpy(&c.data[at], p, n);
+      }
+
+      if (threads == 0)
+      { decode(c, length, apply);
+        continue;
+      }
+      unique_lock<mutex> l(lock);
+      changed.wait(l, [&]() { return queue.size() < window || !error.empty(); });
+      if (!error.empty())
+        break;
+      queue.push_back(chunk());
+      queue.back().h = c.h;
+      queue.back().data.swap(c.data);
+      l.unlock();
+      changed.notify_all();
+    }
+  }
+  catch (...)
+  { finish();
+    throw;
+  }
+  finish();
+  if (!error.empty())
+    THROW(error);
+}
+
+void load(vw& all, io_buf& model_file, dense_parameters& weights)
+{ // load_chunks and decode keep the chunks to ranges that do not overlap, so the decoders write the
+  // array without a lock
+  load_chunks(all, model_file, true, [&](uint64_t i, weight v) { weights.strided_index(i) = v; });
+}
+
+void load(vw& all, io_buf& model_file, sparse_parameters& weights)
+{ load_chunks(all, model_file, false, [&](uint64_t i, weight v) { weights.strided_index(i) = v; });
+}
+}
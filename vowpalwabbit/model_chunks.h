@@ -0,0 +1,19 @@
+/*
+Copyright (c) by respective owners including Yahoo!, Microsoft, and
+individual contributors. All rights reserved.  Released under a BSD
+license as described in the file LICENSE.
+ */
+#pragma once
+#include "global_data.h"
+
+// --compress_model: the regressor cut into ranges of weights, each written as one chunk holding the
+// index deltas of its nonzero weights (stream-vbyte) and their values (byte planes), deflated, with a
+// checksum.  Ranges are encoded, and decoded again on load, on all cores.
+namespace MODEL_CHUNKS
+{
+void save(vw& all, io_buf& model_file, dense_parameters& weights);
+void save(vw& all, io_buf& model_file, sparse_parameters& weights);
+
+void load(vw& all, io_buf& model_file, dense_parameters& weights);
+void load(vw& all, io_buf& model_file, sparse_parameters& weights);
+}
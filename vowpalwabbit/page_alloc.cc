@@ -0,0 +1,172 @@
+/*
+Copyright (c) by respective owners including Yahoo!, Microsoft, and
+individual contributors. All rights reserved.  Released under a BSD (revised)
+license as described in the file LICENSE.
+ */
+#include <sstream>
+#include <fstream>
+#include <string.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <stdint.h>
+#ifndef _WIN32
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+#ifdef __linux__
+#include <linux/mempolicy.h>
+#endif
+#include "page_alloc.h"
+#include "vw_exception.h"
+
+#ifdef _WIN32
+void* map_pages(size_t& bytes, bool, const page_options&, std::string& report)
+{ void* data = calloc(bytes, 1);
+  if (data == nullptr)
+    THROW("internal error: memory allocation failed!");
+  report = "regular pages, huge pages and NUMA placement are not supported on windows";
+  return data;
+}
+
+void unmap_pages(void* data, size_t) { free(data); }
+#else
+
+#ifndef MAP_ANONYMOUS
+#define MAP_ANONYMOUS MAP_ANON
+#endif
+
+const size_t huge_2m_size = (size_t)1 << 21;
+
+// whether the system would turn madvise(MADV_HUGEPAGE) into huge pages; shared memory has its own switch
+bool transparent_huge_pages(bool shared)
+{ std::ifstream enabled(shared ? "/sys/kernel/mm/transparent_hugepage/shmem_enabled" : "/sys/kernel/mm/transparent_hugepage/enabled");
+  std::string modes;
+  return enabled && std::getline(enabled, modes) && modes.find("[never]") == std::string::npos
+    && modes.find("[deny]") == std::string::npos;
+}
+
+// maps bytes aligned to a 2MB boundary, so transparent huge pages can cover all of it
+void* map_aligned(size_t bytes, int flags)
+{ size_t padded = bytes + huge_2m_size;
+  char* data = (char*)mmap(nullptr, padded, PROT_READ | PROT_WRITE, flags, -1, 0);
+  if (data == MAP_FAILED)
+    return MAP_FAILED;
+  char* aligned = (char*)(((uintptr_t)data + huge_2m_size - 1) & ~(uintptr_t)(huge_2m_size - 1));
+  if (aligned > data)
+    munmap(data, aligned - data);
+  if (data + padded > aligned + bytes)
+    munmap(aligned + bytes, data + padded - (aligned + bytes));
+  return aligned;
+}
+
+#ifdef __linux__
+// the nodes listed in a sysfs node list such as "0-3,6", at most 64 of them
+uint64_t online_nodes(size_t& count)
+{ std::ifstream online("/sys/devices/system/node/online");
+  std::string list;
+  uint64_t mask = 0;
+  count = 0;
+  if (!online || !std::getline(online, list))
+  { count = 1;
+    return 1;
+  }
+  std::stringstream ranges(list);
+  std::string range;
+  while (std::getline(ranges, range, ','))
+  { int first = atoi(range.c_str()), last = first;
+    size_t dash = range.find('-');
+    if (dash != std::string::npos)
+      last = atoi(range.c_str() + dash + 1);
+    for (int n = first; n <= last && n < 64; n++)
+      if (!(mask & ((uint64_t)1 << n)))
+      { mask |= (uint64_t)1 << n;
+        count++;
+      }
+  }
+  return mask;
+}
+
+// sets the NUMA policy of a mapping before any of it is touched, so every page is placed by it
+void place(void* data, size_t bytes, const page_options& options, std::stringstream& report)
+{ uint64_t mask;
+  size_t count = 1;
+  int mode;
+  if (options.numa == numa_bind)
+  { if (options.node < 0 || options.node >= 64)
+    { report << ", NUMA node " << options.node << " is out of range, not bound";
+      return;
+    }
+    mask = (uint64_t)1 << options.node;
+    mode = MPOL_BIND;
+  }
+  else
+  { mask = online_nodes(count);
+    mode = MPOL_INTERLEAVE;
+  }
+  if (syscall(SYS_mbind, data, bytes, mode, &mask, 64, 0) != 0)
+    report << ", NUMA policy not applied (" << strerror(errno) << ")";
+  else if (options.numa == numa_bind)
+    report << ", bound to NUMA node " << options.node;
+  else
+    report << ", interleaved across " << count << " NUMA node" << (count == 1 ? "" : "s");
+}
+#else
+void place(void*, size_t, const page_options&, std::stringstream& report)
+{ report << ", NUMA placement is only supported on linux"; }
+#endif
+
+void* map_pages(size_t& bytes, bool shared, const page_options& options, std::string& report)
+{ int flags = (shared ? MAP_SHARED : MAP_PRIVATE) | MAP_ANONYMOUS;
+  std::stringstream got, missing;
+  got << (bytes >> 20) << "MB on ";
+
+  void* data = MAP_FAILED;
+  if (options.huge == huge_2m || options.huge == huge_1g)
+  { const char* name = options.huge == huge_1g ? "1GB" : "2MB";
+#if defined(MAP_HUGETLB) && defined(MAP_HUGE_SHIFT)
+    size_t shift = options.huge == huge_1g ? 30 : 21;
+    size_t page = (size_t)1 << shift;
+    size_t rounded = (bytes + page - 1) & ~(page - 1);
+    data = mmap(nullptr, rounded, PROT_READ | PROT_WRITE, flags | MAP_HUGETLB | (int)(shift << MAP_HUGE_SHIFT), -1, 0);
+    if (data != MAP_FAILED)
+    { bytes = rounded;
+      got << name << " hugetlb pages";
+    }
+    else
+      missing << " (no " << name << " hugetlb pages: " << strerror(errno) << ")";
+#else
+    missing << " (no " << name << " hugetlb pages on this system)";
+#endif
+  }
+
+  if (data == MAP_FAILED && options.huge != huge_none)
+  { data = map_aligned(bytes, flags);
+    if (data != MAP_FAILED)
+    { if (!transparent_huge_pages(shared))
+        got << "regular pages, transparent huge pages are disabled";
+#ifdef MADV_HUGEPAGE
+      else if (madvise(data, bytes, MADV_HUGEPAGE) == 0)
+        got << "transparent huge pages";
+#endif
+      else
+        got << "regular pages, transparent huge pages were refused";
+    }
+  }
+
+  if (data == MAP_FAILED)
+  { data = mmap(nullptr, bytes, PROT_READ | PROT_WRITE, flags, -1, 0);
+    if (data == MAP_FAILED)
+      THROW("internal error: memory allocation failed!");
+    got << "regular pages";
+  }
+  got << missing.str();
+
+  if (options.numa != numa_none)
+    place(data, bytes, options, got);
+  report = got.str();
+  return data;
+}
+
+void unmap_pages(void* data, size_t bytes) { munmap(data, bytes); }
+#endif
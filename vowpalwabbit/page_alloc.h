@@ -0,0 +1,25 @@
+/*
+Copyright (c) by respective owners including Yahoo!, Microsoft, and
+individual contributors. All rights reserved.  Released under a BSD
+license as described in the file LICENSE.
+ */
+#pragma once
+#include <string>
+
+// How the memory behind a dense weight array or sparse weight table is obtained (--hugepages, --numa).  Large models are
+// read at random hashed offsets, so with 4KB pages nearly every access misses the TLB.
+enum huge_pages { huge_none, huge_transparent, huge_2m, huge_1g };
+enum numa_policy { numa_none, numa_interleave, numa_bind };
+
+struct page_options
+{ huge_pages huge;
+  numa_policy numa;
+  int node; // for numa_bind
+};
+
+// Maps at least bytes of zeroed memory, shared with forked children or not, following options as
+// far as the system allows: hugetlb pages fall back to transparent huge pages, and those to regular
+// pages.  bytes is updated to the length to unmap; report describes what was obtained.
+void* map_pages(size_t& bytes, bool shared, const page_options& options, std::string& report);
+
+void unmap_pages(void* data, size_t bytes);
@@ -372,13 +372,23 @@ void parse_source(vw& all)
   ("num_children", po::value<size_t>(&(all.num_children)), "number of children for persistent daemon mode")
   ("pid_file", po::value< string >(), "Write pid file in persistent daemon mode")
   ("port_file", po::value< string >(), "Write port used in persistent daemon mode")
+  ("serve", "in persistent daemon mode, answer all clients from one process, scoring their lines together in micro-batches on threads sharing the model; needs -t")
+  ("serve_threads", po::value<size_t>(), "scoring threads for serve (default: one per hardware thread)")
+  ("serve_batch", po::value<size_t>()->default_value(32), "most lines serve scores at once")
+  ("serve_latency", po::value<size_t>()->default_value(200), "microseconds a line may wait for its serve batch to fill")
+  ("serve_queue", po::value<size_t>()->default_value(4096), "most lines serve keeps waiting to be scored before it stops reading from clients")
+  ("serve_watch", "swap in the model at the -i path whenever a new one is written there (SIGHUP swaps it in on demand)")
   ("cache,c", "Use a cache.  The default is <data>.cache")
   ("cache_file", po::value< vector<string> >(), "The location(s) of cache_file.")
+  ("convert_cache", po::value< string >(), "while reading a cache file, rewrite it into the given file in the current cache format")
   ("json", "Enable JSON parsing.")
   ("dsjson", "Enable Decision Service JSON parsing.")
   ("kill_cache,k", "do not reuse existing cache: create a new one always")
   ("compressed", "use gzip format whenever possible. If a cache file is being created, this option creates a compressed cache file. A mixture of raw-text & compressed inputs are supported with autodetection.")
-  ("no_stdin", "do not default to reading from stdin");
+  ("cache_mmap", "read input files, cache files in particular, through mmap rather than read()")
+  ("prefetch", "read input files, cache files in particular, ahead on a background thread")
+  ("no_stdin", "do not default to reading from stdin")
+  ("parse_threads", po::value<size_t>(&(all.p->parse_threads)), "number of threads tokenizing and hashing text input. Examples still reach the learner in input order.");
   add_options(all);
 
   // Be friendly: if -d was left out, treat positional param as data file
@@ -398,13 +408,23 @@ void parse_source(vw& all)
   if ( (vm.count("total") || vm.count("node") || vm.count("unique_id")) && !(vm.count("total") && vm.count("node") && vm.count("unique_id")) )
     THROW("you must specificy unique_id, total, and node if you specify any");
 
-  if (vm.count("daemon") || vm.count("pid_file") || (vm.count("port") && !all.active) )
+  if (vm.count("serve") && all.training)
+    THROW("serve answers from a fixed model: add -t");
+  if (vm.count("serve_watch") && !(vm.count("serve") && vm.count("initial_regressor")))
+    THROW("serve_watch watches the model serve was given with -i");
+
+  if (vm.count("daemon") || vm.count("serve") || vm.count("pid_file") || (vm.count("port") && !all.active) )
   { all.daemon = true;
 
     // allow each child to process up to 1e5 connections
     all.numpasses = (size_t) 1e5;
   }
 
+  if (all.p->parse_threads > 0 && (all.daemon || all.active))
+  { all.p->parse_threads = 0;
+    all.trace_message << "ignoring parse_threads: daemon and active mode answer one line at a time" << endl;
+  }
+
   if (vm.count("compressed"))
     set_compressed(all.p);
 
@@ -416,6 +436,24 @@ void parse_source(vw& all)
   else
     all.data_filename = "";
 
+  if (vm.count("cache_mmap"))
+  { if (all.p->input->compressed())
+      all.trace_message << "ignoring cache_mmap: compressed files can't be mapped" << endl;
+    else
+      set_mmap(all.p);
+  }
+
+  if (vm.count("prefetch"))
+  { if (all.p->input->compressed())
+      all.trace_message << "ignoring prefetch: compressed files are read by zlib" << endl;
+    else if (vm.count("cache_mmap"))
+      all.trace_message << "ignoring prefetch: cache_mmap reads files directly" << endl;
+    else if (all.daemon)
+      all.trace_message << "ignoring prefetch: daemon mode reads from sockets" << endl;
+    else
+      set_prefetch(all.p);
+  }
+
   if ((vm.count("cache") || vm.count("cache_file")) && vm.count("invert_hash"))
     THROW("invert_hash is incompatible with a cache file.  Use it in single pass mode only.");
 
@@ -1014,6 +1052,9 @@ void parse_output_model(vw& all)
   ("readable_model", po::value< string >(), "Output human-readable final regressor with numeric features")
   ("invert_hash", po::value< string >(), "Output human-readable final regressor with feature names.  Computationally expensive.")
   ("save_resume", "save extra state so learning can be resumed later with new data")
+  ("dense_model", "save the weights as one page-aligned array, which -i maps instead of reading when it can, sharing it between processes")
+  ("compress_model", "save the nonzero weights in deflated chunks, encoded and loaded again on all cores")
+  ("quantize_model", po::value< string >(), "save only the weights, as fp16 or as int8 scaled per block of 64, for prediction with -t")
   ("preserve_performance_counters", "reset performance counters when warmstarting")
   ("save_per_pass", "Save the model after every pass over data")
   ("output_feature_regularizer_binary", po::value< string >(&(all.per_feature_regularizer_output)), "Per feature regularization output file")
@@ -1044,6 +1085,27 @@ void parse_output_model(vw& all)
   if (vm.count("save_resume"))
     all.save_resume = true;
 
+  if (vm.count("dense_model"))
+    all.dense_model = true;
+
+  if (vm.count("compress_model"))
+    all.compress_model = true;
+
+  if (all.dense_model && all.compress_model)
+    THROW("dense_model and compress_model are different layouts of the weights: pick one");
+
+  if (vm.count("quantize_model"))
+  { string kind = vm["quantize_model"].as<string>();
+    if (kind == "fp16")
+      all.quantize_model = quantize_fp16;
+    else if (kind == "int8")
+      all.quantize_model = quantize_int8;
+    else
+      THROW("quantize_model must be fp16 or int8, not " << kind);
+    if (all.dense_model || all.compress_model || all.save_resume)
+      THROW("quantize_model keeps nothing but the weights, in its own layout: it can not go with dense_model, compress_model or save_resume");
+  }
+
   if (vm.count("preserve_performance_counters"))
     all.preserve_performance_counters = true;
   
@@ -1146,6 +1208,18 @@ void parse_reductions(vw& all)
   all.l = setup_base(all);
 }
 
+wire_format parse_wire(const string& wire, const char* option)
+{ if (wire == "raw")
+    return wire_raw;
+  if (wire == "fp16")
+    return wire_fp16;
+  if (wire == "bf16")
+    return wire_bf16;
+  if (wire == "zero_runs")
+    return wire_zero_runs;
+  THROW(option << " must be raw, fp16, bf16 or zero_runs, not " << wire);
+}
+
 void add_to_args(vw& all, int argc, char* argv[], int excl_param_count = 0, const char* excl_params[] = NULL)
 { bool skip_next = false;
 
@@ -1204,6 +1278,10 @@ vw& parse_args(int argc, char *argv[], trace_message_t trace_listener, void* tra
     ("normal_weights", po::value<bool>(&(all.normal_weights)), "make initial weights normal")
     ("truncated_normal_weights", po::value<bool>(&(all.tnormal_weights)), "make initial weights truncated normal")
     ("sparse_weights", "Use a sparse datastructure for weights")
+    ("sparse_reserve", po::value<size_t>(&(all.sparse_reserve)), "make room for this many features in the sparse weights up front, instead of growing to it")
+    ("hugepages", po::value<string>()->implicit_value("2M"), "back the weight array (or sparse_weights table) with huge pages: 2M or 1G ones from the hugetlb pool, falling back to transparent huge pages, or thp for those only")
+    ("numa", po::value<string>(), "place the weight array (or sparse_weights table) on NUMA nodes: interleave across all of them, or bind it to the given node")
+    ("weight_prefetch", po::value<size_t>(&(all.weight_prefetch))->implicit_value(8), "prefetch the weights of interaction features this many features ahead (8 if not given); may help when the weights are much larger than the caches")
     ("input_feature_regularizer", po::value< string >(&(all.per_feature_regularizer_input)), "Per feature regularization input file");
     add_options(all);
  
@@ -1212,10 +1290,45 @@ vw& parse_args(int argc, char *argv[], trace_message_t trace_listener, void* tra
       all.weights.sparse = true;
     else
       all.weights.sparse = false;
+
+    if (vm.count("hugepages"))
+    { string huge = vm["hugepages"].as<string>();
+      if (huge == "2M" || huge == "2m")
+        all.weight_pages.huge = huge_2m;
+      else if (huge == "1G" || huge == "1g")
+        all.weight_pages.huge = huge_1g;
+      else if (huge == "thp")
+        all.weight_pages.huge = huge_transparent;
+      else
+        THROW("hugepages must be 2M, 1G or thp, not " << huge);
+    }
+    if (vm.count("numa"))
+    { string numa = vm["numa"].as<string>();
+      if (numa == "interleave")
+        all.weight_pages.numa = numa_interleave;
+      else
+      { char* end;
+        long node = strtol(numa.c_str(), &end, 10);
+        if (numa.empty() || *end != '\0' || node < 0)
+          THROW("numa must be interleave or a node number, not " << numa);
+        all.weight_pages.numa = numa_bind;
+        all.weight_pages.node = (int)node;
+      }
+    }
+    if (vm.count("sparse_reserve") && !all.weights.sparse)
+      THROW("sparse_reserve sizes the sparse_weights table");
     
     new_options(all, "Parallelization options")
     ("span_server", po::value<string>(), "Location of server for setting up spanning tree")
+    ("allreduce_ring", "with span_server, reduce around a ring of the nodes instead of up and down the spanning tree: each node sends about twice the model however many nodes there are")
+    ("allreduce_sparse", "send only the blocks of weights that some node changed since the last allreduce, or that are not zero in a sum of gradients")
+    ("allreduce_weights", po::value<string>(), "with span_server, send the weights averaged after each pass as fp16 or bf16; sums are still floats, fp16 tops out at 65504")
+    ("allreduce_gradients", po::value<string>(), "with span_server, send the gradients and preconditioner bfgs sums as zero_runs (lossless, the runs of zeros left out), fp16 or bf16")
+    ("allreduce_overlap", "with span_server, average the weights at the end of a pass on a thread of its own while the next pass learns, then add what each node learned meanwhile to the average; needs holdout_off, not with save_per_pass, the last pass averages at once")
+    ("allreduce_recover", "with span_server, when a node is lost redo the average of the pass on a new tree, once a node started in its place with -i <the last save_per_pass model> --save_resume --preserve_performance_counters has joined; needs holdout_off")
     ("threads", "Enable multi-threading")
+    ("learner_threads", po::value<size_t>(&(all.learner_threads)), "number of threads learning from the example ring at once, updating the weights without locks")
+    ("predict_batch", po::value<size_t>(&(all.predict_batch)), "score up to this many parsed test examples per call down the learner stack (default 16, 1 for one at a time)")
     ("unique_id", po::value<size_t>()->default_value(0), "unique id used for cluster parallel jobs")
     ("total", po::value<size_t>()->default_value(1), "total number of nodes used in cluster parallel job")
     ("node", po::value<size_t>()->default_value(0), "node number in cluster parallel job");
@@ -1227,8 +1340,37 @@ vw& parse_args(int argc, char *argv[], trace_message_t trace_listener, void* tra
         vm["span_server"].as<string>(),
         vm["unique_id"].as<size_t>(),
         vm["total"].as<size_t>(),
-        vm["node"].as<size_t>());
+        vm["node"].as<size_t>(),
+        vm.count("allreduce_ring") > 0,
+        vm.count("allreduce_recover") > 0);
     }
+    else if (vm.count("allreduce_ring"))
+      THROW("allreduce_ring needs span_server");
+    if (vm.count("allreduce_sparse"))
+    { if (all.weights.sparse)
+        THROW("allreduce_sparse works on dense weights, not sparse_weights");
+      all.allreduce_sparse = true;
+    }
+    if (vm.count("allreduce_overlap"))
+    { if (!vm.count("span_server"))
+        THROW("allreduce_overlap needs span_server");
+      if (all.weights.sparse)
+        THROW("allreduce_overlap works on dense weights, not sparse_weights");
+      all.allreduce_overlap = true;
+    }
+    if (vm.count("allreduce_recover"))
+    { if (!vm.count("span_server"))
+        THROW("allreduce_recover needs span_server");
+      if (all.weights.sparse)
+        THROW("allreduce_recover works on dense weights, not sparse_weights");
+      if (all.allreduce_overlap)
+        THROW("allreduce_recover redoes an average at the end of its pass, not overlapped with the next");
+      all.allreduce_recover = true;
+    }
+    if (vm.count("allreduce_weights"))
+      all.weights_wire = parse_wire(vm["allreduce_weights"].as<string>(), "allreduce_weights");
+    if (vm.count("allreduce_gradients"))
+      all.gradients_wire = parse_wire(vm["allreduce_gradients"].as<string>(), "allreduce_gradients");
 
     all.random_state = all.random_seed;
     parse_diagnostics(all, argc);
@@ -1318,6 +1460,17 @@ void parse_sources(vw& all, io_buf& model, bool skipModelLoad)
 
   enable_sources(all, all.quiet, all.numpasses);
 
+  if (all.learner_threads > 1)
+  { if (all.daemon)
+    { all.learner_threads = 1;
+      all.trace_message << "ignoring learner_threads: daemon mode answers one example at a time" << endl;
+    }
+    else if (!all.l->concurrent)
+      THROW("learner_threads needs plain gd over dense weights, without reductions, --l1, --l2 or audit");
+  }
+  if (all.vm.count("serve") && !all.l->concurrent)
+    THROW("serve needs plain gd over dense weights, without reductions, --l1, --l2 or audit");
+
   // force wpp to be a power of 2 to avoid 32-bit overflow
   uint32_t i = 0;
   size_t params_per_problem = all.l->increment;
@@ -1419,6 +1572,7 @@ vw* initialize(int argc, char* argv[], io_buf* model, bool skipModelLoad, trace_
     parse_modules(all, *model);
     parse_sources(all, *model, skipModelLoad);
 
+    INTERACTIONS::compile_plan(all); // the model may have brought its own interactions
     initialize_parser_datastructures(all);
 
     all.l->init_driver();
@@ -1535,13 +1689,16 @@ void finish(vw& all, bool delete_all)
   vw_exception finalize_regressor_exception(__FILE__, __LINE__, "empty");
   bool finalize_regressor_exception_thrown = false;
   try
-  { finalize_regressor(all, all.final_regressor_name);
+  { finish_average(all, all.weights); // with allreduce_overlap, a pass that stopped early leaves one under way
+    finalize_regressor(all, all.final_regressor_name);
   }
   catch (vw_exception& e)
   { finalize_regressor_exception = e;
     finalize_regressor_exception_thrown = true;
   }
 
+  free_average(all);
+
   if (all.l != nullptr)
   { all.l->finish();
     free_it(all.l);
@@ -1580,6 +1737,8 @@ void finish(vw& all, bool delete_all)
   // destroy all interactions and array of them
   for (v_string& i : all.interactions) i.delete_v();
   all.interactions.delete_v();
+  all.interaction_plan.prefixes.delete_v();
+  all.interaction_plan.prefix.delete_v();
 
   if (delete_all) delete &all;
 
@@ -196,7 +196,7 @@ public:
       { for (size_t dict=0; dict<namespace_dictionaries[index].size(); dict++)
         { feature_dict* map = namespace_dictionaries[index][dict];
           uint64_t hash = uniform_hash(feature_name.begin, feature_name.end-feature_name.begin, quadratic_constant);
-          features* feats = map->get(feature_name, hash);
+          features* feats = map->find(feature_name, hash);
           if ((feats != nullptr) && (feats->values.size() > 0))
           { features& dict_fs = ae->feature_space[dictionary_namespace];
             if (dict_fs.size() == 0)
@@ -345,7 +345,7 @@ public:
   }
 };
 
-void substring_to_example(vw* all, example* ae, substring example)
+char* substring_to_label(vw* all, example* ae, substring example)
 { all->p->lp.default_label(&ae->l);
   char* bar_location = safe_index(example.begin, '|', example.end);
   char* tab_location = safe_index(example.begin, '\t', bar_location);
@@ -374,12 +374,20 @@ void substring_to_example(vw* all, example* ae, substring example)
   if (all->p->words.size() > 0)
     all->p->lp.parse_label(all->p, all->sd, &ae->l, all->p->words);
 
-  if (all->audit || all->hash_inv)
-    TC_parser<true> parser_line(bar_location,example.end,*all,ae);
+  return bar_location;
+}
+
+void substring_to_features(vw* all, example* ae, char* begin, char* end)
+{ if (all->audit || all->hash_inv)
+    TC_parser<true> parser_line(begin,end,*all,ae);
   else
-    TC_parser<false> parser_line(bar_location,example.end,*all,ae);
+    TC_parser<false> parser_line(begin,end,*all,ae);
 }
 
+void substring_to_example(vw* all, example* ae, substring example)
+{ char* bar_location = substring_to_label(all, ae, example);
+  substring_to_features(all, ae, bar_location, example.end);
+}
 
 namespace VW
 {
@@ -16,6 +16,10 @@ typedef enum
 } FeatureInputType;
 
 void substring_to_example(vw* all, example* ae, substring example);
+// the two halves of substring_to_example: the label and tag are parsed in input order (label
+// parsers share scratch and label statistics), the namespaces only touch the example itself.
+char* substring_to_label(vw* all, example* ae, substring example); // returns the start of the namespaces
+void substring_to_features(vw* all, example* ae, char* begin, char* end);
 
 namespace VW
 {
@@ -83,6 +83,23 @@ template<class T> double calculate_sd(vw& all,T& weights)
   double sq_sum = inner_product(diff.begin(), diff.end(), diff.begin(), 0.0);
   return sqrt(sq_sum / my_size);
 }
+void allocate(vw& all, sparse_parameters& weights, size_t length, uint32_t stride_shift)
+{ new(&weights) sparse_parameters(length, stride_shift, all.weight_pages);
+  if (all.sparse_reserve > 0)
+    weights.reserve(all.sparse_reserve);
+}
+
+void allocate(vw& all, dense_parameters& weights, size_t length, uint32_t stride_shift)
+{ if (all.weight_pages.huge == huge_none && all.weight_pages.numa == numa_none)
+    new(&weights) dense_parameters(length, stride_shift);
+  else
+  { string report;
+    new(&weights) dense_parameters(length, stride_shift, all.weight_pages, report);
+    if (!all.quiet)
+      all.trace_message << "weight array: " << report << endl;
+  }
+}
+
 template<class T> void initialize_regressor(vw& all, T& weights)
 { // Regressor is already initialized.
 
@@ -93,7 +110,7 @@ template<class T> void initialize_regressor(vw& all, T& weights)
     {
       uint32_t ss = weights.stride_shift();
       weights.~T();//dealloc so that we can realloc, now with a known size
-      new(&weights) T(length, ss); }
+      allocate(all, weights, length, ss); }
   catch (VW::vw_exception anExc)
     { THROW(" Failed to allocate weight array with " << all.num_bits << " bits: try decreasing -b <bits>");
     }
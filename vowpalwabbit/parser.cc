@@ -41,6 +41,9 @@ int getpid()
 #include <errno.h>
 #include <stdio.h>
 #include <assert.h>
+#if defined(__SSE2__) || defined(_M_AMD64) || defined(_M_X64)
+#include <emmintrin.h>
+#endif
 namespace po = boost::program_options;
 
 #include "parse_example.h"
@@ -125,6 +128,46 @@ void condition_variable_signal_all(CV * pcv)
 #endif
 }
 
+// back off while spinning on the example ring
+inline void ring_relax()
+{
+#if defined(__SSE2__) || defined(_M_AMD64) || defined(_M_X64)
+  _mm_pause();
+#endif
+}
+
+// wake threads parked on cv; only touches the lock when somebody is actually parked.
+void wake_parked(parser* p, std::atomic<size_t>& parked, CV* cv)
+{ if (parked.load() > 0)
+  { mutex_lock(&p->examples_lock);
+    condition_variable_signal_all(cv);
+    mutex_unlock(&p->examples_lock);
+  }
+}
+
+// spin, then park on cv, until ready() holds; whoever makes it hold must call wake_parked(p, parked, cv).
+template<class F> void ring_wait(parser* p, std::atomic<size_t>& parked, CV* cv, F ready)
+{ for (size_t spin = 0; !ready(); spin++)
+    if (spin < p->ring_spin)
+      ring_relax();
+    else
+    { mutex_lock(&p->examples_lock);
+      parked++;
+      while (!ready())
+        condition_variable_wait(cv, &p->examples_lock);
+      parked--;
+      mutex_unlock(&p->examples_lock);
+      return;
+    }
+}
+
+void mark_parser_done(parser* p)
+{ p->done = true;
+  wake_parked(p, p->parked_consumers, &p->example_available);
+  wake_parked(p, p->parked_workers, &p->task_available);
+  wake_parked(p, p->parked_splitter, &p->task_finished);
+}
+
 //This should not? matter in a library mode.
 bool got_sigterm;
 
@@ -147,6 +190,13 @@ parser* new_parser()
   ret.local_example_number = 0;
   ret.in_pass_counter = 0;
   ret.ring_size = 1 << 8;
+  ret.ring_spin = 1 << 10;
+  ret.parked_producers = 0;
+  ret.parked_consumers = 0;
+  ret.parked_workers = 0;
+  ret.parked_splitter = 0;
+  ret.tasks_dispatched = 0;
+  ret.tasks_claimed = 0;
   ret.done = false;
   ret.used_index = 0;
   ret.jsonp = nullptr;
@@ -160,8 +210,21 @@ void set_compressed(parser* par)
   par->output = new comp_io_buf;
 }
 
-uint32_t cache_numbits(io_buf* buf, int filepointer)
-{ v_array<char> t = v_init<char>();
+void set_mmap(parser* par)
+{ finalize_source(par);
+  par->input = new mmap_io_buf;
+  par->output = new io_buf;
+}
+
+void set_prefetch(parser* par)
+{ finalize_source(par);
+  par->input = new prefetch_io_buf;
+  par->output = new io_buf;
+}
+
+uint32_t cache_numbits(io_buf* buf, int filepointer, char& marker)
+{ marker = cache_marker;
+ v_array<char> t = v_init<char>();
 
   try
   { size_t v_length;
@@ -184,11 +247,10 @@ uint32_t cache_numbits(io_buf* buf, int filepointer)
       return 0;
     }
 
-    char temp;
-    if (buf->read_file(filepointer, &temp, 1) < 1)
+    if (buf->read_file(filepointer, &marker, 1) < 1)
       THROW("failed to read");
 
-    if (temp != 'c')
+    if (marker != cache_marker && marker != block_cache_marker)
       THROW("data file is not a cache file");
   }
   catch(...)
@@ -212,11 +274,24 @@ bool member(v_array<int> ids, int id)
   return false;
 }
 
+// picks the reader for a cache file that starts with marker
+void use_cache_reader(vw& all, char marker)
+{ if (marker == block_cache_marker)
+  { if (all.p->cache_in == nullptr)
+      all.p->cache_in = new_block_reader();
+    all.p->cache_in->examples_left = 0;
+    all.p->reader = read_block_cached_features;
+  }
+  else
+    all.p->reader = read_cached_features;
+}
+
 void reset_source(vw& all, size_t numbits)
 { io_buf* input = all.p->input;
   input->current = 0;
   if (all.p->write_cache)
-  { all.p->output->flush();
+  { flush_cache_block(all);
+    all.p->output->flush();
     all.p->write_cache = false;
     all.p->output->close_file();
     remove(all.p->output->finalname.begin());
@@ -230,8 +305,10 @@ void reset_source(vw& all, size_t numbits)
           io_buf::close_file_or_socket(fd);
       }
     input->open_file(all.p->output->finalname.begin(), all.stdin_off, io_buf::READ); //pushing is merged into open_file
-    all.p->reader = read_cached_features;
+    use_cache_reader(all, all.p->cache_out != nullptr ? block_cache_marker : cache_marker);
   }
+  if (all.p->cache_in != nullptr) // a pass may end in the middle of a block
+    all.p->cache_in->examples_left = 0;
   if ( all.p->resettable == true )
   { if (all.daemon)
     { // wait for all predictions to be sent back to client
@@ -268,7 +345,8 @@ void reset_source(vw& all, size_t numbits)
     else
     { for (size_t i = 0; i < input->files.size(); i++)
       { input->reset_file(input->files[i]);
-        if (cache_numbits(input, input->files[i]) < numbits)
+        char marker;
+        if (cache_numbits(input, input->files[i], marker) < numbits)
           THROW("argh, a bug in caching of some sort!");
       }
     }
@@ -316,11 +394,15 @@ void make_write_cache(vw& all, string &newname, bool quiet)
   }
 
   size_t v_length = (uint64_t)version.to_string().length()+1;
+  // the block format keeps indices in 32 bits
+  char marker = all.num_bits <= 32 ? block_cache_marker : cache_marker;
 
   output->write_file(f, &v_length, sizeof(v_length));
   output->write_file(f,version.to_string().c_str(),v_length);
-  output->write_file(f,"c",1);
+  output->write_file(f,&marker,1);
   output->write_file(f, &all.num_bits, sizeof(all.num_bits));
+  if (marker == block_cache_marker)
+    all.p->cache_out = new_block_writer();
 
   push_many(output->finalname,newname.c_str(),newname.length()+1);
   all.p->write_cache = true;
@@ -338,6 +420,7 @@ void parse_cache(vw& all, po::variables_map &vm, string source,
 
   all.p->write_cache = false;
 
+  bool read_cache = false;
   for (size_t i = 0; i < caches.size(); i++)
   { int f = -1;
     if (!vm.count("kill_cache"))
@@ -348,7 +431,8 @@ void parse_cache(vw& all, po::variables_map &vm, string source,
     if (f == -1)
       make_write_cache(all, caches[i], quiet);
     else
-    { uint64_t c = cache_numbits(all.p->input, f);
+    { char marker;
+      uint64_t c = cache_numbits(all.p->input, f, marker);
       if (c < all.num_bits)
       { if (!quiet)
 		  all.trace_message << "WARNING: cache file is ignored as it's made with less bit precision than required!" << endl;
@@ -358,15 +442,23 @@ void parse_cache(vw& all, po::variables_map &vm, string source,
       else
       { if (!quiet)
           all.trace_message << "using cache_file = " << caches[i].c_str() << endl;
-        all.p->reader = read_cached_features;
+        if (i > 0 && (all.p->reader == read_block_cached_features) != (marker == block_cache_marker))
+          THROW("cache files " << caches[0] << " and " << caches[i] << " are in different formats, convert one with --convert_cache");
+        use_cache_reader(all, marker);
         if (c == all.num_bits)
           all.p->sorted_cache = true;
         else
           all.p->sorted_cache = false;
         all.p->resettable = true;
+        read_cache = true;
       }
     }
   }
+  // one converted cache gets the examples of every cache read
+  if (read_cache && vm.count("convert_cache"))
+  { string converted = vm["convert_cache"].as<string>();
+    make_write_cache(all, converted, quiet);
+  }
 
   all.parse_mask = ((uint64_t)1 << all.num_bits) - 1;
   if (caches.size() == 0)
@@ -422,7 +514,7 @@ void enable_sources(vw& all, bool quiet, size_t passes)
       THROWERRNO("bind");
 
     // listen on socket
-    if (listen(all.p->bound_sock, 1) < 0)
+    if (listen(all.p->bound_sock, all.vm.count("serve") ? SOMAXCONN : 1) < 0)
       THROWERRNO("listen");
 
     // write port file
@@ -458,6 +550,9 @@ void enable_sources(vw& all, bool quiet, size_t passes)
       pid_file.close();
     }
 
+    if (all.vm.count("serve")) // SERVE::serve() accepts the clients
+      return;
+
     if (all.daemon && !all.active)
     {
 #ifdef _WIN32
@@ -465,7 +560,10 @@ void enable_sources(vw& all, bool quiet, size_t passes)
 #else
       fclose(stdin);
       // weights will be shared across processes, accessible to children
-      all.weights.share(all.length());
+      string report;
+      all.weights.share(all.length(), report);
+      if (!all.quiet && (all.weight_pages.huge != huge_none || all.weight_pages.numa != numa_none))
+        all.trace_message << "shared weight array: " << report << endl;
 
       // learning state to be shared across children
       shared_data* sd = (shared_data *)mmap(0,sizeof(shared_data),
@@ -615,9 +713,7 @@ child:
 
 void set_done(vw& all)
 { all.early_terminate = true;
-  mutex_lock(&all.p->examples_lock);
-  all.p->done = true;
-  mutex_unlock(&all.p->examples_lock);
+  mark_parser_done(all.p);
 }
 
 void addgrams(vw& all, size_t ngram, size_t skip_gram, features& fs,
@@ -660,14 +756,14 @@ void addgrams(vw& all, size_t ngram, size_t skip_gram, features& fs,
  * Hash is evaluated using the principle h(a, b) = h(a)*X + h(b), where X is a random no.
  * 32 random nos. are maintained in an array and are used in the hashing.
  */
-void generateGrams(vw& all, example* &ex)
+void generateGrams(vw& all, example* &ex, v_array<size_t>& gram_mask)
 { for(namespace_index index : ex->indices)
   { size_t length = ex->feature_space[index].size();
     for (size_t n = 1; n < all.ngram[index]; n++)
-    { all.p->gram_mask.erase();
-      all.p->gram_mask.push_back((size_t)0);
+    { gram_mask.erase();
+      gram_mask.push_back((size_t)0);
       addgrams(all, n, all.skips[index], ex->feature_space[index],
-               length, all.p->gram_mask, 0);
+               length, gram_mask, 0);
     }
   }
 }
@@ -687,51 +783,24 @@ void feature_limit(vw& all, example* ex)
     }
 }
 
-namespace VW
-{
-example& get_unused_example(vw* all)
-{ parser* p = all->p;
-  while (true)
-  { mutex_lock(&p->examples_lock);
-    if (p->examples[p->begin_parsed_examples % p->ring_size].in_use == false)
-    { example& ret = p->examples[p->begin_parsed_examples++ % p->ring_size];
-      ret.in_use = true;
-      mutex_unlock(&p->examples_lock);
-      return ret;
-    }
-    else
-      condition_variable_wait(&p->example_unused, &p->examples_lock);
-    mutex_unlock(&p->examples_lock);
-  }
-}
-
-void setup_examples(vw& all, v_array<example*>& examples)
-{ for (example* ae : examples)
-    setup_example(all, ae);
-}
-
-void setup_example(vw& all, example* ae)
-{ if (all.p->sort_features && ae->sorted == false)
-    unique_sort_features(all.parse_mask, ae);
-
-  if (all.p->write_cache)
-  { all.p->lp.cache_label(&ae->l, *(all.p->output));
-    cache_features(*(all.p->output), ae, all.parse_mask);
-  }
-
-  ae->partial_prediction = 0.;
-  ae->num_features = 0;
-  ae->total_sum_feat_sq = 0;
-  ae->loss = 0.;
-
-  ae->example_counter = (size_t)(all.p->end_parsed_examples);
+// the part of setup_example that depends on where the example sits in the input
+void setup_example_sequence(vw& all, example* ae, bool newline)
+{ ae->example_counter = (size_t)(all.p->end_parsed_examples);
   if (!all.p->emptylines_separate_examples)
     all.p->in_pass_counter++;
 
   ae->test_only = is_test_only(all.p->in_pass_counter, all.holdout_period, all.holdout_after, all.holdout_set_off, all.p->emptylines_separate_examples ? (all.holdout_period-1) : 0);
 
-  if (all.p->emptylines_separate_examples && example_is_newline(*ae))
+  if (all.p->emptylines_separate_examples && newline)
     all.p->in_pass_counter++;
+}
+
+// the part of setup_example that only touches the example itself, so parse workers can run it
+void setup_example_features(vw& all, example* ae, v_array<size_t>& gram_mask)
+{ ae->partial_prediction = 0.;
+  ae->num_features = 0;
+  ae->total_sum_feat_sq = 0;
+  ae->loss = 0.;
 
   ae->weight = all.p->lp.get_weight(&ae->l);
 
@@ -746,7 +815,7 @@ void setup_example(vw& all, example* ae)
       }
 
   if(all.ngram_strings.size() > 0)
-    generateGrams(all, ae);
+    generateGrams(all, ae, gram_mask);
 
   if (all.add_constant)//add constant feature
     VW::add_constant_feature(all,ae);
@@ -773,6 +842,37 @@ void setup_example(vw& all, example* ae)
   ae->num_features += new_features_cnt;
   ae->total_sum_feat_sq += new_features_sum_feat_sq;
 }
+
+namespace VW
+{
+example& get_unused_example(vw* all)
+{ parser* p = all->p;
+  size_t ring_index = p->begin_parsed_examples % p->ring_size;
+  std::atomic<uint64_t>& seq = p->ring_seq[ring_index];
+
+  ring_wait(p, p->parked_producers, &p->example_unused, [&]() { return seq.load() == 0; });
+
+  seq.store(++p->begin_parsed_examples);
+  example& ret = p->examples[ring_index];
+  ret.in_use = true;
+  return ret;
+}
+
+void setup_examples(vw& all, v_array<example*>& examples)
+{ for (example* ae : examples)
+    setup_example(all, ae);
+}
+
+void setup_example(vw& all, example* ae)
+{ if (all.p->sort_features && ae->sorted == false)
+    unique_sort_features(all.parse_mask, ae);
+
+  if (all.p->write_cache)
+    cache_example(all, ae);
+
+  setup_example_sequence(all, ae, example_is_newline(*ae));
+  setup_example_features(all, ae, all.p->gram_mask);
+}
 }
 
 namespace VW
@@ -883,23 +983,122 @@ void finish_example(vw& all, example* ec)
   if (!is_ring_example(all, ec))
     return;
 
-  mutex_lock(&all.p->output_lock);
   all.p->local_example_number++;
-  condition_variable_signal(&all.p->output_done);
-  mutex_unlock(&all.p->output_lock);
+  if (all.daemon) // reset_source waits for every prediction to be sent back before closing the socket
+  { mutex_lock(&all.p->output_lock);
+    condition_variable_signal(&all.p->output_done);
+    mutex_unlock(&all.p->output_lock);
+  }
 
   empty_example(all, *ec);
 
-  mutex_lock(&all.p->examples_lock);
   assert(ec->in_use);
   ec->in_use = false;
-  condition_variable_signal(&all.p->example_unused);
+  all.p->ring_seq[ec - all.p->examples].store(0);
+  wake_parked(all.p, all.p->parked_producers, &all.p->example_unused);
   if (all.p->done)
-    condition_variable_signal_all(&all.p->example_available);
-  mutex_unlock(&all.p->examples_lock);
+    wake_parked(all.p, all.p->parked_consumers, &all.p->example_available);
 }
 }
 
+// --parse_threads: the parse thread reads lines and parses their labels (label parsers share state and
+// must see the input in order), workers parse the namespaces, and the parse thread releases the
+// examples to the learner in input order.
+
+// reads the next line into a task; returns what the reader would have returned
+int dispatch_task(vw& all, example* ae)
+{ parser* p = all.p;
+  char* line;
+  size_t num_chars;
+  size_t num_chars_initial = read_features(&all, line, num_chars);
+  if (num_chars_initial < 1)
+    return (int)num_chars_initial;
+
+  parse_task& t = p->tasks[p->tasks_dispatched % p->max_tasks];
+  t.line.erase();
+  push_many(t.line, line, num_chars);
+  // the parsers peek one character past the end of the line, and parseFloat reads the last value
+  // differently after '\n' than after '\0', so keep what ended the line. read_features strips
+  // 1 or 2 characters of line ending and 3 of byte order mark.
+  size_t stripped = num_chars_initial - num_chars;
+  t.line.push_back(stripped % 3 != 0 ? line[num_chars] : '\0');
+  substring example = { t.line.begin(), t.line.begin() + num_chars };
+  t.features.begin = substring_to_label(&all, ae, example);
+  t.features.end = example.end;
+  t.ex = ae;
+
+  p->tasks_dispatched++;
+  wake_parked(p, p->parked_workers, &p->task_available);
+  return (int)num_chars_initial;
+}
+
+// hands finished tasks to the learner in input order, waiting while more than max_in_flight are outstanding
+void release_tasks(vw& all, uint64_t max_in_flight)
+{ parser* p = all.p;
+  while (p->tasks_released < p->tasks_dispatched.load())
+  { uint64_t seq = p->tasks_released;
+    parse_task& t = p->tasks[seq % p->max_tasks];
+    if (t.finished.load() != seq + 1)
+    { if (p->tasks_dispatched.load() - seq <= max_in_flight)
+        return;
+      ring_wait(p, p->parked_splitter, &p->task_finished, [&]() { return t.finished.load() == seq + 1 || p->done.load(); });
+      if (t.finished.load() != seq + 1)
+        return;
+    }
+
+    example* ae = t.ex;
+    if (p->write_cache)
+      cache_example(all, ae);
+    setup_example_sequence(all, ae, t.newline);
+    if (p->write_cache)
+      setup_example_features(all, ae, p->gram_mask);
+
+    p->tasks_released++;
+    p->end_parsed_examples++;
+    wake_parked(p, p->parked_consumers, &p->example_available);
+  }
+}
+
+#ifdef _WIN32
+DWORD WINAPI parse_worker_loop(LPVOID in)
+#else
+void *parse_worker_loop(void *in)
+#endif
+{ vw* all = (vw*)in;
+  parser* p = all->p;
+  v_array<size_t> gram_mask = v_init<size_t>();
+
+  while (true)
+  { uint64_t seq = p->tasks_claimed++;
+    ring_wait(p, p->parked_workers, &p->task_available, [&]() { return p->tasks_dispatched.load() > seq || p->done.load(); });
+    if (p->tasks_dispatched.load() <= seq)
+      break;
+
+    parse_task& t = p->tasks[seq % p->max_tasks];
+    try
+    { substring_to_features(all, t.ex, t.features.begin, t.features.end);
+      if (p->sort_features && t.ex->sorted == false)
+        unique_sort_features(all->parse_mask, t.ex);
+      t.newline = example_is_newline(*t.ex);
+      if (!p->write_cache) // otherwise the cache gets the features as parsed, so this waits for the release
+        setup_example_features(*all, t.ex, gram_mask);
+    }
+    catch (VW::vw_exception& e)
+    { cerr << "vw example #" << seq << "(" << e.Filename() << ":" << e.LineNumber() << "): " << e.what() << endl;
+      mark_parser_done(p);
+    }
+    catch (exception& e)
+    { cerr << "vw: example #" << seq << e.what() << endl;
+      mark_parser_done(p);
+    }
+    t.finished = seq + 1;
+    wake_parked(p, p->parked_splitter, &p->task_finished);
+  }
+
+  gram_mask.delete_v();
+  return 0L;
+}
+
 #ifdef _WIN32
 DWORD WINAPI main_parse_loop(LPVOID in)
 #else
@@ -912,15 +1111,27 @@ void *main_parse_loop(void *in)
   try {
     size_t examples_available;
     while(!all->p->done)
-    { examples.push_back(&VW::get_unused_example(all)); // need at least 1 example
+    { bool finished = false;
+      // after the first pass the reader may switch to the cache, which is read here as before
+      bool split = all->p->parse_threads > 0 && all->p->reader == read_features_string;
+      if (split)
+        release_tasks(*all, all->p->max_tasks - 1);
+      examples.push_back(&VW::get_unused_example(all)); // need at least 1 example
       if (!all->do_reset_source && example_number != all->pass_length && all->max_examples > example_number
-          && all->p->reader(all, examples) > 0)
-      { VW::setup_examples(*all, examples);
+          && (split ? dispatch_task(*all, examples[0]) : all->p->reader(all, examples)) > 0)
+      { if (split) // published by release_tasks
+        { example_number++;
+          examples.erase();
+          continue;
+        }
+        VW::setup_examples(*all, examples);
         example_number+=examples.size();
         examples_available=examples.size();
       }
       else
-      { reset_source(*all, all->num_bits);
+      { if (split)
+          release_tasks(*all, 0);
+        reset_source(*all, all->num_bits);
         all->do_reset_source = false;
         all->passes_complete++;
     
@@ -930,17 +1141,15 @@ void *main_parse_loop(void *in)
           all->pass_length = all->pass_length*2+1;
         }
         if (all->passes_complete >= all->numpasses && all->max_examples >= example_number)
-        { mutex_lock(&all->p->examples_lock);
-          all->p->done = true;
-          mutex_unlock(&all->p->examples_lock);
-        }
+          finished = true;
         example_number = 0;
         examples_available=1;
       }
-      mutex_lock(&all->p->examples_lock);
+      // publish before marking done so the learner never sees done ahead of the last examples
       all->p->end_parsed_examples+=examples_available;
-      condition_variable_signal_all(&all->p->example_available);
-      mutex_unlock(&all->p->examples_lock);
+      wake_parked(all->p, all->p->parked_consumers, &all->p->example_available);
+      if (finished)
+        mark_parser_done(all->p);
       examples.erase();
     }
   }
@@ -951,11 +1160,7 @@ void *main_parse_loop(void *in)
   { cerr << "vw: example #" << example_number << e.what() << endl;
   }
 
-  if (!all->p->done)
-  { mutex_lock(&all->p->examples_lock);
-	all->p->done = true;
-	mutex_unlock(&all->p->examples_lock);
-  }
+  mark_parser_done(all->p);
 
   examples.delete_v();
   return 0L;
@@ -964,29 +1169,46 @@ void *main_parse_loop(void *in)
 namespace VW
 {
 example* get_example(parser* p)
-{ mutex_lock(&p->examples_lock);
-  if (p->end_parsed_examples != p->used_index)
-  { size_t ring_index = p->used_index++ % p->ring_size;
-    if (!(p->examples+ring_index)->in_use)
-      cout << "error: example should be in_use " << p->used_index << " " << p->end_parsed_examples << " " << ring_index << endl;
-    assert((p->examples+ring_index)->in_use);
-    mutex_unlock(&p->examples_lock);
-
-    return p->examples + ring_index;
-  }
-  else
-  { if (!p->done)
-    { condition_variable_wait(&p->example_available, &p->examples_lock);
-      mutex_unlock(&p->examples_lock);
-      return get_example(p);
+{ for (size_t spin = 0; ; spin++)
+  { // read done first: everything published before it was set is then visible below
+    bool done = p->done.load();
+    uint64_t used = p->used_index.load();
+    if (used != p->end_parsed_examples.load())
+    { if (!p->used_index.compare_exchange_weak(used, used + 1))
+        continue; // another consumer took it
+      size_t ring_index = used % p->ring_size;
+      if (p->ring_seq[ring_index].load() != used + 1)
+        cout << "error: example should be in_use " << used + 1 << " " << p->end_parsed_examples << " " << ring_index << endl;
+      assert((p->examples+ring_index)->in_use);
+
+      return p->examples + ring_index;
     }
-    else
-    { mutex_unlock(&p->examples_lock);
+    else if (done)
       return nullptr;
+    else if (spin < p->ring_spin)
+      ring_relax();
+    else
+    { mutex_lock(&p->examples_lock);
+      p->parked_consumers++;
+      while (!p->done && p->used_index.load() == p->end_parsed_examples.load())
+        condition_variable_wait(&p->example_available, &p->examples_lock);
+      p->parked_consumers--;
+      mutex_unlock(&p->examples_lock);
+      spin = 0;
     }
   }
 }
 
+example* try_get_example(parser* p)
+{ for (;;)
+  { uint64_t used = p->used_index.load();
+    if (used == p->end_parsed_examples.load())
+      return nullptr;
+    if (p->used_index.compare_exchange_weak(used, used + 1))
+      return p->examples + used % p->ring_size;
+  }
+}
+
 float get_topic_prediction(example* ec, size_t i)
 { return ec->pred.scalars[i]; }
 
@@ -1039,10 +1261,18 @@ void initialize_examples(vw& all)
   all.p->done = false;
 
   all.p->examples = calloc_or_throw<example>(all.p->ring_size);
+  all.p->ring_seq = new std::atomic<uint64_t>[all.p->ring_size];
 
   for (size_t i = 0; i < all.p->ring_size; i++)
   { memset(&all.p->examples[i].l, 0, sizeof(polylabel));
     all.p->examples[i].in_use = false;
+    all.p->ring_seq[i] = 0;
+  }
+
+  if (all.p->parse_threads > 0)
+  { all.p->max_tasks = max(all.p->ring_size / 2, (size_t)1);
+    all.p->tasks = calloc_or_throw<parse_task>(all.p->max_tasks);
+    all.p->tasks_released = 0;
   }
 }
 
@@ -1057,6 +1287,8 @@ void initialize_parser_datastructures(vw& all)
   initialize_condition_variable(&all.p->example_unused);
   initialize_mutex(&all.p->output_lock);
   initialize_condition_variable(&all.p->output_done);
+  initialize_condition_variable(&all.p->task_available);
+  initialize_condition_variable(&all.p->task_finished);
 }
 
 namespace VW
@@ -1068,6 +1300,16 @@ void start_parser(vw& all)
 #else
   all.parse_thread = ::CreateThread(nullptr, 0, static_cast<LPTHREAD_START_ROUTINE>(main_parse_loop), &all, 0L, nullptr);
 #endif
+  for (size_t i = 0; i < all.p->parse_threads; i++)
+  {
+#ifndef _WIN32
+    pthread_t worker;
+    pthread_create(&worker, nullptr, parse_worker_loop, &all);
+#else
+    HANDLE worker = ::CreateThread(nullptr, 0, static_cast<LPTHREAD_START_ROUTINE>(parse_worker_loop), &all, 0L, nullptr);
+#endif
+    all.p->workers.push_back(worker);
+  }
 }
 }
 void free_parser(vw& all)
@@ -1083,8 +1325,21 @@ void free_parser(vw& all)
       VW::dealloc_example(all.p->lp.delete_label, all.p->examples[i], all.delete_prediction);
 
     free(all.p->examples);
+    delete[] all.p->ring_seq;
   }
 
+  if (all.p->cache_in != nullptr)
+    free_block_reader(all.p->cache_in);
+  if (all.p->cache_out != nullptr)
+    free_block_writer(all.p->cache_out);
+
+  if (all.p->tasks != nullptr)
+  { for (size_t i = 0; i < all.p->max_tasks; i++)
+      all.p->tasks[i].line.delete_v();
+    free(all.p->tasks);
+  }
+  all.p->workers.delete_v();
+
   io_buf* output = all.p->output;
   if (output != nullptr)
   { output->finalname.delete_v();
@@ -1109,6 +1364,15 @@ void end_parser(vw& all)
   ::WaitForSingleObject(all.parse_thread, INFINITE);
   ::CloseHandle(all.parse_thread);
 #endif
+  for (auto worker : all.p->workers)
+  {
+#ifndef _WIN32
+    pthread_join(worker, nullptr);
+#else
+    ::WaitForSingleObject(worker, INFINITE);
+    ::CloseHandle(worker);
+#endif
+  }
   release_parser_datastructures(all);
 }
 
@@ -4,6 +4,7 @@ individual contributors. All rights reserved.  Released under a BSD
 license as described in the file LICENSE.
  */
 #pragma once
+#include <atomic>
 #include "io_buf.h"
 #include "parse_primitives.h"
 #include "example.h"
@@ -12,6 +13,18 @@ license as described in the file LICENSE.
 namespace po = boost::program_options;
 
 struct vw;
+struct block_reader;
+struct block_writer;
+
+// a line of text input on its way through --parse_threads: the parse thread copies the line and
+// parses its label, a worker parses the namespaces, and the parse thread releases it in order.
+struct parse_task
+{ v_array<char> line; // private copy, the io_buf space is reused when it refills
+  substring features; // the namespaces, inside line
+  example* ex;
+  bool newline; // example_is_newline before setup, needed for the holdout counters
+  std::atomic<uint64_t> finished; // 1 + sequence number of the task once a worker is done with it
+};
 
 struct parser
 { v_array<substring> channels;//helper(s) for text parsing
@@ -26,24 +39,49 @@ struct parser
   bool write_cache;
   bool sort_features;
   bool sorted_cache;
+  block_reader* cache_in; // while reading a block cache
+  block_writer* cache_out; // while writing a block cache
 
   size_t ring_size;
   uint64_t begin_parsed_examples; // The index of the beginning parsed example.
-  uint64_t end_parsed_examples; // The index of the fully parsed example.
-  uint64_t local_example_number;
+  std::atomic<uint64_t> end_parsed_examples; // The index of the fully parsed example.
+  std::atomic<uint64_t> local_example_number;
   uint32_t in_pass_counter;
   example* examples;
-  uint64_t used_index;
+  std::atomic<uint64_t>* ring_seq; // per slot: 1 + index of the example held, or 0 if the slot is free
+  std::atomic<uint64_t> used_index;
   bool emptylines_separate_examples; // true if you want to have holdout computed on a per-block basis rather than a per-line basis
+
+  // the ring is handed between threads without locks; these are only taken to park a thread
+  // after it has spun ring_spin times without progress.
+  size_t ring_spin;
+  std::atomic<size_t> parked_producers;
+  std::atomic<size_t> parked_consumers;
   MUTEX examples_lock;
   CV example_available;
   CV example_unused;
   MUTEX output_lock;
   CV output_done;
 
-  bool done;
+  std::atomic<bool> done;
   v_array<size_t> gram_mask;
 
+  size_t parse_threads; // workers tokenizing and hashing text input, 0 to do it on the parse thread
+  parse_task* tasks; // circular, indexed by sequence number
+  size_t max_tasks; // lines in flight; kept below ring_size so the ring can never fill with unreleased examples
+  std::atomic<uint64_t> tasks_dispatched;
+  std::atomic<uint64_t> tasks_claimed;
+  uint64_t tasks_released;
+  std::atomic<size_t> parked_workers;
+  std::atomic<size_t> parked_splitter;
+  CV task_available;
+  CV task_finished;
+#ifndef _WIN32
+  v_array<pthread_t> workers;
+#else
+  v_array<HANDLE> workers;
+#endif
+
   v_array<size_t> ids; //unique ids for sources
   v_array<size_t> counts; //partial examples received from sources
   size_t finished_count;//the number of finished examples;
@@ -63,6 +101,8 @@ struct parser
 parser* new_parser();
 
 void enable_sources(vw& all, bool quiet, size_t passes);
+// the part of setup_example that only touches the example, safe to run on several threads at once
+void setup_example_features(vw& all, example* ae, v_array<size_t>& gram_mask);
 
 bool examples_to_finish();
 
@@ -80,5 +120,7 @@ bool inconsistent_cache(size_t numbits, io_buf& cache);
 void reset_source(vw& all, size_t numbits);
 void finalize_source(parser* source);
 void set_compressed(parser* par);
+void set_mmap(parser* par);
+void set_prefetch(parser* par);
 void initialize_examples(vw& all);
 void free_parser(vw& all);
@@ -0,0 +1,215 @@
+/*
+Copyright (c) by respective owners including Yahoo!, Microsoft, and
+individual contributors. All rights reserved.  Released under a BSD (revised)
+license as described in the file LICENSE.
+ */
+#ifndef _WIN32
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+#include <algorithm>
+#include "prefetch_io.h"
+
+prefetch_io_buf::prefetch_io_buf()
+{ for (size_t i = 0; i < chunk_count; i++)
+  { chunks[i].fd = -1;
+    chunks[i].data = v_init<char>();
+    chunks[i].used = 0;
+    chunks[i].eof = false;
+  }
+  first = 0;
+  ready = 0;
+  plan = v_init<source>();
+  next_source = 0;
+  next_offset = 0;
+  generation = 0;
+  cursor_fd = -1;
+  cursor_offset = 0;
+  cursor_source = 0;
+  stopping = false;
+  reader = nullptr;
+}
+
+prefetch_io_buf::~prefetch_io_buf()
+{ if (reader != nullptr)
+  { { std::lock_guard<std::mutex> l(lock);
+      stopping = true;
+    }
+    freed.notify_all();
+    reader->join();
+    delete reader;
+  }
+  for (size_t i = 0; i < chunk_count; i++)
+    chunks[i].data.delete_v();
+  plan.delete_v();
+}
+
+int prefetch_io_buf::open_file(const char* name, bool stdin_off, int flag)
+{ int f = io_buf::open_file(name, stdin_off, flag);
+  if (f != -1)
+  { std::lock_guard<std::mutex> l(lock);
+    stop(); // descriptors get reused
+    regular.erase(f);
+    offsets[f] = 0;
+  }
+  return f;
+}
+
+void prefetch_io_buf::reset_file(int f)
+{ io_buf::reset_file(f);
+  std::lock_guard<std::mutex> l(lock);
+  offsets[f] = 0;
+  // another pass is about to start: get its first chunk going
+  if (files.size() > 0 && f == files[0] && is_regular(f) && (cursor_fd != f || cursor_offset != 0))
+    restart(f, 0);
+}
+
+ssize_t prefetch_io_buf::read_file(int f, void* buf, size_t nbytes)
+{ std::unique_lock<std::mutex> l(lock);
+  if (!is_regular(f))
+  { l.unlock();
+    return io_buf::read_file(f, buf, nbytes);
+  }
+
+  size_t& offset = offsets[f];
+  if (cursor_fd != f || cursor_offset != offset)
+    restart(f, offset);
+
+  char* out = (char*)buf;
+  size_t total = 0;
+  while (total < nbytes)
+  { // only wait for the first bytes, fill takes whatever is there
+    if (ready == 0 && total > 0)
+      break;
+    loaded.wait(l, [this] { return ready > 0; });
+
+    chunk& c = chunks[first];
+    if (c.eof)
+    { if (total == 0) // done with f, the ring carries on with the next file
+      { first = (first + 1) % chunk_count;
+        ready--;
+        freed.notify_one();
+        if (++cursor_source < plan.size())
+        { cursor_fd = plan[cursor_source].fd;
+          cursor_offset = plan[cursor_source].offset;
+        }
+        else
+          cursor_fd = -1;
+      }
+      break;
+    }
+
+    size_t n = std::min(nbytes - total, c.data.size() - c.used);
+    memcpy(out + total, c.data.begin() + c.used, n);
+    c.used += n;
+    total += n;
+    if (c.used == c.data.size())
+    { first = (first + 1) % chunk_count;
+      ready--;
+      freed.notify_one();
+    }
+  }
+  offset += total;
+  if (cursor_fd == f)
+    cursor_offset += total;
+  return total;
+}
+
+// the descriptor is ahead of what was read by as much as is prefetched
+int64_t prefetch_io_buf::file_offset() { return -1; }
+
+bool prefetch_io_buf::close_file()
+{ if (files.size() > 0)
+  { std::lock_guard<std::mutex> l(lock);
+    stop();
+    regular.erase(files.last());
+    offsets.erase(files.last());
+  }
+  return io_buf::close_file();
+}
+
+bool prefetch_io_buf::is_regular(int f)
+{ std::map<int, bool>::iterator r = regular.find(f);
+  if (r == regular.end())
+  { bool reg = false;
+#ifndef _WIN32
+    struct stat st;
+    reg = fstat(f, &st) == 0 && S_ISREG(st.st_mode);
+#endif
+    r = regular.insert(std::make_pair(f, reg)).first;
+  }
+  return r->second;
+}
+
+void prefetch_io_buf::restart(int f, size_t offset)
+{ stop();
+
+  source s = { f, offset };
+  plan.push_back(s);
+  size_t i = 0;
+  while (i < files.size() && files[i] != f)
+    i++;
+  for (i++; i < files.size(); i++)
+    if (is_regular(files[i]))
+    { source t = { files[i], offsets[files[i]] };
+      plan.push_back(t);
+    }
+
+  next_offset = offset;
+  cursor_fd = f;
+  cursor_offset = offset;
+
+  if (reader == nullptr)
+  { for (size_t j = 0; j < chunk_count; j++)
+      chunks[j].data.resize(chunk_size);
+    reader = new std::thread(&prefetch_io_buf::read_ahead, this);
+  }
+  freed.notify_one();
+}
+
+void prefetch_io_buf::stop()
+{ generation++;
+  first = 0;
+  ready = 0;
+  plan.erase();
+  next_source = 0;
+  cursor_fd = -1;
+  cursor_source = 0;
+}
+
+void prefetch_io_buf::read_ahead()
+{ std::unique_lock<std::mutex> l(lock);
+  while (true)
+  { freed.wait(l, [this] { return stopping || (ready < chunk_count && next_source < plan.size()); });
+    if (stopping)
+      return;
+
+    // the slot after the loaded ones isn't touched by the consumer, so fill it unlocked
+    uint64_t g = generation;
+    chunk& c = chunks[(first + ready) % chunk_count];
+    int fd = plan[next_source].fd;
+    size_t offset = next_offset;
+    l.unlock();
+#ifdef _WIN32
+    ssize_t n = -1;
+#else
+    ssize_t n = pread(fd, c.data.begin(), chunk_size, offset);
+#endif
+    l.lock();
+    if (g != generation) // restarted meanwhile
+      continue;
+
+    c.fd = fd;
+    c.used = 0;
+    c.eof = n <= 0;
+    c.data.end() = c.data.begin() + (n > 0 ? n : 0);
+    if (c.eof)
+    { if (++next_source < plan.size())
+        next_offset = plan[next_source].offset;
+    }
+    else
+      next_offset += n;
+    ready++;
+    loaded.notify_one();
+  }
+}
@@ -0,0 +1,75 @@
+/*
+Copyright (c) by respective owners including Yahoo!, Microsoft, and
+individual contributors. All rights reserved.  Released under a BSD
+license as described in the file LICENSE.
+ */
+#pragma once
+#include <map>
+#include <mutex>
+#include <thread>
+#include <condition_variable>
+#include "io_buf.h"
+
+// An io_buf that reads regular files ahead on a background thread.  The reader fills a ring of
+// chunks with pread, following files in order from the one being read, so the next chunk, and
+// the next file once this one runs out, is usually loaded while the parser decodes the current
+// one.  Reading anywhere other than where the ring left off restarts it there.  Pipes, sockets
+// and stdin go through the usual read().
+class prefetch_io_buf : public io_buf
+{
+public:
+  static const size_t chunk_count = 3;
+  static const size_t chunk_size = 1 << 20;
+
+  struct chunk
+  { int fd;
+    v_array<char> data;
+    size_t used; // bytes handed out so far
+    bool eof; // marks the end of fd, data is empty
+  };
+  chunk chunks[chunk_count];
+  size_t first; // the chunk read from next
+  size_t ready; // chunks loaded, starting at first
+
+  struct source
+  { int fd;
+    size_t offset;
+  };
+  v_array<source> plan; // what the reader loads, in order
+  size_t next_source; // the reader's position in plan
+  size_t next_offset; // and in that file
+  uint64_t generation; // bumped whenever the ring is restarted, so stale reads are dropped
+
+  int cursor_fd; // where the data at the front of the ring continues from; -1 when stopped
+  size_t cursor_offset;
+  size_t cursor_source; // the entry of plan the front of the ring belongs to
+  std::map<int, size_t> offsets; // bytes handed out so far, per file
+  std::map<int, bool> regular; // whether a file can be read ahead
+
+  bool stopping;
+  std::mutex lock;
+  std::condition_variable loaded; // the reader filled a chunk
+  std::condition_variable freed; // a chunk was used up, or the ring was restarted
+  std::thread* reader;
+
+  prefetch_io_buf();
+
+  virtual ~prefetch_io_buf();
+
+  virtual int open_file(const char* name, bool stdin_off, int flag = READ);
+
+  virtual void reset_file(int f);
+
+  virtual ssize_t read_file(int f, void* buf, size_t nbytes);
+
+  virtual int64_t file_offset();
+
+  virtual bool close_file();
+
+  void read_ahead(); // the reader thread
+
+  // the rest are called with lock held
+  bool is_regular(int f);
+  void restart(int f, size_t offset);
+  void stop();
+};
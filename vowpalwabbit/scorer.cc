@@ -20,6 +20,39 @@ void predict_or_learn(scorer& s, LEARNER::base_learner& base, example& ec)
   ec.pred.scalar = link(ec.pred.scalar);
 }
 
+// a batch goes down in one call when its labels leave the label range as it was, since the range
+// clips predictions; otherwise its examples go one at a time, each seeing the labels before it
+template <bool is_learn, float (*link)(float in)>
+void predict_or_learn_batch(scorer& s, LEARNER::base_learner& base, example** ecs, size_t count)
+{ shared_data* sd = s.all->sd;
+  float min_label = sd->min_label, max_label = sd->max_label;
+  bool whole = true;
+  for (size_t c = 0; c < count; c++)
+  { s.all->set_minmax(sd, ecs[c]->l.simple.label);
+    if (is_learn && (ecs[c]->l.simple.label == FLT_MAX || ecs[c]->weight <= 0))
+      whole = false;
+  }
+  if (!whole || sd->min_label != min_label || sd->max_label != max_label)
+  { sd->min_label = min_label;
+    sd->max_label = max_label;
+    for (size_t c = 0; c < count; c++)
+      predict_or_learn<is_learn, link>(s, base, *ecs[c]);
+    return;
+  }
+
+  if (is_learn)
+    base.learn_batch(ecs, count);
+  else
+    base.predict_batch(ecs, count);
+
+  for (size_t c = 0; c < count; c++)
+  { example& ec = *ecs[c];
+    if(ec.weight > 0 && ec.l.simple.label != FLT_MAX)
+      ec.loss = s.all->loss->getLoss(s.all->sd, ec.pred.scalar, ec.l.simple.label) * ec.weight;
+    ec.pred.scalar = link(ec.pred.scalar);
+  }
+}
+
 template <float (*link)(float in)>
 inline void multipredict(scorer&, LEARNER::base_learner& base, example& ec, size_t count, size_t, polyprediction*pred, bool finalize_predictions)
 { base.multipredict(ec, 0, count, pred, finalize_predictions); // TODO: need to thread step through???
@@ -54,6 +87,8 @@ LEARNER::base_learner* scorer_setup(vw& all)
   LEARNER::base_learner* base = setup_base(all);
   LEARNER::learner<scorer>* l;
   void (*multipredict_f)(scorer&, LEARNER::base_learner&, example&, size_t, size_t, polyprediction*, bool) = multipredict<id>;
+  void (*learn_batch_f)(scorer&, LEARNER::base_learner&, example**, size_t) = predict_or_learn_batch<true, id>;
+  void (*predict_batch_f)(scorer&, LEARNER::base_learner&, example**, size_t) = predict_or_learn_batch<false, id>;
 
   string link = vm["link"].as<string>();
   if (!vm.count("link") || link.compare("identity") == 0)
@@ -63,23 +98,34 @@ LEARNER::base_learner* scorer_setup(vw& all)
     l = &init_learner(&s, base, predict_or_learn<true, logistic>,
                       predict_or_learn<false, logistic>);
     multipredict_f = multipredict<logistic>;
+    learn_batch_f = predict_or_learn_batch<true, logistic>;
+    predict_batch_f = predict_or_learn_batch<false, logistic>;
   }
   else if (link.compare("glf1") == 0)
   { *all.file_options << " --link=glf1 ";
     l = &init_learner(&s, base, predict_or_learn<true, glf1>,
                       predict_or_learn<false, glf1>);
     multipredict_f = multipredict<glf1>;
+    learn_batch_f = predict_or_learn_batch<true, glf1>;
+    predict_batch_f = predict_or_learn_batch<false, glf1>;
   }
   else if (link.compare("poisson") == 0)
   { *all.file_options << " --link=poisson ";
     l = &init_learner(&s, base, predict_or_learn<true, expf>, predict_or_learn<false, expf>);
     multipredict_f = multipredict<expf>;
+    learn_batch_f = predict_or_learn_batch<true, expf>;
+    predict_batch_f = predict_or_learn_batch<false, expf>;
   }
   else
     THROW("Unknown link function: " << link);
 
   l->set_multipredict(multipredict_f);
   l->set_update(update);
+  if (base->batches())
+  { l->set_learn_batch(learn_batch_f);
+    l->set_predict_batch(predict_batch_f);
+  }
+  l->concurrent = base->concurrent;
   all.scorer = make_base(*l);
 
   return all.scorer;
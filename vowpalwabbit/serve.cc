@@ -0,0 +1,651 @@
+/*
+Copyright (c) by respective owners including Yahoo!, Microsoft, and
+individual contributors. All rights reserved.  Released under a BSD (revised)
+license as described in the file LICENSE.
+ */
+#ifdef __linux__
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/signalfd.h>
+#include <sys/inotify.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <signal.h>
+#include <unistd.h>
+#include <fcntl.h>
+#endif
+#include <algorithm>
+#include <iterator>
+#include <chrono>
+#include <deque>
+#include <map>
+#include <unordered_map>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include "parse_example.h"
+#include "parser.h"
+#include "unique_sort.h"
+#include "vw.h"
+#include "vw_exception.h"
+#include "serve.h"
+
+using namespace std;
+
+// --serve: an event loop on the calling thread owns every socket.  It accepts clients, queues their
+// lines in one bounded queue and writes the answers back in the order each client sent its lines.
+// Scoring threads take micro-batches off the queue: a batch goes once it is full, or once its oldest
+// line has waited --serve_latency microseconds, so a lone client is answered right away and a busy
+// server scores the lines of many clients per call down the learner stack.  The model is shared by
+// the threads and never changes: not even the labels of the lines widen the range its predictions
+// are clipped to, which the threads would otherwise write at once.  While the queue is full the loop
+// stops reading, and clients wait in their socket buffers.
+//
+// SIGHUP, or with --serve_watch a new file at the -i path, swaps in a new model without dropping a
+// line: a thread builds it from serve's own command line less the server options, the scoring
+// threads move to it with their next batch, and the old one is finished once its last batch is.
+
+namespace SERVE
+{
+#ifdef __linux__
+typedef chrono::steady_clock steady;
+
+struct request
+{ uint64_t client;
+  uint64_t seq; // of the line, from its client
+  string line;
+  steady::time_point arrived;
+};
+
+struct answer
+{ uint64_t client;
+  uint64_t seq;
+  string text;
+};
+
+// a model and the batches being scored with it
+struct model
+{ vw* all;
+  size_t users; // under server::lock
+};
+
+struct server
+{ size_t batch; // most lines scored together
+  size_t capacity; // most lines queued
+  chrono::microseconds latency; // longest a line waits for its batch to fill
+  label_parser lp; // of the examples the scoring threads keep; every model has to parse the same labels
+  bool quiet;
+
+  mutex lock; // queue, stopping, current, the users of every model and the reload state
+  condition_variable work;
+  deque<request> queue;
+  bool stopping;
+  model* current; // what the next batch is scored with
+  condition_variable drained; // a model that is no longer current lost its last user
+
+  mutex label_lock; // label parsers share scratch space
+  mutex answers_lock;
+  vector<answer> answers; // scored, not yet picked up by the loop
+  int wake; // eventfd the scoring threads signal once they add answers
+
+  vector<string> args; // builds the next model
+  string path; // of the model, "" without -i
+  thread loader;
+  bool loading;
+  bool reload_again; // asked for while loading
+};
+
+struct client
+{ uint64_t id;
+  int fd;
+  string in; // read, but not queued
+  uint64_t next_seq; // for the next line queued
+  uint64_t next_send; // the line whose answer is written next
+  map<uint64_t, string> early; // answers that overtook the ones before them
+  string out; // answers not written yet
+  bool eof;
+  bool failed;
+  bool stalled; // has complete lines waiting for room in the queue
+  bool listed; // in the list of stalled clients
+};
+
+// epoll ids below first_client
+const uint64_t listener_id = 0;
+const uint64_t wake_id = 1;
+const uint64_t signal_id = 2;
+const uint64_t watch_id = 3;
+const uint64_t first_client = 4;
+
+void parse(server& s, vw& all, example& ec, string& line, v_array<size_t>& gram_mask)
+{ VW::empty_example(all, ec);
+  // the line keeps its ending: parseFloat reads the last value differently after '\n' than after '\0'
+  substring text = { &line[0], &line[0] + line.size() };
+  while (text.end > text.begin && (text.end[-1] == '\n' || text.end[-1] == '\r'))
+    text.end--;
+  char* features;
+  { lock_guard<mutex> l(s.label_lock);
+    features = substring_to_label(&all, &ec, text);
+  }
+  substring_to_features(&all, &ec, features, text.end);
+  if (all.p->sort_features && ec.sorted == false)
+    unique_sort_features(all.parse_mask, &ec);
+  setup_example_features(all, &ec, gram_mask);
+  ec.test_only = true;
+}
+
+// the answer print_result would write
+void format(string& text, example& ec)
+{ char temp[30];
+  float res = ec.pred.scalar;
+  if (floorf(res) != res)
+    sprintf(temp, "%f", res);
+  else
+    sprintf(temp, "%.0f", res);
+  stringstream ss;
+  ss << temp;
+  print_tag(ss, ec.tag);
+  ss << '\n';
+  text = ss.str();
+}
+
+void score(server& s)
+{ example* examples = VW::alloc_examples(s.lp.label_size, s.batch);
+  vector<example*> ready;
+  vector<request> taken;
+  vector<answer> done;
+  v_array<size_t> gram_mask = v_init<size_t>();
+
+  while (true)
+  { taken.clear();
+    model* m;
+    { unique_lock<mutex> l(s.lock);
+      s.work.wait(l, [&]() { return s.stopping || !s.queue.empty(); });
+      if (s.queue.empty())
+        break;
+      if (s.queue.size() < s.batch && !s.stopping)
+        s.work.wait_until(l, s.queue.front().arrived + s.latency,
+                          [&]() { return s.stopping || s.queue.size() >= s.batch || s.queue.empty(); });
+      size_t n = min(s.batch, s.queue.size());
+      for (size_t i = 0; i < n; i++)
+      { taken.push_back(move(s.queue.front()));
+        s.queue.pop_front();
+      }
+      m = s.current;
+      m->users++;
+    }
+    vw& all = *m->all;
+
+    ready.clear();
+    done.resize(taken.size());
+    for (size_t i = 0; i < taken.size(); i++)
+    { done[i].client = taken[i].client;
+      done[i].seq = taken[i].seq;
+      try
+      { parse(s, all, examples[i], taken[i].line, gram_mask);
+        ready.push_back(&examples[i]);
+      }
+      catch (exception& e)
+      { done[i].text = string("error: ") + e.what() + '\n';
+      }
+    }
+    all.l->predict_batch(ready.data(), ready.size());
+    for (size_t i = 0; i < taken.size(); i++)
+      if (done[i].text.empty())
+        format(done[i].text, examples[i]);
+
+    { lock_guard<mutex> l(s.lock);
+      if (--m->users == 0 && m != s.current)
+        s.drained.notify_all();
+    }
+    { lock_guard<mutex> l(s.answers_lock);
+      for (answer& a : done)
+        s.answers.push_back(move(a));
+    }
+    uint64_t one = 1;
+    if (write(s.wake, &one, sizeof(one)) < 0 && errno != EAGAIN)
+      cerr << "serve: eventfd: " << strerror(errno) << endl;
+  }
+
+  for (size_t i = 0; i < s.batch; i++)
+    VW::dealloc_example(s.lp.delete_label, examples[i]);
+  free(examples);
+  gram_mask.delete_v();
+}
+
+// the command line of the models swapped in: serve's own, without the options of the server
+vector<string> model_args(int argc, char* argv[])
+{ const char* flags[] = { "--daemon", "--serve", "--foreground", "--serve_watch", "--quiet", "--no_stdin" };
+  const char* valued[] = { "--port", "--port_file", "--pid_file", "--num_children",
+                           "--serve_threads", "--serve_batch", "--serve_latency", "--serve_queue"
+                         };
+  vector<string> args;
+  args.push_back(argv[0]);
+  for (int i = 1; i < argc; i++)
+  { string arg = argv[i];
+    string name = arg.substr(0, arg.find('='));
+    if (find(begin(flags), end(flags), name) != end(flags))
+      continue;
+    if (find(begin(valued), end(valued), name) != end(valued))
+    { if (name == arg) // the value is the next argument
+        i++;
+      continue;
+    }
+    args.push_back(arg);
+  }
+  args.push_back("--quiet");
+  args.push_back("--no_stdin");
+  return args;
+}
+
+// a model that is done with writes no files
+void retire(model* m)
+{ m->all->early_terminate = true;
+  m->all->quiet = true;
+  VW::finish(*m->all);
+  delete m;
+}
+
+void reload(server& s)
+{ while (true)
+  { vw* fresh = nullptr;
+    try
+    { vector<char*> argv;
+      for (string& arg : s.args)
+        argv.push_back(&arg[0]);
+      fresh = VW::initialize((int)argv.size(), argv.data());
+      const char* problem = nullptr;
+      if (fresh->training)
+        problem = "it would learn";
+      else if (!fresh->l->concurrent)
+        problem = "it can not be run on several threads at once";
+      else if (fresh->p->lp.parse_label != s.lp.parse_label || fresh->p->lp.label_size != s.lp.label_size)
+        problem = "its labels differ";
+      if (problem != nullptr)
+      { cerr << "serve: keeping the current model, the one at " << s.path << " can not be served: " << problem << endl;
+        fresh->early_terminate = true;
+        VW::finish(*fresh);
+        fresh = nullptr;
+      }
+    }
+    catch (exception& e)
+    { cerr << "serve: keeping the current model, loading " << s.path << " failed: " << e.what() << endl;
+    }
+
+    if (fresh != nullptr)
+    { fresh->set_minmax = noop_mm;
+      model* next = new model;
+      next->all = fresh;
+      next->users = 0;
+      model* old;
+      { unique_lock<mutex> l(s.lock);
+        old = s.current;
+        s.current = next;
+        s.drained.wait(l, [&]() { return old->users == 0; });
+      }
+      retire(old);
+      if (!s.quiet)
+        cerr << "serve: swapped in the model at " << s.path << endl;
+    }
+
+    lock_guard<mutex> l(s.lock);
+    if (!s.reload_again)
+    { s.loading = false;
+      return;
+    }
+    s.reload_again = false;
+  }
+}
+
+void request_reload(server& s)
+{ if (s.path.empty())
+  { cerr << "serve: no model to reload without -i" << endl;
+    return;
+  }
+  { lock_guard<mutex> l(s.lock);
+    if (s.loading)
+    { s.reload_again = true;
+      return;
+    }
+    s.loading = true;
+  }
+  if (s.loader.joinable()) // done with its last load
+    s.loader.join();
+  s.loader = thread(reload, ref(s));
+}
+
+// queues the complete lines c has sent, and the last one once it has closed; false if the queue filled up first
+bool queue_lines(server& s, client& c)
+{ size_t start = 0;
+  bool grew = false;
+  { lock_guard<mutex> l(s.lock);
+    while (start < c.in.size() && s.queue.size() < s.capacity)
+    { size_t end = c.in.find('\n', start);
+      if (end == string::npos && !c.eof)
+        break;
+      end = end == string::npos ? c.in.size() : end + 1;
+      request r = { c.id, c.next_seq++, c.in.substr(start, end - start), steady::now() };
+      s.queue.push_back(move(r));
+      grew = true;
+      start = end;
+    }
+  }
+  if (grew)
+    s.work.notify_one();
+  c.in.erase(0, start);
+  c.stalled = c.in.find('\n') != string::npos || (c.eof && !c.in.empty());
+  return !c.stalled;
+}
+
+// reads until the socket runs dry, the client closes or the queue fills up
+void read_client(server& s, client& c)
+{ char buffer[1 << 16];
+  while (queue_lines(s, c) && !c.eof)
+  { ssize_t r = recv(c.fd, buffer, sizeof(buffer), 0);
+    if (r > 0)
+      c.in.append(buffer, r);
+    else if (r == 0)
+      c.eof = true;
+    else if (errno == EAGAIN || errno == EWOULDBLOCK)
+      break;
+    else if (errno != EINTR)
+    { c.eof = true;
+      c.failed = true;
+    }
+  }
+}
+
+void write_client(client& c)
+{ size_t sent = 0;
+  while (sent < c.out.size())
+  { ssize_t w = send(c.fd, c.out.data() + sent, c.out.size() - sent, MSG_NOSIGNAL);
+    if (w >= 0)
+      sent += w;
+    else if (errno == EAGAIN || errno == EWOULDBLOCK)
+      break; // EPOLLOUT says when to go on
+    else if (errno != EINTR)
+    { c.failed = true;
+      break;
+    }
+  }
+  c.out.erase(0, sent);
+}
+
+bool finished(client& c)
+{ return c.failed || (c.eof && !c.stalled && c.next_send == c.next_seq && c.out.empty()); }
+
+bool add(int epoll, int fd, uint32_t events, uint64_t id)
+{ epoll_event e;
+  e.events = events;
+  e.data.u64 = id;
+  return epoll_ctl(epoll, EPOLL_CTL_ADD, fd, &e) == 0;
+}
+
+// The listener is level-triggered: a connection accept() can not take for want of descriptors stays
+// queued and keeps it readable, so the loop would spin.  Until a client closes or accept_backoff has
+// passed, the listener is left out of the epoll set.
+const int accept_backoff = 1000; // milliseconds
+
+void listen_to(int epoll, int listener, bool on)
+{ epoll_event e;
+  e.events = on ? EPOLLIN : 0;
+  e.data.u64 = listener_id;
+  if (epoll_ctl(epoll, EPOLL_CTL_MOD, listener, &e) < 0)
+    cerr << "serve: epoll_ctl: " << strerror(errno) << endl;
+}
+
+// stops the scoring threads and waits for them and the model loader, however serve() leaves
+struct stopper
+{ server& s;
+  vector<thread>& scorers;
+
+  void stop()
+  { { lock_guard<mutex> l(s.lock);
+      s.stopping = true;
+    }
+    s.work.notify_all();
+    for (thread& t : scorers)
+      if (t.joinable())
+        t.join();
+    if (s.loader.joinable())
+      s.loader.join();
+  }
+
+  ~stopper() { stop(); }
+};
+
+void serve(vw& all, int argc, char* argv[])
+{ server s;
+  po::variables_map& vm = all.vm;
+  size_t threads = vm.count("serve_threads") ? vm["serve_threads"].as<size_t>() : thread::hardware_concurrency();
+  if (threads == 0)
+    threads = 1;
+  s.batch = max(vm["serve_batch"].as<size_t>(), (size_t)1);
+  s.capacity = max(vm["serve_queue"].as<size_t>(), s.batch);
+  s.latency = chrono::microseconds(vm["serve_latency"].as<size_t>());
+  s.lp = all.p->lp;
+  s.quiet = all.quiet;
+  s.stopping = false;
+  s.current = new model;
+  s.current->all = &all;
+  s.current->users = 0;
+  all.set_minmax = noop_mm;
+  s.args = model_args(argc, argv);
+  if (vm.count("initial_regressor"))
+    s.path = vm["initial_regressor"].as< vector<string> >()[0];
+  s.loading = false;
+  s.reload_again = false;
+
+  // SIGTERM and SIGHUP are read from a signalfd; blocked before the threads start, so none of them takes one
+  sigset_t handled;
+  sigemptyset(&handled);
+  sigaddset(&handled, SIGTERM);
+  sigaddset(&handled, SIGHUP);
+  if (sigprocmask(SIG_BLOCK, &handled, nullptr) < 0)
+    THROWERRNO("sigprocmask");
+  int signals = signalfd(-1, &handled, SFD_NONBLOCK);
+  s.wake = eventfd(0, EFD_NONBLOCK);
+  int epoll = epoll_create1(0);
+  if (signals < 0 || s.wake < 0 || epoll < 0)
+    THROWERRNO("serve");
+
+  int listener = all.p->bound_sock;
+  fcntl(listener, F_SETFL, fcntl(listener, F_GETFL) | O_NONBLOCK);
+  if (!add(epoll, listener, EPOLLIN, listener_id) || !add(epoll, s.wake, EPOLLIN, wake_id) || !add(epoll, signals, EPOLLIN, signal_id))
+    THROWERRNO("epoll_ctl");
+
+  // the directory is watched, as a new model usually arrives by a rename over the old one
+  int watch = -1;
+  string watched;
+  if (vm.count("serve_watch"))
+  { size_t slash = s.path.rfind('/');
+    string directory = slash == string::npos ? "." : s.path.substr(0, max(slash, (size_t)1));
+    watched = slash == string::npos ? s.path : s.path.substr(slash + 1);
+    watch = inotify_init1(IN_NONBLOCK);
+    if (watch < 0 || inotify_add_watch(watch, directory.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO) < 0)
+      THROWERRNO("inotify " << directory);
+    if (!add(epoll, watch, EPOLLIN, watch_id))
+      THROWERRNO("epoll_ctl");
+  }
+
+  if (!s.quiet)
+  { sockaddr_in address;
+    socklen_t size = sizeof(address);
+    if (getsockname(listener, (sockaddr*)&address, &size) == 0)
+      all.trace_message << "serving port " << ntohs(address.sin_port) << " with " << threads << " scoring threads" << endl;
+  }
+
+  vector<thread> scorers;
+  stopper stop_threads = { s, scorers };
+  for (size_t i = 0; i < threads; i++)
+    scorers.push_back(thread(score, ref(s)));
+
+  unordered_map<uint64_t, client> clients;
+  vector<uint64_t> stalled; // clients to read again once the queue has room
+  vector<uint64_t> touched;
+  vector<answer> answers;
+  uint64_t next_id = first_client;
+  uint64_t answered = 0;
+  bool stop = false;
+  bool accepting = true;
+  bool starved = false; // said so, and accepted no client since
+  epoll_event events[256];
+
+  while (!stop)
+  { int n = epoll_wait(epoll, events, 256, accepting ? -1 : accept_backoff);
+    if (n < 0)
+    { if (errno == EINTR)
+        continue;
+      THROWERRNO("epoll_wait");
+    }
+
+    bool closed = n == 0; // a client, freeing a descriptor, or the backoff has passed
+    touched.clear();
+    for (int i = 0; i < n; i++)
+    { uint64_t id = events[i].data.u64;
+      if (id == signal_id)
+      { signalfd_siginfo info; // taken, so it is not delivered once unblocked
+        while (read(signals, &info, sizeof(info)) == sizeof(info))
+          if (info.ssi_signo == SIGHUP)
+            request_reload(s);
+          else
+            stop = true;
+      }
+      else if (id == watch_id)
+      { char buffer[4096] __attribute__ ((aligned(__alignof__(inotify_event))));
+        ssize_t length;
+        bool changed = false;
+        while ((length = read(watch, buffer, sizeof(buffer))) > 0)
+          for (char* p = buffer; p < buffer + length; p += sizeof(inotify_event) + ((inotify_event*)p)->len)
+          { inotify_event* e = (inotify_event*)p;
+            changed |= e->len > 0 && watched == e->name;
+          }
+        if (changed)
+          request_reload(s);
+      }
+      else if (id == listener_id)
+      { int fd;
+        while ((fd = accept4(listener, nullptr, nullptr, SOCK_NONBLOCK)) >= 0)
+        { int on = 1;
+          setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, (char*)&on, sizeof(on));
+          if (!add(epoll, fd, EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET, next_id))
+          { cerr << "serve: epoll_ctl: " << strerror(errno) << ", dropping a client" << endl;
+            close(fd);
+            continue;
+          }
+          starved = false;
+          client& c = clients[next_id];
+          c.id = next_id++;
+          c.fd = fd;
+          c.next_seq = 0;
+          c.next_send = 0;
+          c.eof = c.failed = c.stalled = c.listed = false;
+        }
+        if (errno == EMFILE || errno == ENFILE || errno == ENOBUFS || errno == ENOMEM)
+        { if (!starved)
+            cerr << "serve: accept: " << strerror(errno) << ", waiting for a client to close" << endl;
+          starved = true;
+          listen_to(epoll, listener, false);
+          accepting = false;
+        }
+        else if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+          cerr << "serve: accept: " << strerror(errno) << endl;
+      }
+      else if (id == wake_id)
+      { uint64_t count;
+        if (read(s.wake, &count, sizeof(count)) < 0 && errno != EAGAIN)
+          cerr << "serve: eventfd: " << strerror(errno) << endl;
+        { lock_guard<mutex> l(s.answers_lock);
+          answers.swap(s.answers);
+        }
+        answered += answers.size();
+        for (answer& a : answers)
+        { auto it = clients.find(a.client);
+          if (it == clients.end()) // gone while its lines were scored
+            continue;
+          client& c = it->second;
+          if (a.seq != c.next_send)
+          { c.early[a.seq] = move(a.text);
+            continue;
+          }
+          c.out += a.text;
+          c.next_send++;
+          while (!c.early.empty() && c.early.begin()->first == c.next_send)
+          { c.out += c.early.begin()->second;
+            c.early.erase(c.early.begin());
+            c.next_send++;
+          }
+          touched.push_back(c.id);
+        }
+        answers.clear();
+
+        // the scoring threads made room in the queue
+        vector<uint64_t> retry;
+        retry.swap(stalled);
+        for (uint64_t r : retry)
+        { auto it = clients.find(r);
+          if (it != clients.end())
+          { it->second.listed = false;
+            read_client(s, it->second);
+            touched.push_back(r);
+          }
+        }
+      }
+      else
+      { auto it = clients.find(id);
+        if (it == clients.end())
+          continue;
+        client& c = it->second;
+        if (events[i].events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR))
+          read_client(s, c);
+        touched.push_back(id);
+      }
+    }
+
+    for (uint64_t id : touched)
+    { auto it = clients.find(id);
+      if (it == clients.end())
+        continue;
+      client& c = it->second;
+      if (!c.out.empty())
+        write_client(c);
+      if (finished(c))
+      { close(c.fd);
+        clients.erase(it);
+        closed = true;
+      }
+      else if (c.stalled && !c.listed)
+      { c.listed = true;
+        stalled.push_back(id);
+      }
+    }
+    if (!accepting && closed)
+    { listen_to(epoll, listener, true);
+      accepting = true;
+    }
+  }
+
+  stop_threads.stop(); // before the model they score with is finished
+  for (auto& c : clients)
+    close(c.second.fd);
+  close(epoll);
+  close(s.wake);
+  close(signals);
+  if (watch >= 0)
+    close(watch);
+  sigprocmask(SIG_UNBLOCK, &handled, nullptr);
+  if (!s.quiet)
+    cerr << "served " << answered << " lines to " << next_id - first_client << " clients" << endl;
+
+  vw& last = *s.current->all; // finished as any other run; the models before it were retired
+  delete s.current;
+  VW::sync_stats(last);
+  VW::finish(last);
+}
+#else
+void serve(vw&, int, char*[])
+{ THROW("serve needs epoll, which only linux has");
+}
+#endif
+}
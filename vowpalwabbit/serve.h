@@ -0,0 +1,14 @@
+/*
+Copyright (c) by respective owners including Yahoo!, Microsoft, and
+individual contributors. All rights reserved.  Released under a BSD
+license as described in the file LICENSE.
+ */
+#pragma once
+#include "global_data.h"
+
+namespace SERVE
+{
+// --serve: answers every client of the bound socket from this process until SIGTERM, and finishes all;
+// argv builds the models swapped in on SIGHUP or --serve_watch
+void serve(vw& all, int argc, char* argv[]);
+}
@@ -5,6 +5,7 @@ license as described in the file LICENSE.
 */
 
 #include "spanning_tree.h"
+#include "allreduce.h"
 #include "vw_exception.h"
 
 #include <string.h>
@@ -16,18 +17,34 @@ license as described in the file LICENSE.
 #include <fstream>
 #include <cmath>
 #include <map>
+#include <vector>
 #include <future>
+#include <ctime>
+#ifndef _WIN32
+#include <signal.h>
+#endif
 
 using namespace std;
 
 struct client
 { uint32_t client_ip;
   socket_t socket;
+  size_t id;
 };
 
 struct partial
 { client* nodes;
+  size_t total;
   size_t filled;
+  bool ring;
+  bool recover;
+};
+
+// A node of a recovering job with its place in a tree.  Its connection stays open, and it beats on it.
+struct member
+{ socket_t socket;
+  size_t id;
+  time_t heard; // when it last beat
 };
 
 static int socket_sort(const void* s1, const void* s2)
@@ -69,14 +86,90 @@ int build_tree(int*  parent, uint16_t* kid_count, size_t source_count, int offse
   return oroot;
 }
 
+// Each node's parent is the next node of the ring, and its one kid the previous one.
+void build_ring(int* parent, uint16_t* kid_count, size_t source_count)
+{ for (size_t i = 0; i < source_count; i++)
+  { parent[i] = source_count > 1 ? (int)((i + 1) % source_count) : -1;
+    kid_count[i] = source_count > 1 ? 1 : 0;
+  }
+}
+
 void fail_send(const socket_t fd, const void* buf, const int count)
 { if (send(fd, (char*)buf, count, 0) == -1)
     THROWERRNO("send: ");
 }
 
+// Closing the connections of a tree tells its nodes that it is lost; they join again for a new one.
+void drop_tree(map<size_t, vector<member>>& trees, map<size_t, vector<member>>::iterator tree)
+{ for (member& m : tree->second)
+    CLOSESOCK(m.socket);
+  trees.erase(tree);
+}
+
+// Reads the beats of the nodes in trees.  A tree loses a node that goes away without beat_done, or
+// that has not beat for timeout seconds, and is dropped.
+void check_trees(map<size_t, vector<member>>& trees, fd_set& fds, size_t timeout)
+{ time_t now = time(nullptr);
+  for (auto tree = trees.begin(); tree != trees.end();)
+  { vector<member>& nodes = tree->second;
+    bool lost = false;
+    for (size_t i = 0; i < nodes.size();)
+    { if (FD_ISSET(nodes[i].socket, &fds))
+      { char beat;
+        int read_size = recv(nodes[i].socket, &beat, 1, 0);
+        if (read_size == 1 && beat == beat_alive)
+          nodes[i].heard = now;
+        else if (read_size == 1 && beat == beat_done)
+        { CLOSESOCK(nodes[i].socket);
+          nodes.erase(nodes.begin() + i);
+          continue;
+        }
+        else
+        { cerr << "nonce " << tree->first << ": node " << nodes[i].id << " went away" << endl;
+          lost = true;
+        }
+      }
+      else if (now - nodes[i].heard > (time_t)timeout)
+      { cerr << "nonce " << tree->first << ": node " << nodes[i].id << " has not beat for " << timeout << " seconds" << endl;
+        lost = true;
+      }
+      i++;
+    }
+    if (lost)
+    { cerr << "nonce " << tree->first << ": dropping its tree, the nodes left join again" << endl;
+      drop_tree(trees, tree++);
+    }
+    else if (nodes.empty())
+      trees.erase(tree++);
+    else
+      ++tree;
+  }
+}
+
+// A node of a recovering job that goes away while it waits for the others leaves its place free for
+// the node started instead.  Waiting nodes send nothing, so anything they send counts as going away.
+void check_waiting(map<size_t, partial>& partial_nodesets, fd_set& fds)
+{ for (auto p = partial_nodesets.begin(); p != partial_nodesets.end();)
+  { partial& waiting = p->second;
+    for (size_t i = 0; waiting.recover && i < waiting.total; i++)
+      if (waiting.nodes[i].client_ip != (uint32_t)-1 && FD_ISSET(waiting.nodes[i].socket, &fds))
+      { cerr << "nonce " << p->first << ": waiting node " << i << " went away" << endl;
+        CLOSESOCK(waiting.nodes[i].socket);
+        waiting.nodes[i].client_ip = (uint32_t)-1;
+        waiting.filled--;
+      }
+    if (waiting.filled == 0)
+    { free(waiting.nodes);
+      partial_nodesets.erase(p++);
+    }
+    else
+      ++p;
+  }
+}
+
 namespace VW
 {
-SpanningTree::SpanningTree() : m_stop(false), port(26543), m_future(nullptr)
+SpanningTree::SpanningTree(size_t pheartbeat_timeout) : m_stop(false), port(26543), heartbeat_timeout(pheartbeat_timeout), m_future(nullptr)
 {
 #ifdef _WIN32
   WSAData wsaData;
@@ -116,7 +209,13 @@ void SpanningTree::Start()
 }
 
 void SpanningTree::Stop()
-{ CLOSESOCK(sock);
+{ // closing alone does not wake the accept in Run on Linux
+#ifdef _WIN32
+  shutdown(sock, SD_BOTH);
+#else
+  shutdown(sock, SHUT_RDWR);
+#endif
+  CLOSESOCK(sock);
   m_stop = true;
 
   // wait for run to stop
@@ -127,10 +226,41 @@ void SpanningTree::Stop()
 
 void SpanningTree::Run()
 { map<size_t, partial> partial_nodesets;
+  map<size_t, vector<member>> trees; // of recovering jobs, by nonce
+#ifndef _WIN32
+  signal(SIGPIPE, SIG_IGN); // sending to a node that died fails the send, not the span server
+#endif
   while (!m_stop)
   { if (listen(sock, 1024) < 0)
       THROWERRNO("listen: ");
 
+    // wake for connections, beats, and at least every second to time the beats out
+    fd_set fds;
+    FD_ZERO(&fds);
+    FD_SET(sock, &fds);
+    socket_t max_fd = sock;
+    for (auto& tree : trees)
+      for (member& m : tree.second)
+      { FD_SET(m.socket, &fds);
+        max_fd = (std::max)(max_fd, m.socket);
+      }
+    for (auto& p : partial_nodesets)
+      for (size_t i = 0; p.second.recover && i < p.second.total; i++)
+        if (p.second.nodes[i].client_ip != (uint32_t)-1)
+        { FD_SET(p.second.nodes[i].socket, &fds);
+          max_fd = (std::max)(max_fd, p.second.nodes[i].socket);
+        }
+    timeval second = { 1, 0 };
+    if (select((int)max_fd + 1, &fds, nullptr, nullptr, &second) < 0)
+    { if (m_stop || errno != EINTR)
+        break;
+      continue;
+    }
+    check_trees(trees, fds, heartbeat_timeout);
+    check_waiting(partial_nodesets, fds);
+    if (!FD_ISSET(sock, &fds))
+      continue;
+
     sockaddr_in client_address;
     socklen_t size = sizeof(client_address);
     socket_t f = accept(sock, (sockaddr*)&client_address, &size);
@@ -160,27 +290,40 @@ void SpanningTree::Run()
     size_t nonce = 0;
     if (recv(f, (char*)&nonce, sizeof(nonce), 0) != sizeof(nonce))
     { cerr << dotted_quad << "(" << hostname << ':' << ntohs(port)
-           << "): nonce read failed, exiting" << endl;
-      exit(1);
+           << "): nonce read failed, dropping it" << endl;
+      CLOSESOCK(f);
+      continue;
     }
     else cerr << dotted_quad << "(" << hostname << ':' << ntohs(port)
                 << "): nonce=" << nonce << endl;
     size_t total = 0;
     if (recv(f, (char*)&total, sizeof(total), 0) != sizeof(total))
     { cerr << dotted_quad << "(" << hostname << ':' << ntohs(port)
-           << "): total node count read failed, exiting" << endl;
-      exit(1);
+           << "): total node count read failed, dropping it" << endl;
+      CLOSESOCK(f);
+      continue;
     }
     else cerr << dotted_quad << "(" << hostname << ':' << ntohs(port)
                 << "): total=" << total << endl;
     size_t id = 0;
     if (recv(f, (char*)&id, sizeof(id), 0) != sizeof(id))
     { cerr << dotted_quad << "(" << hostname << ':' << ntohs(port)
-           << "): node id read failed, exiting" << endl;
-      exit(1);
+           << "): node id read failed, dropping it" << endl;
+      CLOSESOCK(f);
+      continue;
+    }
+    bool ring = (id & ring_request) != 0;
+    bool recover = (id & recover_request) != 0;
+    id &= ~(ring_request | recover_request);
+    cerr << dotted_quad << "(" << hostname << ':' << ntohs(port)
+         << "): node id=" << id << (ring ? " (ring)" : "") << (recover ? " (recover)" : "") << endl;
+
+    // a node joining a recovering job that has a tree lost its place in it: so do the others
+    auto tree = trees.find(nonce);
+    if (recover && tree != trees.end())
+    { cerr << "nonce " << nonce << ": node " << id << " joins again, dropping its tree" << endl;
+      drop_tree(trees, tree);
     }
-    else cerr << dotted_quad << "(" << hostname << ':' << ntohs(port)
-                << "): node id=" << id << endl;
 
     int ok = true;
     if (id >= total)
@@ -194,7 +337,10 @@ void SpanningTree::Run()
     { partial_nodeset.nodes = (client*)calloc(total, sizeof(client));
       for (size_t i = 0; i < total; i++)
         partial_nodeset.nodes[i].client_ip = (uint32_t)-1;
+      partial_nodeset.total = total;
       partial_nodeset.filled = 0;
+      partial_nodeset.ring = ring;
+      partial_nodeset.recover = recover;
     }
     else
     { partial_nodeset = partial_nodesets[nonce];
@@ -203,13 +349,29 @@ void SpanningTree::Run()
 
     if (ok && partial_nodeset.nodes[id].client_ip != (uint32_t)-1)
       ok = false;
-    fail_send(f, &ok, sizeof(ok));
+    if (ok && partial_nodeset.ring != ring)
+    { cout << dotted_quad << "(" << hostname << ':' << ntohs(port)
+           << "): node " << id << (ring ? " asks for a ring" : " asks for a tree")
+           << " but nonce " << nonce << (ring ? " has a tree" : " has a ring") << " !" << endl;
+      ok = false;
+    }
+    if (ok && partial_nodeset.recover != recover)
+    { cout << dotted_quad << "(" << hostname << ':' << ntohs(port)
+           << "): node " << id << (recover ? " recovers" : " does not recover")
+           << " but nonce " << nonce << (recover ? " does not" : " does") << " !" << endl;
+      ok = false;
+    }
+    if (send(f, (char*)&ok, sizeof(ok), 0) != sizeof(ok))
+      ok = false;
 
     if (ok)
     { partial_nodeset.nodes[id].client_ip = client_address.sin_addr.s_addr;
       partial_nodeset.nodes[id].socket = f;
+      partial_nodeset.nodes[id].id = id;
       partial_nodeset.filled++;
     }
+    else
+      CLOSESOCK(f);
     if (partial_nodeset.filled != total) //Need to wait for more connections
     { partial_nodesets[nonce] = partial_nodeset;
       for (size_t i = 0; i < total; i++)
@@ -227,35 +389,55 @@ void SpanningTree::Run()
 
       int* parent = (int*)calloc(total, sizeof(int));
       uint16_t* kid_count = (uint16_t*)calloc(total, sizeof(uint16_t));
-
-      int root = build_tree(parent, kid_count, total, 0);
-      parent[root] = -1;
-
-      for (size_t i = 0; i < total; i++)
-      { fail_send(partial_nodeset.nodes[i].socket, &kid_count[i], sizeof(kid_count[i]));
-      }
-
       uint16_t* client_ports = (uint16_t*)calloc(total, sizeof(uint16_t));
 
-      for (size_t i = 0; i < total; i++)
-      { int done = 0;
-        if (recv(partial_nodeset.nodes[i].socket, (char*)&(client_ports[i]), sizeof(client_ports[i]), 0) < (int) sizeof(client_ports[i]))
-          cerr << " Port read failed for node " << i << " read " << done << endl;
-      }// all clients have bound to their ports.
+      if (partial_nodeset.ring)
+        build_ring(parent, kid_count, total);
+      else
+      { int root = build_tree(parent, kid_count, total, 0);
+        parent[root] = -1;
+      }
 
-      for (size_t i = 0; i < total; i++)
-      { if (parent[i] >= 0)
-        { fail_send(partial_nodeset.nodes[i].socket, &partial_nodeset.nodes[parent[i]].client_ip, sizeof(partial_nodeset.nodes[parent[i]].client_ip));
-          fail_send(partial_nodeset.nodes[i].socket, &client_ports[parent[i]], sizeof(client_ports[parent[i]]));
+      // a node that died meanwhile fails the tree, and the others join again
+      bool built = false;
+      try
+      { for (size_t i = 0; i < total; i++)
+        { fail_send(partial_nodeset.nodes[i].socket, &kid_count[i], sizeof(kid_count[i]));
         }
-        else
-        { int bogus = -1;
-          uint32_t bogus2 = -1;
-          fail_send(partial_nodeset.nodes[i].socket, &bogus2, sizeof(bogus2));
-          fail_send(partial_nodeset.nodes[i].socket, &bogus, sizeof(bogus));
+
+        for (size_t i = 0; i < total; i++)
+        { if (recv(partial_nodeset.nodes[i].socket, (char*)&(client_ports[i]), sizeof(client_ports[i]), 0) < (int) sizeof(client_ports[i]))
+            THROW("port read failed for node " << partial_nodeset.nodes[i].id);
+        }// all clients have bound to their ports.
+
+        for (size_t i = 0; i < total; i++)
+        { if (parent[i] >= 0)
+          { fail_send(partial_nodeset.nodes[i].socket, &partial_nodeset.nodes[parent[i]].client_ip, sizeof(partial_nodeset.nodes[parent[i]].client_ip));
+            fail_send(partial_nodeset.nodes[i].socket, &client_ports[parent[i]], sizeof(client_ports[parent[i]]));
+          }
+          else
+          { uint16_t bogus = (uint16_t)-1; // the size of the port nodes read: nothing is left over on a connection kept
+            uint32_t bogus2 = -1;
+            fail_send(partial_nodeset.nodes[i].socket, &bogus2, sizeof(bogus2));
+            fail_send(partial_nodeset.nodes[i].socket, &bogus, sizeof(bogus));
+          }
+          if (partial_nodeset.ring) // nodes sorted by address take their places in this order
+            fail_send(partial_nodeset.nodes[i].socket, &i, sizeof(i));
         }
-        CLOSESOCK(partial_nodeset.nodes[i].socket);
+        built = true;
+      }
+      catch (VW::vw_exception& e)
+      { cerr << "nonce " << nonce << ": building the tree failed: " << e.what() << endl;
+      }
+
+      if (built && partial_nodeset.recover)
+      { vector<member>& tree = trees[nonce];
+        for (size_t i = 0; i < total; i++)
+          tree.push_back({ partial_nodeset.nodes[i].socket, partial_nodeset.nodes[i].id, time(nullptr) });
       }
+      else
+        for (size_t i = 0; i < total; i++)
+          CLOSESOCK(partial_nodeset.nodes[i].socket);
       free(client_ports);
       free(partial_nodeset.nodes);
       free(parent);
@@ -45,13 +45,14 @@ private:
   bool m_stop;
   socket_t sock;
   short unsigned int port;
+  size_t heartbeat_timeout; // seconds a node of a recovering job may go without beating
 
   // future to signal end of thread running.
   // Need a pointer since C++/CLI doesn't like futures yet
   std::future<void>* m_future;
 
 public:
-  SpanningTree();
+  SpanningTree(size_t pheartbeat_timeout = 10);
   ~SpanningTree();
 
   void Start();
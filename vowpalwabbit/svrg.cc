@@ -161,8 +161,9 @@ base_learner* svrg_setup(vw& all)
   s.prev_pass = -1;
   s.stable_grad_count = 0;
 
-  // Request more parameter storage (4 floats per feature)
-  all.weights.stride_shift(2);
+  // Request more parameter storage (4 floats per feature), unless only predicting, which just
+  // reads the inner weights
+  all.weights.stride_shift(all.training ? 2 : 0);
   learner<svrg>& l = init_learner(&s, learn, UINT64_ONE << all.weights.stride_shift());
 
   l.set_predict(predict);
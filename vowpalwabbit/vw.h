@@ -28,6 +28,7 @@ namespace VW
    */
 vw* initialize(std::string s, io_buf* model=nullptr, bool skipModelLoad=false, trace_message_t trace_listener = nullptr, void* trace_context = nullptr);
 vw* initialize(int argc, char* argv[], io_buf* model=nullptr, bool skipModelLoad = false, trace_message_t trace_listener = nullptr, void* trace_context = nullptr);
+// a new instance that shares the weights and statistics of vw_model, which must outlive it
 vw* seed_vw_model(vw* vw_model, std::string extra_args, trace_message_t trace_listener = nullptr, void* trace_context = nullptr);
 
 void cmd_string_replace_value( std::stringstream*& ss, std::string flag_to_replace, std::string new_value );
@@ -76,6 +77,7 @@ void setup_examples(vw& all, v_array<example*>& examples);
 void setup_example(vw& all, example* ae);
 example* new_unused_example(vw& all);
 example* get_example(parser* pf);
+example* try_get_example(parser* pf); // nullptr instead of waiting when no parsed example is ready
 float get_topic_prediction(example*ec, size_t i);//i=0 to max topic -1
 float get_label(example*ec);
 float get_importance(example*ec);
@@ -9,8 +9,11 @@ license as described in the file LICENSE.
 #include "vw.h"
 #include "allreduce.h"
 
+void wait_for_average(vw& all); // accumulate.cc
+
 template <class T, void(*f)(T&, const T&)> void all_reduce(vw& all, T* buffer, const size_t n)
-{ switch (all.all_reduce_type)
+{ wait_for_average(all);
+  switch (all.all_reduce_type)
   { case AllReduceType::Socket:
       ((AllReduceSockets*)all.all_reduce)->all_reduce<T, f>(buffer, n);
       break;
@@ -20,3 +23,19 @@ template <class T, void(*f)(T&, const T&)> void all_reduce(vw& all, T* buffer, c
       break;
   }
 }
+
+void add_float(float& c1, const float& c2);
+
+// Sums floats, sent between nodes as wire has them.
+inline void all_reduce_sum(vw& all, float* buffer, const size_t n, wire_format wire)
+{ wait_for_average(all);
+  switch (all.all_reduce_type)
+  { case AllReduceType::Socket:
+      ((AllReduceSockets*)all.all_reduce)->all_reduce_sum(buffer, n, wire);
+      break;
+
+    case AllReduceType::Thread:
+      ((AllReduceThreads*)all.all_reduce)->all_reduce<float, add_float>(buffer, n);
+      break;
+  }
+}